@@ -0,0 +1,27 @@
+#version 450 core
+
+out vec4 FragColor;
+
+in vec3 TexCoord;
+
+uniform sampler3D texture1;
+uniform sampler1D transferFunction; //TransferFunction::table, premultiplied RGBA per voxel value
+uniform sampler2D lightBuffer;
+uniform mat4 lightViewProjection;
+
+const float AMBIENT = 0.25f;
+
+//Eye pass of half-angle slicing: the light buffer holds the opacity accumulated
+//between the light and this slice, which gives the single-scatter shadow term.
+void main()
+{
+	float amplitude = texture(texture1, TexCoord).x;
+	vec4 classified = texture(transferFunction, (amplitude * 255.0f + 0.5f) / 256.0f);
+
+	//TexCoord is twice the world position, see verticesTexCoords.
+	vec4 lightPos = lightViewProjection * vec4(TexCoord * 0.5f, 1.0f);
+	vec2 lightUV = lightPos.xy / lightPos.w * 0.5f + 0.5f;
+	float transmittance = 1.0f - texture(lightBuffer, lightUV).a;
+
+	FragColor = vec4(classified.rgb * (AMBIENT + (1.0f - AMBIENT) * transmittance), classified.a);
+}
\ No newline at end of file
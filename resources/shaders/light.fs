@@ -0,0 +1,15 @@
+#version 450 core
+
+out vec4 FragColor;
+
+in vec3 TexCoord;
+
+uniform sampler3D texture1;
+uniform sampler1D transferFunction; //TransferFunction::table, premultiplied RGBA per voxel value
+
+//Light pass of half-angle slicing, only the opacity seen from the light is accumulated.
+void main()
+{
+	float amplitude = texture(texture1, TexCoord).x;
+	FragColor = vec4(0.0f, 0.0f, 0.0f, texture(transferFunction, (amplitude * 255.0f + 0.5f) / 256.0f).a);
+}
\ No newline at end of file
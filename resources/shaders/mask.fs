@@ -0,0 +1,11 @@
+#version 450 core
+
+uniform sampler2D accumulation;
+uniform float threshold;
+
+//Only pixels whose accumulated opacity reached the threshold survive and write the stencil mask.
+void main()
+{
+	if (texelFetch(accumulation, ivec2(gl_FragCoord.xy), 0).a < threshold)
+		discard;
+}
\ No newline at end of file
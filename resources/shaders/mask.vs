@@ -0,0 +1,8 @@
+#version 450 core
+
+//Fullscreen triangle, no vertex attributes are read.
+void main()
+{
+	vec2 pos = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(pos * 2.0f - 1.0f, 0.0f, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#version 450 core
+
+out vec4 FragColor;
+
+uniform sampler2D accumulation;
+uniform int projectionMode; //ProjectionMode, 2 minimum or 3 average
+
+//Alpha counts the slices blended into a pixel: none leaves the background, the mean divides by it.
+void main()
+{
+	vec4 accumulated = texelFetch(accumulation, ivec2(gl_FragCoord.xy), 0);
+	if (accumulated.a <= 0.0f)
+		FragColor = vec4(0.0f, 0.0f, 0.0f, 1.0f);
+	else if (projectionMode == 3)
+		FragColor = vec4(accumulated.rgb / accumulated.a, 1.0f);
+	else
+		FragColor = vec4(accumulated.rgb, 1.0f);
+}
\ No newline at end of file
@@ -0,0 +1,56 @@
+#version 450 core
+
+//View-aligned slice polygons generated on the GPU (Rezk-Salama & Kolb).
+//gl_VertexID is the polygon vertex (0..5) from a static index buffer and
+//gl_InstanceID the slice, so no geometry is uploaded per frame.
+//SliceProxy::sliceVertex() in ProxyGeometry.h is the CPU copy of this shader.
+
+const int v1[24] = int[24](0,1,4,4, 1,0,1,4, 0,2,5,5, 2,0,2,5, 0,3,6,6, 3,0,3,6);
+const int v2[24] = int[24](1,4,7,7, 5,1,4,7, 2,5,7,7, 6,2,5,7, 3,6,7,7, 4,3,6,7);
+const float LAMBDA_EPSILON = 1e-4f;
+
+uniform vec3 vecVertices[8];
+uniform int nSequence[64];
+
+uniform int frontIdx;
+uniform vec3 vecView;
+uniform float dPlaneStart;
+uniform float dPlaneIncr;
+uniform int sliceOffset;
+
+uniform mat4 view;
+uniform mat4 projection;
+out vec3 TexCoord;
+
+void main()
+{
+	float dPlane = dPlaneStart + (sliceOffset + gl_InstanceID) * dPlaneIncr;
+	vec3 position = vecVertices[frontIdx];
+	bool nearMiss = false;
+
+	for (int e = 0; e < 4; ++e)
+	{
+		int vidx1 = nSequence[frontIdx * 8 + v1[gl_VertexID * 4 + e]];
+		int vidx2 = nSequence[frontIdx * 8 + v2[gl_VertexID * 4 + e]];
+		vec3 vecV1 = vecVertices[vidx1];
+		vec3 vecV2 = vecVertices[vidx2];
+		vec3 vecDir = vecV2 - vecV1;
+		float denom = dot(vecDir, vecView);
+		float lambda = (denom != 0.0f) ? (dPlane - dot(vecV1, vecView)) / denom : -1.0f;
+		if (lambda >= 0.0f && lambda <= 1.0f)
+		{
+			position = vecV1 + lambda * vecDir;
+			break;
+		}
+		//Rounding where a plane passes through a vertex, unless a later edge is cut.
+		if (!nearMiss && lambda >= -LAMBDA_EPSILON && lambda <= 1.0f + LAMBDA_EPSILON)
+		{
+			position = vecV1 + clamp(lambda, 0.0f, 1.0f) * vecDir;
+			nearMiss = true;
+		}
+	}
+
+	gl_Position = projection * view * vec4(position, 1.0f);
+	//Same mapping as verticesTexCoords: the proxy cube [-0.5,0.5] carries texture coordinates [-1,1].
+	TexCoord = position * 2.0f;
+}
\ No newline at end of file
@@ -5,9 +5,226 @@ out vec4 FragColor;
 in vec3 TexCoord;
 
 uniform sampler3D texture1;
+uniform sampler1D transferFunction; //TransferFunction::table, premultiplied RGBA per voxel value
+uniform float opacityExponent; //sliceSpacing over the spacing the transfer function's opacity is meant for
+uniform bool preIntegrated;
+uniform bool gradientClassification;
+uniform sampler2D transferFunction2D; //TransferFunction2D::table, value along s and gradient magnitude along t
+uniform sampler2D preIntegration; //PreIntegrationTable, back value along s and front value along t
+uniform int projectionMode; //ProjectionMode: 0 composite, 4 isosurface, else maximum, minimum or average by the blend equation
+uniform int shadingMode; //ShadingMode: 0 unlit, 1 gradient of six more fetches, 2 quantized normal of the nearest voxel
+uniform sampler2D normalTable; //GradientMagnitude::normalTable(), u along s and v along t
+uniform sampler3D normalVolume; //GradientMagnitude::interleaveNormals(), (u, v) per voxel
+uniform bool ambientOcclusion;
+uniform sampler3D occlusionVolume; //AmbientOcclusion::visibility, one texel per cell
+uniform vec3 occlusionScale; //AmbientOcclusion::textureScale()
+uniform bool cubicFiltering;
+uniform sampler1D cubicOffsets; //cubicOffsets() of Volume.h, (h0, h1, g0) per fraction along s
+uniform bool labeled;
+uniform usampler3D labelVolume; //LabelVolume::data, nearest and clamped to the edge
+uniform sampler2D labelTable; //LabelVolume::table, 256 labels per row
+uniform bool fused;
+uniform sampler3D fusedVolume; //FusedVolume::volume, its own size and placement
+uniform sampler1D fusedTransfer; //FusedVolume::transferFunction's table
+uniform mat4 fusedFromTexCoord; //FusedVolume::texFromWorld from TexCoord, i.e. times 0.5
+uniform int fusionOperator; //FusionOperator: 0 over, 1 add, 2 maximum, 3 blend, 4 mask
+uniform float fusionWeight;
+
+//Isosurface, pre-integrated and shaded modes, all in world space (TexCoord * 0.5).
+uniform float isoValue;
+uniform vec3 eyePosition;
+uniform vec3 viewDirection;
+uniform float sliceSpacing;
+uniform sampler3D brickRange; //MinMaxGrid level 0, min and max of every brick in r and g
+uniform int brickSize;
+
+const int ISO_REFINEMENT_STEPS = 4;
+const float AMBIENT = 0.15f, DIFFUSE = 0.7f, SPECULAR = 0.25f, SHININESS = 32.0f;
+const float SHADING_MAGNITUDE = 16.0f;
+
+//Where the ray through position crosses the slice sliceSpacing nearer the eye.
+vec3 previousSlice(vec3 position)
+{
+	float d = dot(position - eyePosition, viewDirection);
+	return eyePosition + (position - eyePosition) * (max(d - sliceSpacing, 0.0f) / d);
+}
+
+bool brickMayCross(vec3 texCoord)
+{
+	vec3 u = texCoord * vec3(textureSize(texture1, 0)) - 0.5f;
+	ivec3 brick = clamp(ivec3(floor(u / brickSize)), ivec3(0), textureSize(brickRange, 0) - 1);
+	vec2 range = texelFetch(brickRange, brick, 0).rg;
+	return range.x <= isoValue && isoValue <= range.y;
+}
+
+//Same as Volume::gradient(), per unit of texture coordinate.
+vec3 gradientAt(vec3 texCoord)
+{
+	vec3 h = 1.0f / vec3(textureSize(texture1, 0));
+	return vec3(
+		texture(texture1, texCoord + vec3(h.x, 0.0f, 0.0f)).x - texture(texture1, texCoord - vec3(h.x, 0.0f, 0.0f)).x,
+		texture(texture1, texCoord + vec3(0.0f, h.y, 0.0f)).x - texture(texture1, texCoord - vec3(0.0f, h.y, 0.0f)).x,
+		texture(texture1, texCoord + vec3(0.0f, 0.0f, h.z)).x - texture(texture1, texCoord - vec3(0.0f, 0.0f, h.z)).x) / (2.0f * h);
+}
+
+//Same as Volume::sampleCubic(): the B-spline over 4x4x4 voxels as a blend of 8 trilinear
+//fetches, placed by the offsets table so each one weighs two voxels per axis.
+vec4 sampleCubic(vec3 texCoord)
+{
+	vec3 size = vec3(textureSize(texture1, 0));
+	vec3 u = texCoord * size - 0.5f;
+	vec3 i = floor(u), a = (u - i) * 255.0f + 0.5f;
+	vec3 x = texture(cubicOffsets, a.x / 256.0f).xyz, y = texture(cubicOffsets, a.y / 256.0f).xyz, z = texture(cubicOffsets, a.z / 256.0f).xyz;
+	vec3 p0 = (i + vec3(x.x, y.x, z.x) + 0.5f) / size, p1 = (i + vec3(x.y, y.y, z.y) + 0.5f) / size;
+	vec3 g0 = vec3(x.z, y.z, z.z);
+	vec4 c00 = mix(texture(texture1, vec3(p1.x, p0.y, p0.z)), texture(texture1, p0), g0.x);
+	vec4 c10 = mix(texture(texture1, vec3(p1.x, p1.y, p0.z)), texture(texture1, vec3(p0.x, p1.y, p0.z)), g0.x);
+	vec4 c01 = mix(texture(texture1, vec3(p1.x, p0.y, p1.z)), texture(texture1, vec3(p0.x, p0.y, p1.z)), g0.x);
+	vec4 c11 = mix(texture(texture1, p1), texture(texture1, vec3(p0.x, p1.y, p1.z)), g0.x);
+	return mix(mix(c11, c01, g0.y), mix(c10, c00, g0.y), g0.z);
+}
+
+//What composited and projected samples read; isosurfaces stay trilinear.
+vec4 sampleVolume(vec3 texCoord)
+{
+	return cubicFiltering ? sampleCubic(texCoord) : texture(texture1, texCoord);
+}
+
+//Same as LabelVolume::lookup(): what the classified sample is multiplied by.
+vec4 labelStyle()
+{
+	uint label = texture(labelVolume, TexCoord).r;
+	return texelFetch(labelTable, ivec2(label & 255u, label >> 8u), 0);
+}
+
+//Same as RayCaster::shade(): the quantized normal costs two nearest fetches and the table,
+//scaled by the size it points along the gradient like the one computed from six fetches.
+vec4 shade(vec4 classified)
+{
+	vec3 size = vec3(textureSize(texture1, 0));
+	vec3 gradient;
+	float magnitude;
+	if (shadingMode == 2)
+	{
+		ivec3 voxel = clamp(ivec3(floor(TexCoord * size)), ivec3(0), ivec3(size) - 1);
+		gradient = texelFetch(normalTable, ivec2(round(texelFetch(normalVolume, voxel, 0).xy * 255.0f)), 0).xyz * size;
+		magnitude = texelFetch(texture1, voxel, 0).y * 255.0f;
+	}
+	else
+	{
+		gradient = gradientAt(TexCoord);
+		magnitude = length(gradient * 2.0f / size) * 255.0f;
+	}
+	float norm = length(gradient);
+	float facing = norm > 0.0f ? abs(dot(gradient / norm, normalize(TexCoord * 0.5f - eyePosition))) : 1.0f;
+	vec4 lit = vec4(classified.rgb * (AMBIENT + DIFFUSE * facing) + SPECULAR * pow(facing, SHININESS) * classified.a, classified.a);
+	return mix(classified, lit, min(magnitude / SHADING_MAGNITUDE, 1.0f));
+}
+
+//Same as RayCaster::castRay(): the color dimmed by the visibility around the sample.
+vec4 occlude(vec4 classified)
+{
+	return vec4(classified.rgb * texture(occlusionVolume, TexCoord * occlusionScale).r, classified.a);
+}
+
+//Same as FusedVolume::classify() and fuseSamples(): the other volume classified by its own
+//transfer function where this fragment lies in it, then combined with the sample of texture1.
+vec4 fuse(vec4 primary)
+{
+	float value = texture(fusedVolume, (fusedFromTexCoord * vec4(TexCoord, 1.0f)).xyz).r;
+	vec4 classified = texture(fusedTransfer, (value * 255.0f + 0.5f) / 256.0f);
+	float alpha = 1.0f - pow(1.0f - classified.a, opacityExponent);
+	vec4 other = classified.a > 0.0f ? vec4(classified.rgb * (alpha / classified.a), alpha) : vec4(0.0f);
+	if (fusionOperator == 0)
+		return primary + (1.0f - primary.a) * other;
+	if (fusionOperator == 1)
+		return min(primary + other, vec4(1.0f));
+	if (fusionOperator == 2)
+		return other.a > primary.a ? other : primary;
+	if (fusionOperator == 3)
+		return mix(primary, other, fusionWeight);
+	return primary * other.a;
+}
+
+//Same as RayCaster::castIsosurface(): a crossing between this slice and the one sliceSpacing
+//nearer is refined with regula falsi and shaded like shadeIsosurface(). Opaque, so both the
+//over and the under operator keep the nearest crossing of a pixel.
+vec4 isosurface(float amplitude)
+{
+	vec3 position = TexCoord * 0.5f;
+	vec3 previous = previousSlice(position);
+	//The crossing point lies in a brick whose range holds the iso-value, at one of the two ends.
+	if (!brickMayCross(TexCoord) && !brickMayCross(previous * 2.0f))
+		discard;
+
+	float f0 = texture(texture1, previous * 2.0f).x - isoValue, f1 = amplitude - isoValue;
+	if ((f0 < 0.0f) == (f1 < 0.0f))
+		discard;
+	vec3 p0 = previous * 2.0f, p1 = TexCoord;
+	for (int i = 0; i < ISO_REFINEMENT_STEPS && f1 != f0; i++)
+	{
+		vec3 middle = mix(p0, p1, f0 / (f0 - f1));
+		float f = texture(texture1, middle).x - isoValue;
+		if ((f < 0.0f) == (f0 < 0.0f))
+		{
+			p0 = middle;
+			f0 = f;
+		}
+		else
+		{
+			p1 = middle;
+			f1 = f;
+		}
+	}
+	vec3 hit = f1 != f0 ? mix(p0, p1, f0 / (f0 - f1)) : p1;
+
+	vec3 gradient = gradientAt(hit);
+	float facing = length(gradient) > 0.0f ? abs(dot(normalize(gradient), normalize(position - eyePosition))) : 1.0f;
+	float intensity = AMBIENT + DIFFUSE * facing + SPECULAR * pow(facing, SHININESS);
+	return vec4(intensity, intensity, intensity, 1.0f);
+}
 
 void main()
 {
-	float amplitude = texture(texture1, TexCoord).x;
-	FragColor = vec4(amplitude, amplitude, amplitude, amplitude);
+	if (projectionMode == 4)
+	{
+		FragColor = isosurface(texture(texture1, TexCoord).x);
+		return;
+	}
+	vec2 voxel = sampleVolume(TexCoord).xy; //value and GradientMagnitude
+	float amplitude = voxel.x;
+	//The projections see the raw value, alpha marks the pixel as covered (and counts slices for the mean).
+	if (projectionMode != 0)
+	{
+		FragColor = vec4(amplitude, amplitude, amplitude, 1.0f);
+		return;
+	}
+	//Premultiplied alpha so the same output works with the over and the under operator.
+	//Pre-integrated, the fragment stands for the ray segment back to the previous slice.
+	if (preIntegrated)
+	{
+		float front = sampleVolume(previousSlice(TexCoord * 0.5f) * 2.0f).x;
+		FragColor = texture(preIntegration, (vec2(amplitude, front) * 255.0f + 0.5f) / 256.0f);
+		if (labeled)
+			FragColor *= labelStyle();
+		if (shadingMode != 0 && FragColor.a > 0.0f)
+			FragColor = shade(FragColor);
+		if (ambientOcclusion)
+			FragColor = occlude(FragColor);
+		if (fused)
+			FragColor = fuse(FragColor);
+		return;
+	}
+	vec4 classified = gradientClassification ? texture(transferFunction2D, (voxel * 255.0f + 0.5f) / 256.0f)
+	                                         : texture(transferFunction, (amplitude * 255.0f + 0.5f) / 256.0f);
+	float alpha = 1.0f - pow(1.0f - classified.a, opacityExponent);
+	FragColor = classified.a > 0.0f ? vec4(classified.rgb * (alpha / classified.a), alpha) : vec4(0.0f);
+	if (labeled)
+		FragColor *= labelStyle();
+	if (shadingMode != 0 && FragColor.a > 0.0f)
+		FragColor = shade(FragColor);
+	if (ambientOcclusion)
+		FragColor = occlude(FragColor);
+	if (fused)
+		FragColor = fuse(FragColor);
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 450 core
+
+out vec4 FragColor;
+
+in vec3 SliceCoord;
+
+uniform sampler2DArray stack;
+uniform sampler1D transferFunction; //TransferFunction::table, premultiplied RGBA per voxel value
+uniform float opacityExponent; //slice distance along the view ray over the 3D slice spacing
+
+void main()
+{
+	float amplitude = texture(stack, SliceCoord).x; //bilinear inside the slice only
+	vec4 classified = texture(transferFunction, (amplitude * 255.0f + 0.5f) / 256.0f);
+	//Opacity correction, object-aligned slices are not sliceSpacing apart along the rays.
+	float alpha = 1.0f - pow(1.0f - classified.a, opacityExponent);
+	vec3 color = classified.a > 0.0f ? classified.rgb * (alpha / classified.a) : vec3(0.0f);
+	FragColor = vec4(color, alpha);
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#version 450 core
+
+//One quad per slice of an object-aligned stack, nothing is read from vertex buffers.
+//gl_VertexID picks the quad corner and gl_InstanceID the slice.
+const vec2 corners[6] = vec2[6](vec2(0,0), vec2(1,0), vec2(1,1), vec2(0,0), vec2(1,1), vec2(0,1));
+
+uniform int axis; //0: x stack, 1: y stack, 2: z stack
+uniform int layerCount;
+uniform bool ascending; //draw layer 0 first
+uniform mat4 view;
+uniform mat4 projection;
+
+out vec3 SliceCoord; //slice image uv and layer
+
+void main()
+{
+	int layer = ascending ? gl_InstanceID : layerCount - 1 - gl_InstanceID;
+	vec2 uv = corners[gl_VertexID];
+	float w = (layer + 0.5f) / layerCount;
+
+	vec3 texCoord;
+	if (axis == 0)
+		texCoord = vec3(w, uv.x, uv.y);
+	else if (axis == 1)
+		texCoord = vec3(uv.x, w, uv.y);
+	else
+		texCoord = vec3(uv.x, uv.y, w);
+
+	//The data occupies the [0,0.5] octant of the proxy cube, see verticesTexCoords.
+	gl_Position = projection * view * vec4(texCoord * 0.5f, 1.0f);
+	SliceCoord = vec3(uv, layer);
+}
\ No newline at end of file
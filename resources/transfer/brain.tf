@@ -0,0 +1,10 @@
+# value r g b a
+# Values in [0,255], colors and opacity in [0,1], not premultiplied.
+# Noise below 24 stays transparent, so empty space skipping keeps its bricks.
+0   0.00 0.00 0.00 0.00
+24  0.00 0.00 0.00 0.00
+64  0.55 0.20 0.10 0.02
+128 0.90 0.55 0.35 0.08
+176 0.95 0.80 0.60 0.30
+224 1.00 1.00 0.95 0.80
+255 1.00 1.00 1.00 1.00
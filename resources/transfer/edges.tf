@@ -0,0 +1,8 @@
+# value r g b a
+# For a gradient magnitude volume fused with the data (Q): weak gradients stay
+# transparent, strong boundaries show in blue to cyan.
+0   0.00 0.00 0.00 0.00
+48  0.00 0.00 0.00 0.00
+96  0.10 0.25 0.90 0.03
+160 0.20 0.70 1.00 0.15
+255 0.60 1.00 1.00 0.60
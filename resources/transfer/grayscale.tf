@@ -0,0 +1,4 @@
+# value r g b a
+# The grayscale ramp the renderers start with, premultiplied (a^2, a^2, a^2, a).
+0   0 0 0 0
+255 1 1 1 1
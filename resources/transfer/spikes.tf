@@ -0,0 +1,11 @@
+# value r g b a
+# Two narrow opacity peaks, the kind of transfer function slices miss when
+# the value jumps over a peak between them. Try it with pre-integration (J).
+0   0.0 0.0 0.0 0.0
+140 0.0 0.0 0.0 0.0
+144 1.0 0.6 0.3 0.6
+148 0.0 0.0 0.0 0.0
+200 0.0 0.0 0.0 0.0
+204 0.9 0.9 1.0 0.8
+208 0.0 0.0 0.0 0.0
+255 0.0 0.0 0.0 0.0
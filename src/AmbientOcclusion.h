@@ -0,0 +1,419 @@
+#ifndef AMBIENT_OCCLUSION_H
+#define AMBIENT_OCCLUSION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+
+#include "Volume.h"
+#include "TransferFunction.h"
+#include "TileScheduler.h"
+
+// Ambient occlusion precomputed from the classification instead of per frame,
+// as a low resolution volume of visibilities, one per cellSize^3 voxels. A
+// cell's density is the mean opacity of its voxels, the voxels outside the grid
+// counting as empty. A summed-volume table of the densities gives the sum over
+// any box of cells in eight lookups, and a cell's visibility is one minus the
+// mean density of the boxes of RADII half-widths around it: a box-filtered
+// stand-in for cones in every direction, in which a near occluder counts more
+// because it lies in every box. Outside the grid is empty as well.
+// Renderers multiply the color of a classified sample by the trilinear
+// visibility at its position, sample() on the CPU and a texture of
+// visibility in shader.fs.
+// update() compares the opacity with the one the volume was built from like
+// PreIntegrationTable does. Only cells whose value range holds a changed entry
+// get a new density, the table is summed again from the first slab of cells
+// that changed, and only visibilities within the largest radius of a changed
+// density are recomputed. Slabs of cells are spread over the TileScheduler.
+class AmbientOcclusion
+{
+public:
+    static const int RADIUS_COUNT = 4;
+    static constexpr int RADII[RADIUS_COUNT] = {1, 2, 4, 8}; //in cells
+    const Volume& volume;
+    int cellSize; //in voxels
+    int width, height, depth; //in cells
+    std::vector<unsigned char> visibility; //per cell, 255 unoccluded
+    unsigned int threadCount;
+    double buildMilliseconds = 0.0; //last update() that changed anything
+    size_t rebuiltCells = 0; //densities recomputed by it
+    size_t occludedCells = 0; //visibilities recomputed by it
+    glm::ivec3 changedLow, changedHigh; //box around those, inclusive, empty if low > high
+
+    AmbientOcclusion(const Volume& volume, int cellSize = 2) : volume(volume)
+    {
+        this->cellSize = cellSize;
+        width = (volume.width + cellSize - 1) / cellSize;
+        height = (volume.height + cellSize - 1) / cellSize;
+        depth = (volume.depth + cellSize - 1) / cellSize;
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        changedLow = glm::ivec3(0);
+        changedHigh = glm::ivec3(-1);
+    }
+
+    // Takes the opacity per voxel value, 256 entries like MinMaxGrid::classify().
+    // Returns whether any visibility changed.
+    bool update(const std::vector<float>& opacity)
+    {
+        int first = 0, last = TransferFunction::SIZE - 1;
+        bool full = density.empty();
+        if (!full)
+        {
+            first = TransferFunction::SIZE;
+            last = -1;
+            for(int v = 0; v < TransferFunction::SIZE; v++)
+            {
+                if (built[v] == opacity[v])
+                    continue;
+                first = std::min(first, v);
+                last = v;
+            }
+            if (first > last)
+                return false;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        built = opacity;
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)depth)));
+        if (full)
+            allocate(scheduler);
+
+        std::vector<int> low(threadCount, INT_MAX), high(threadCount, -1);
+        std::vector<size_t> counts(threadCount, 0);
+        spans.resize((size_t)height * depth);
+        //A row of cells with any candidate is streamed whole, the others come out as they were.
+        scheduler.run(depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+        {
+            std::vector<float> sums(width);
+            std::vector<unsigned char> fresh(width);
+            for(int z = tile.x0; z < tile.x1; z++)
+            {
+                for(int y = 0; y < height; y++)
+                {
+                    size_t row = index(0, y, z), candidates = 0;
+                    int& spanLow = spans[(size_t)z * height + y].x;
+                    int& spanHigh = spans[(size_t)z * height + y].y;
+                    spanLow = INT_MAX;
+                    spanHigh = -1;
+                    for(int x = 0; x < width; x++)
+                        candidates += maxValue[row + x] >= first && minValue[row + x] <= last;
+                    if (candidates == 0)
+                        continue;
+                    counts[worker] += candidates;
+                    rowDensities(y, z, sums.data(), fresh.data());
+                    for(int x = 0; x < width; x++)
+                    {
+                        if (fresh[x] == density[row + x] && !full)
+                            continue;
+                        density[row + x] = fresh[x];
+                        spanLow = std::min(spanLow, x);
+                        spanHigh = x;
+                        low[worker] = std::min(low[worker], z);
+                        high[worker] = std::max(high[worker], z);
+                    }
+                }
+            }
+        });
+
+        int changedZ0 = INT_MAX, changedZ1 = -1;
+        rebuiltCells = 0;
+        for(unsigned int t = 0; t < threadCount; t++)
+        {
+            changedZ0 = std::min(changedZ0, low[t]);
+            changedZ1 = std::max(changedZ1, high[t]);
+            rebuiltCells += counts[t];
+        }
+        occludedCells = 0;
+        changedLow = glm::ivec3(INT_MAX);
+        changedHigh = glm::ivec3(-1);
+        if (changedZ0 <= changedZ1)
+        {
+            sum(scheduler, changedZ0, changedZ1);
+            reachSpans(scheduler);
+            const int reach = RADII[RADIUS_COUNT - 1];
+            std::vector<glm::ivec3> boxLow(threadCount, glm::ivec3(INT_MAX)), boxHigh(threadCount, glm::ivec3(-1));
+            std::vector<size_t> occluded(threadCount, 0);
+            scheduler.run(depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+            {
+                for(int z = tile.x0; z < tile.x1; z++)
+                {
+                    for(int y = 0; y < height; y++)
+                    {
+                        glm::ivec2 span = spans[(size_t)z * height + y];
+                        if (span.x > span.y)
+                            continue;
+                        int x0 = std::max(span.x - reach, 0), x1 = std::min(span.y + reach + 1, width);
+                        occludeRow(y, z, x0, x1);
+                        occluded[worker] += x1 - x0;
+                        boxLow[worker] = glm::min(boxLow[worker], glm::ivec3(x0, y, z));
+                        boxHigh[worker] = glm::max(boxHigh[worker], glm::ivec3(x1 - 1, y, z));
+                    }
+                }
+            });
+            for(unsigned int t = 0; t < threadCount; t++)
+            {
+                changedLow = glm::min(changedLow, boxLow[t]);
+                changedHigh = glm::max(changedHigh, boxHigh[t]);
+                occludedCells += occluded[t];
+            }
+        }
+        buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return changedLow.x <= changedHigh.x;
+    }
+
+    // Visibility in [0,1] at a texture coordinate of the volume, trilinear
+    // between the cell centres and clamped to the edge cells like the GL_LINEAR
+    // fetch at texCoord * textureScale().
+    float sample(glm::vec3 texCoord) const
+    {
+        glm::ivec3 size(width, height, depth);
+        glm::vec3 c = glm::clamp(texCoord * glm::vec3(volume.width, volume.height, volume.depth) / (float)cellSize - 0.5f, glm::vec3(0.0f), glm::vec3(size - 1));
+        glm::ivec3 c0 = glm::ivec3(c), c1 = glm::min(c0 + 1, size - 1);
+        glm::vec3 f = c - glm::vec3(c0);
+        float c00 = visibility[index(c0.x, c0.y, c0.z)] * (1 - f.x) + visibility[index(c1.x, c0.y, c0.z)] * f.x;
+        float c10 = visibility[index(c0.x, c1.y, c0.z)] * (1 - f.x) + visibility[index(c1.x, c1.y, c0.z)] * f.x;
+        float c01 = visibility[index(c0.x, c0.y, c1.z)] * (1 - f.x) + visibility[index(c1.x, c0.y, c1.z)] * f.x;
+        float c11 = visibility[index(c0.x, c1.y, c1.z)] * (1 - f.x) + visibility[index(c1.x, c1.y, c1.z)] * f.x;
+        float c0z = c00 * (1 - f.y) + c10 * f.y;
+        float c1z = c01 * (1 - f.y) + c11 * f.y;
+        return (c0z * (1 - f.z) + c1z * f.z) / 255.0f;
+    }
+
+    // The cells cover a little more than the volume when its size is not a
+    // multiple of cellSize; texture coordinates of the volume times this are
+    // those of a texture of visibility.
+    glm::vec3 textureScale() const
+    {
+        return glm::vec3(volume.width, volume.height, volume.depth) / (glm::vec3(width, height, depth) * (float)cellSize);
+    }
+
+    size_t index(int x, int y, int z) const
+    {
+        return ((size_t)z * height + y) * width + x;
+    }
+
+private:
+    std::vector<unsigned char> minValue, maxValue; //of the voxels of each cell
+    std::vector<unsigned char> density; //mean opacity of each cell * 255
+    std::vector<uint32_t> table; //summed densities with a zero first plane on each axis, entry (x, y, z) sums the cells below it
+    std::vector<float> built; //opacity the densities were computed from
+    std::vector<glm::ivec2> spans; //per row of cells, first and last x whose density changed, then those it reaches
+
+    size_t tableIndex(int x, int y, int z) const
+    {
+        return ((size_t)z * (height + 1) + y) * (width + 1) + x;
+    }
+
+    // Value ranges of the cells, once; the table's sums stay below 2^32 up to 2^24 cells.
+    void allocate(TileScheduler& scheduler)
+    {
+        size_t cells = (size_t)width * height * depth;
+        minValue.resize(cells);
+        maxValue.resize(cells);
+        density.assign(cells, 0);
+        visibility.assign(cells, 255);
+        table.assign((size_t)(width + 1) * (height + 1) * (depth + 1), 0);
+        scheduler.run(depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int cz = tile.x0; cz < tile.x1; cz++)
+            {
+                for(int cy = 0; cy < height; cy++)
+                {
+                    unsigned char* low = &minValue[index(0, cy, cz)];
+                    unsigned char* high = &maxValue[index(0, cy, cz)];
+                    std::fill(low, low + width, 255);
+                    std::fill(high, high + width, 0);
+                    for(int z = cz * cellSize; z < std::min((cz + 1) * cellSize, volume.depth); z++)
+                    {
+                        for(int y = cy * cellSize; y < std::min((cy + 1) * cellSize, volume.height); y++)
+                        {
+                            const unsigned char* row = &volume.data[((size_t)z * volume.height + y) * volume.width];
+                            for(int cx = 0, x = 0; cx < width; cx++)
+                            {
+                                for(int end = std::min(x + cellSize, volume.width); x < end; x++)
+                                {
+                                    low[cx] = std::min(low[cx], row[x]);
+                                    high[cx] = std::max(high[cx], row[x]);
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+    }
+
+    // Densities of the row (cy, cz) of cells, its voxels streamed row by row.
+    void rowDensities(int cy, int cz, float* sums, unsigned char* out) const
+    {
+        std::fill(sums, sums + width, 0.0f);
+        for(int z = cz * cellSize; z < std::min((cz + 1) * cellSize, volume.depth); z++)
+        {
+            for(int y = cy * cellSize; y < std::min((cy + 1) * cellSize, volume.height); y++)
+            {
+                const unsigned char* row = &volume.data[((size_t)z * volume.height + y) * volume.width];
+                for(int cx = 0, x = 0; cx < width; cx++)
+                {
+                    float total = 0.0f;
+                    for(int end = std::min(x + cellSize, volume.width); x < end; x++)
+                        total += built[row[x]];
+                    sums[cx] += total;
+                }
+            }
+        }
+        float scale = 255.0f / (cellSize * cellSize * cellSize);
+        for(int cx = 0; cx < width; cx++)
+            out[cx] = (unsigned char)(sums[cx] * scale + 0.5f);
+    }
+
+    // Sums the slabs z0 to z1 of cells as planes, then the planes along z per
+    // row; past z1 every plane grows by what plane z1 did. Unsigned wraparound
+    // keeps the differences exact.
+    void sum(TileScheduler& scheduler, int z0, int z1)
+    {
+        std::vector<uint32_t> previous(table.begin() + tableIndex(0, 0, z1 + 1), table.begin() + tableIndex(0, 0, z1 + 2));
+        scheduler.run(z1 - z0 + 1, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int z = z0 + tile.x0; z < z0 + tile.x1; z++)
+            {
+                for(int y = 0; y < height; y++)
+                {
+                    uint32_t running = 0;
+                    const unsigned char* cells = &density[index(0, y, z)];
+                    uint32_t* above = &table[tableIndex(1, y, z + 1)];
+                    uint32_t* row = &table[tableIndex(1, y + 1, z + 1)];
+                    for(int x = 0; x < width; x++)
+                    {
+                        running += cells[x];
+                        row[x] = above[x] + running;
+                    }
+                }
+            }
+        });
+        scheduler.run(height, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            std::vector<uint32_t> growth(width);
+            for(int y = tile.x0 + 1; y <= tile.x1; y++)
+            {
+                for(int z = z0 + 1; z <= z1 + 1; z++)
+                {
+                    const uint32_t* below = &table[tableIndex(1, y, z - 1)];
+                    uint32_t* row = &table[tableIndex(1, y, z)];
+                    for(int x = 0; x < width; x++)
+                        row[x] += below[x];
+                }
+                for(int x = 0; x < width; x++)
+                    growth[x] = table[tableIndex(1 + x, y, z1 + 1)] - previous[tableIndex(1 + x, y, 0)];
+                for(int z = z1 + 2; z <= depth; z++)
+                {
+                    uint32_t* row = &table[tableIndex(1, y, z)];
+                    for(int x = 0; x < width; x++)
+                        row[x] += growth[x];
+                }
+            }
+        });
+    }
+
+    uint32_t boxSum(glm::ivec3 low, glm::ivec3 high) const
+    {
+        glm::ivec3 a = low, b = high + 1;
+        return table[tableIndex(b.x, b.y, b.z)] - table[tableIndex(a.x, b.y, b.z)] - table[tableIndex(b.x, a.y, b.z)] - table[tableIndex(b.x, b.y, a.z)]
+               + table[tableIndex(a.x, a.y, b.z)] + table[tableIndex(a.x, b.y, a.z)] + table[tableIndex(b.x, a.y, a.z)] - table[tableIndex(a.x, a.y, a.z)];
+    }
+
+    // Widens every row's span of changed densities to the rows within the
+    // largest radius in y, then in z; occludeRow() widens it along x.
+    void reachSpans(TileScheduler& scheduler)
+    {
+        const int reach = RADII[RADIUS_COUNT - 1];
+        std::vector<glm::ivec2> grown(spans.size());
+        scheduler.run(depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int z = tile.x0; z < tile.x1; z++)
+            {
+                for(int y = 0; y < height; y++)
+                {
+                    glm::ivec2 span(INT_MAX, -1);
+                    for(int n = std::max(y - reach, 0); n <= std::min(y + reach, height - 1); n++)
+                        span = glm::ivec2(std::min(span.x, spans[(size_t)z * height + n].x), std::max(span.y, spans[(size_t)z * height + n].y));
+                    grown[(size_t)z * height + y] = span;
+                }
+            }
+        });
+        scheduler.run(height, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int y = tile.x0; y < tile.x1; y++)
+            {
+                for(int z = 0; z < depth; z++)
+                {
+                    glm::ivec2 span(INT_MAX, -1);
+                    for(int n = std::max(z - reach, 0); n <= std::min(z + reach, depth - 1); n++)
+                        span = glm::ivec2(std::min(span.x, grown[(size_t)n * height + y].x), std::max(span.y, grown[(size_t)n * height + y].y));
+                    spans[(size_t)z * height + y] = span;
+                }
+            }
+        });
+    }
+
+    // Visibilities of the cells x0 to x1 - 1 of a row. Boxes that stay inside
+    // the grid read the table at fixed offsets from the cell, the others are
+    // clamped to it.
+    void occludeRow(int y, int z, int x0, int x1)
+    {
+        const int reach = RADII[RADIUS_COUNT - 1];
+        int inner0 = x1, inner1 = x1;
+        if (y >= reach && y + reach < height && z >= reach && z + reach < depth)
+        {
+            inner0 = glm::clamp(reach, x0, x1);
+            inner1 = glm::clamp(width - reach, inner0, x1);
+        }
+        for(int x = x0; x < inner0; x++)
+            visibility[index(x, y, z)] = occlude(x, y, z);
+
+        ptrdiff_t offsets[RADIUS_COUNT][8];
+        float weights[RADIUS_COUNT];
+        for(int r = 0; r < RADIUS_COUNT; r++)
+        {
+            int a = -RADII[r], b = RADII[r] + 1;
+            for(int corner = 0; corner < 8; corner++)
+                offsets[r][corner] = ((ptrdiff_t)(corner & 4 ? b : a) * (height + 1) + (corner & 2 ? b : a)) * (width + 1) + (corner & 1 ? b : a);
+            weights[r] = 255.0f * (2 * RADII[r] + 1) * (2 * RADII[r] + 1) * (2 * RADII[r] + 1);
+        }
+        for(int x = inner0; x < inner1; x++)
+        {
+            const uint32_t* cell = &table[tableIndex(x, y, z)];
+            float occlusion = 0.0f;
+            for(int r = 0; r < RADIUS_COUNT; r++)
+            {
+                const ptrdiff_t* o = offsets[r];
+                uint32_t total = cell[o[7]] - cell[o[6]] - cell[o[5]] - cell[o[3]] + cell[o[4]] + cell[o[2]] + cell[o[1]] - cell[o[0]];
+                occlusion += total / weights[r];
+            }
+            visibility[index(x, y, z)] = (unsigned char)((1.0f - occlusion / RADIUS_COUNT) * 255.0f + 0.5f);
+        }
+
+        for(int x = inner1; x < x1; x++)
+            visibility[index(x, y, z)] = occlude(x, y, z);
+    }
+
+    unsigned char occlude(int x, int y, int z) const
+    {
+        glm::ivec3 cell(x, y, z), last = glm::ivec3(width, height, depth) - 1;
+        float occlusion = 0.0f;
+        for(int r = 0; r < RADIUS_COUNT; r++)
+        {
+            int side = 2 * RADII[r] + 1;
+            uint32_t total = boxSum(glm::max(cell - RADII[r], glm::ivec3(0)), glm::min(cell + RADII[r], last));
+            occlusion += total / (255.0f * side * side * side);
+        }
+        return (unsigned char)((1.0f - occlusion / RADIUS_COUNT) * 255.0f + 0.5f);
+    }
+};
+#endif
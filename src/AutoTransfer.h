@@ -0,0 +1,309 @@
+#ifndef AUTO_TRANSFER_H
+#define AUTO_TRANSFER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+
+#include "Volume.h"
+#include "TransferFunction.h"
+#include "TileScheduler.h"
+
+// Voxel counts per value and, given a GradientMagnitude volume, per (value,
+// magnitude) pair. build() counts z-slabs on the TileScheduler into private
+// tables per worker that are summed at the end. Voxels are read eight at a
+// time as one 64-bit word: a word of eight equal bytes, what empty space and
+// homogeneous material are made of, is a single add. Mixed words go to four
+// interleaved tables, so consecutive increments rarely wait on the same
+// counter; the joint table spreads over 64K counters and does without.
+class VolumeHistogram
+{
+public:
+    static const int SIZE = TransferFunction::SIZE;
+    std::vector<double> counts; //SIZE, by value
+    std::vector<double> joint; //SIZE * SIZE, row by magnitude, column by value; empty without magnitudes
+    double total = 0.0;
+    double milliseconds = 0.0; //of the last build()
+
+    void build(const Volume& volume, const Volume* magnitude = nullptr, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        const size_t slice = (size_t)volume.width * volume.height;
+        const size_t tableSize = magnitude != nullptr ? (size_t)SIZE * SIZE : 4 * SIZE;
+        threadCount = std::max(1u, std::min(threadCount, (unsigned int)volume.depth));
+        std::vector<std::vector<unsigned int>> partial(threadCount, std::vector<unsigned int>(tableSize, 0));
+        TileScheduler scheduler(threadCount);
+        scheduler.run(volume.depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+        {
+            const uint64_t ONES = 0x0101010101010101ull;
+            unsigned int* bins = partial[worker].data();
+            const unsigned char* values = &volume.data[tile.x0 * slice];
+            size_t n = (tile.x1 - tile.x0) * slice, i = 0;
+            if (magnitude != nullptr)
+            {
+                const unsigned char* magnitudes = &magnitude->data[tile.x0 * slice];
+                for(; i + 8 <= n; i += 8)
+                {
+                    uint64_t v, g;
+                    memcpy(&v, values + i, 8);
+                    memcpy(&g, magnitudes + i, 8);
+                    if (v == (v & 0xff) * ONES && g == (g & 0xff) * ONES)
+                    {
+                        bins[(g & 0xff) * SIZE + (v & 0xff)] += 8;
+                        continue;
+                    }
+                    for(int b = 0; b < 64; b += 8)
+                        bins[((g >> b) & 0xff) * SIZE + ((v >> b) & 0xff)]++;
+                }
+                for(; i < n; i++)
+                    bins[(size_t)magnitudes[i] * SIZE + values[i]]++;
+                return;
+            }
+            for(; i + 8 <= n; i += 8)
+            {
+                uint64_t v;
+                memcpy(&v, values + i, 8);
+                if (v == (v & 0xff) * ONES)
+                {
+                    bins[v & 0xff] += 8;
+                    continue;
+                }
+                bins[v & 0xff]++;
+                bins[SIZE + ((v >> 8) & 0xff)]++;
+                bins[2 * SIZE + ((v >> 16) & 0xff)]++;
+                bins[3 * SIZE + ((v >> 24) & 0xff)]++;
+                bins[((v >> 32) & 0xff)]++;
+                bins[SIZE + ((v >> 40) & 0xff)]++;
+                bins[2 * SIZE + ((v >> 48) & 0xff)]++;
+                bins[3 * SIZE + (v >> 56)]++;
+            }
+            for(; i < n; i++)
+                bins[values[i]]++;
+        });
+
+        counts.assign(SIZE, 0.0);
+        joint.clear();
+        if (magnitude != nullptr)
+            joint.assign((size_t)SIZE * SIZE, 0.0);
+        for(const std::vector<unsigned int>& bins : partial)
+        {
+            for(size_t i = 0; i < tableSize; i++)
+            {
+                if (magnitude != nullptr)
+                    joint[i] += bins[i];
+                counts[i % SIZE] += bins[i];
+            }
+        }
+        total = (double)volume.voxelCount();
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Mean gradient magnitude of the voxels with each value, 0 where there are none.
+    std::vector<float> meanMagnitude() const
+    {
+        std::vector<float> mean(SIZE, 0.0f);
+        if (joint.empty())
+            return mean;
+        for(int v = 0; v < SIZE; v++)
+        {
+            double sum = 0.0;
+            for(int g = 0; g < SIZE; g++)
+                sum += g * joint[(size_t)g * SIZE + v];
+            mean[v] = counts[v] > 0.0 ? (float)(sum / counts[v]) : 0.0f;
+        }
+        return mean;
+    }
+};
+
+// Starting transfer functions from a histogram. Materials show up as peaks of
+// the (log, smoothed) value histogram; the fullest peak in the lower half of
+// the range is taken as the background and the window opens where the
+// histogram stops falling steeply above it, closing where all but HIGH_TAIL
+// of the voxels past its low end lie. The transfer function is transparent
+// below the window, peaks at every material inside it with opacity rising
+// with the value, dips at the valleys between them and saturates at the
+// window's high end.
+// With the joint histogram the boundary between two neighbouring materials
+// (and the background) is the value in between where the mean gradient
+// magnitude peaks (Kindlmann and Durkin); the 2D widgets show the materials
+// at low magnitudes and the boundaries as faint shells at high ones.
+class AutoTransfer
+{
+public:
+    static const int SIZE = TransferFunction::SIZE;
+    float windowLow = 0.0f, windowHigh = 255.0f; //voxel values
+    std::vector<int> materials; //peak values by rising value
+    std::vector<int> boundaries; //between consecutive materials, the first one above the background
+    std::vector<TransferPoint> points; //for TransferFunction::setPoints()
+    std::vector<TransferWidget> widgets; //for TransferFunction2D::setWidgets(), empty without the joint histogram
+    double milliseconds = 0.0; //of the last analyze()
+
+    float level() const
+    {
+        return 0.5f * (windowLow + windowHigh);
+    }
+
+    float window() const
+    {
+        return windowHigh - windowLow;
+    }
+
+    void analyze(const VolumeHistogram& histogram)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        const std::vector<double>& counts = histogram.counts;
+        std::vector<float> smooth(SIZE, 0.0f);
+        for(int v = 0; v < SIZE; v++)
+        {
+            int from = std::max(0, v - SMOOTHING), to = std::min(SIZE - 1, v + SMOOTHING);
+            for(int u = from; u <= to; u++)
+                smooth[v] += logf(1.0f + (float)counts[u]);
+            smooth[v] /= to - from + 1;
+        }
+
+        std::vector<int> peaks;
+        std::vector<double> mass;
+        for(int v = 0; v < SIZE; v++)
+        {
+            int from = std::max(0, v - PEAK_RADIUS), to = std::min(SIZE - 1, v + PEAK_RADIUS);
+            bool highest = true;
+            double around = 0.0;
+            for(int u = from; u <= to; u++)
+            {
+                //The first value of a plateau is its peak.
+                highest = highest && (smooth[u] < smooth[v] || (smooth[u] == smooth[v] && u >= v));
+                around += counts[u];
+            }
+            if (highest && around >= MIN_PEAK_FRACTION * histogram.total)
+            {
+                peaks.push_back(v);
+                mass.push_back(around);
+            }
+        }
+
+        int background = -1;
+        if (!mass.empty())
+        {
+            size_t fullest = std::max_element(mass.begin(), mass.end()) - mass.begin();
+            if (peaks[fullest] < SIZE / 2)
+                background = (int)fullest;
+        }
+        int firstMaterial = background + 1;
+        int low = 0;
+        if (background >= 0)
+        {
+            int to = firstMaterial < (int)peaks.size() ? peaks[firstMaterial] : SIZE - 1;
+            low = peaks[background] + 1;
+            while (low < to && smooth[low + 1] < smooth[low] - FLAT_SLOPE)
+                low++;
+        }
+        else
+        {
+            while (low < SIZE - 1 && counts[low] <= 0.0)
+                low++;
+        }
+
+        double above = 0.0;
+        for(int v = low; v < SIZE; v++)
+            above += counts[v];
+        int high = SIZE - 1;
+        double tail = 0.0;
+        while (high > low + 1 && tail + counts[high] <= HIGH_TAIL * above)
+            tail += counts[high--];
+        windowLow = (float)low;
+        windowHigh = (float)high;
+
+        materials.clear();
+        for(size_t p = firstMaterial; p < peaks.size(); p++)
+            if (peaks[p] > low && peaks[p] <= high)
+                materials.push_back(peaks[p]);
+        if (materials.empty())
+            materials.push_back((low + high) / 2);
+
+        boundaries.clear();
+        std::vector<float> gradient = histogram.meanMagnitude();
+        if (!histogram.joint.empty())
+        {
+            int from = background >= 0 ? peaks[background] : low;
+            for(int m : materials)
+            {
+                //Only a clear maximum inside the range, one at either end is the slope of a material's own peak.
+                int first = from + SMOOTHING + 1, last = m - SMOOTHING - 1, steepest = -1;
+                for(int v = first; v <= last; v++)
+                    if (counts[v] > 0.0 && (steepest < 0 || gradient[v] > gradient[steepest]))
+                        steepest = v;
+                if (steepest > first && steepest < last && gradient[steepest] > BOUNDARY_CONTRAST * std::max(gradient[first], gradient[last]))
+                    boundaries.push_back(steepest);
+                from = m;
+            }
+        }
+
+        points.clear();
+        points.push_back({windowLow, glm::vec4(tint(windowLow), 0.0f)});
+        for(size_t i = 0; i < materials.size(); i++)
+        {
+            if (i > 0)
+            {
+                int between = valley(smooth, materials[i - 1], materials[i]);
+                float alpha = 0.5f * std::min(opacity((float)materials[i - 1]), opacity((float)materials[i]));
+                points.push_back({(float)between, glm::vec4(tint((float)between), alpha)});
+            }
+            points.push_back({(float)materials[i], glm::vec4(tint((float)materials[i]), opacity((float)materials[i]))});
+        }
+        if (materials.back() < high)
+            points.push_back({windowHigh, glm::vec4(tint(windowHigh), opacity(windowHigh))});
+
+        widgets.clear();
+        if (!histogram.joint.empty())
+        {
+            for(size_t i = 0; i < materials.size(); i++)
+            {
+                float m = (float)materials[i];
+                float width = 2.0f * std::min(i > 0 ? m - materials[i - 1] : m - windowLow, i + 1 < materials.size() ? materials[i + 1] - m : windowHigh - m);
+                widgets.push_back({m, std::max(width, 2.0f * SMOOTHING), 0.0f, 2.0f * std::max(gradient[materials[i]], 1.0f), glm::vec4(tint(m), opacity(m))});
+            }
+            for(int b : boundaries)
+                widgets.push_back({(float)b, 2.0f * PEAK_RADIUS, 0.5f * gradient[b], 255.0f, glm::vec4(tint((float)b), BOUNDARY_OPACITY)});
+        }
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+private:
+    static const int SMOOTHING = 3; //values either side averaged into the log histogram
+    static const int PEAK_RADIUS = 8; //values either side a peak has to top
+    static constexpr float FLAT_SLOPE = 0.05f; //log count per value the background has to keep falling by
+    static constexpr double MIN_PEAK_FRACTION = 0.005; //of all voxels within PEAK_RADIUS of a peak
+    static constexpr double HIGH_TAIL = 0.001; //of the voxels above the window left out at its top
+    static constexpr float BOUNDARY_CONTRAST = 1.1f; //of the mean gradient magnitude at the boundary over the range's ends
+    static constexpr float BOUNDARY_OPACITY = 0.05f;
+
+    static int valley(const std::vector<float>& smooth, int from, int to)
+    {
+        int lowest = std::min(from + 1, to);
+        for(int v = lowest; v <= to; v++)
+            if (smooth[v] < smooth[lowest])
+                lowest = v;
+        return lowest;
+    }
+
+    // Position in the window, squared so the dense materials at its top stand out.
+    float opacity(float value) const
+    {
+        float t = window() > 0.0f ? glm::clamp((value - windowLow) / window(), 0.0f, 1.0f) : 1.0f;
+        return 0.02f + 0.78f * t * t;
+    }
+
+    // Dark red at the bottom of the window to warm white at the top.
+    glm::vec3 tint(float value) const
+    {
+        float t = window() > 0.0f ? glm::clamp((value - windowLow) / window(), 0.0f, 1.0f) : 1.0f;
+        return glm::mix(glm::vec3(0.55f, 0.20f, 0.10f), glm::vec3(1.0f, 0.95f, 0.85f), t);
+    }
+};
+#endif
@@ -0,0 +1,100 @@
+#ifndef CLIPPER_H
+#define CLIPPER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+
+struct ClipStats
+{
+    unsigned long long slices = 0;
+    unsigned long long slicesCulled = 0; //completely outside the frustum
+    unsigned long long verticesIn = 0; //polygon vertices before clipping
+    unsigned long long verticesOut = 0; //polygon vertices after clipping
+};
+
+// Sutherland-Hodgman clipping of convex slice polygons against the six planes
+// of the view frustum. Vertices are in view space, the planes are tested in
+// clip space where they are simply -w <= x,y,z <= w. Since the projection is
+// linear in homogeneous coordinates the view space position and the texture
+// coordinate can be interpolated with the same parameter.
+template <typename VertexT>
+class FrustumClipper
+{
+public:
+    glm::mat4 projection;
+
+    FrustumClipper(glm::mat4 projection)
+    {
+        this->projection = projection;
+    }
+
+    // Clips the polygon in place, returns false when nothing is left of it.
+    bool clip(std::vector<VertexT>& polygon, ClipStats& stats)
+    {
+        stats.slices++;
+        stats.verticesIn += polygon.size();
+
+        clipCoords.resize(polygon.size());
+        for(size_t i = 0; i < polygon.size(); i++)
+            clipCoords[i] = projection * glm::vec4(polygon[i].vertexCoord, 1.0f);
+
+        for(int plane = 0; plane < 6 && !polygon.empty(); plane++)
+            clipPlane(polygon, plane);
+
+        if (polygon.size() < 3)
+        {
+            polygon.clear();
+            stats.slicesCulled++;
+            return false;
+        }
+
+        stats.verticesOut += polygon.size();
+        return true;
+    }
+
+private:
+    std::vector<VertexT> output;
+    std::vector<glm::vec4> clipCoords, outputClipCoords;
+
+    // Signed distance to frustum plane 0..5 (left, right, bottom, top, near, far), inside is positive.
+    static float distance(glm::vec4 c, int plane)
+    {
+        float coord = c[plane / 2];
+        return (plane % 2 == 0) ? c.w + coord : c.w - coord;
+    }
+
+    void clipPlane(std::vector<VertexT>& polygon, int plane)
+    {
+        output.clear();
+        outputClipCoords.clear();
+
+        for(size_t i = 0; i < polygon.size(); i++)
+        {
+            size_t j = (i + 1) % polygon.size();
+            float di = distance(clipCoords[i], plane);
+            float dj = distance(clipCoords[j], plane);
+
+            if (di >= 0)
+            {
+                output.push_back(polygon[i]);
+                outputClipCoords.push_back(clipCoords[i]);
+            }
+
+            //Edge crosses the plane, emit the intersection.
+            if ((di >= 0) != (dj >= 0))
+            {
+                float t = di / (di - dj);
+                VertexT v;
+                v.vertexCoord = polygon[i].vertexCoord + (polygon[j].vertexCoord - polygon[i].vertexCoord) * t;
+                v.texCoord = polygon[i].texCoord + (polygon[j].texCoord - polygon[i].texCoord) * t;
+                output.push_back(v);
+                outputClipCoords.push_back(clipCoords[i] + (clipCoords[j] - clipCoords[i]) * t);
+            }
+        }
+
+        polygon.swap(output);
+        clipCoords.swap(outputClipCoords);
+    }
+};
+#endif
@@ -0,0 +1,258 @@
+#ifndef COMPOSITOR_H
+#define COMPOSITOR_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <cstring>
+
+#include "Volume.h"
+#include "TransferFunction.h"
+
+// The proxy cube spans [-0.5,0.5]^3 in world space and carries texture
+// coordinates in [-1,1]^3, so the data itself covers the [0,0.5]^3 octant.
+inline glm::vec3 worldToTexCoord(glm::vec3 worldPos)
+{
+    return worldPos * 2.0f;
+}
+
+inline bool insideProxyCube(glm::vec3 worldPos)
+{
+    const float eps = 1e-5f;
+    return fabsf(worldPos.x) <= 0.5f + eps && fabsf(worldPos.y) <= 0.5f + eps && fabsf(worldPos.z) <= 0.5f + eps;
+}
+
+// View space direction through the center of pixel (px, py), scaled to z = -1.
+// Rows start at the bottom like glReadPixels.
+inline glm::vec3 viewRayThroughPixel(int px, int py, int width, int height, const glm::mat4& invProjection)
+{
+    glm::vec2 ndc((2.0f * (px + 0.5f)) / width - 1.0f, (2.0f * (py + 0.5f)) / height - 1.0f);
+    glm::vec4 farPoint = invProjection * glm::vec4(ndc, 1.0f, 1.0f);
+    glm::vec3 rayDir = glm::vec3(farPoint) / farPoint.w;
+    return rayDir / -rayDir.z;
+}
+
+// What becomes of the samples along a ray: emission-absorption compositing
+// through a TransferFunction, their maximum, minimum or mean value as gray,
+// or the first crossing of an iso-value, shaded opaque.
+enum ProjectionMode
+{
+    PROJECTION_COMPOSITE = 0,
+    PROJECTION_MAXIMUM,
+    PROJECTION_MINIMUM,
+    PROJECTION_AVERAGE,
+    PROJECTION_ISOSURFACE,
+    PROJECTION_MODE_COUNT
+};
+
+inline const char* projectionName(ProjectionMode mode)
+{
+    static const char* names[PROJECTION_MODE_COUNT] = {"emission-absorption", "maximum intensity", "minimum intensity", "average intensity", "isosurface"};
+    return names[mode];
+}
+
+// Command line spelling: composite, mip, minip, average or iso.
+inline bool parseProjection(const char* name, ProjectionMode& mode)
+{
+    static const char* names[PROJECTION_MODE_COUNT] = {"composite", "mip", "minip", "average", "iso"};
+    for(int i = 0; i < PROJECTION_MODE_COUNT; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            mode = (ProjectionMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// How composited samples are lit: not at all, by the gradient of six extra
+// trilinear samples, or by the quantized normal GradientMagnitude stored for
+// the nearest voxel.
+enum ShadingMode
+{
+    SHADING_NONE = 0,
+    SHADING_GRADIENT,
+    SHADING_PRECOMPUTED,
+    SHADING_MODE_COUNT
+};
+
+inline const char* shadingName(ShadingMode mode)
+{
+    static const char* names[SHADING_MODE_COUNT] = {"none", "gradient", "precomputed"};
+    return names[mode];
+}
+
+inline bool parseShading(const char* name, ShadingMode& mode)
+{
+    for(int i = 0; i < SHADING_MODE_COUNT; i++)
+    {
+        if (strcmp(name, shadingName((ShadingMode)i)) == 0)
+        {
+            mode = (ShadingMode)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Headlight Blinn-Phong with the given gradient, seen along rayDir: the
+// diffuse factor, ambient included, and the specular one. Two-sided, so it
+// does not matter which way the gradient points. shader.fs uses the same
+// constants.
+inline glm::vec2 blinnPhong(glm::vec3 gradient, glm::vec3 rayDir)
+{
+    const float AMBIENT = 0.15f, DIFFUSE = 0.7f, SPECULAR = 0.25f, SHININESS = 32.0f;
+    float length = glm::length(gradient);
+    //A flat spot has no normal, it gets the light of a surface facing the eye.
+    float facing = length > 0.0f ? fabsf(glm::dot(gradient / length, glm::normalize(rayDir))) : 1.0f;
+    return glm::vec2(AMBIENT + DIFFUSE * facing, SPECULAR * powf(facing, SHININESS));
+}
+
+// An isosurface is white and opaque.
+inline glm::vec4 shadeIsosurface(glm::vec3 gradient, glm::vec3 rayDir)
+{
+    glm::vec2 light = blinnPhong(gradient, rayDir);
+    float intensity = light.x + light.y;
+    return glm::vec4(intensity, intensity, intensity, 1.0f);
+}
+
+// Premultiplied sample lit in proportion to strength in [0,1]: 0 keeps the
+// unlit color of homogeneous regions, whose gradients are mostly noise, 1 is
+// the full diffuse color plus a white highlight as strong as the sample is
+// opaque.
+inline glm::vec4 shadeSample(glm::vec4 src, glm::vec3 gradient, glm::vec3 rayDir, float strength)
+{
+    glm::vec2 light = blinnPhong(gradient, rayDir);
+    glm::vec4 lit(glm::vec3(src) * light.x + light.y * src.a, src.a);
+    return src + (lit - src) * strength;
+}
+
+// Shading strength of a gradient magnitude in GradientMagnitude's units:
+// ramps up to full over the first SHADING_MAGNITUDE of 255.
+inline float shadingStrength(float magnitude)
+{
+    const float SHADING_MAGNITUDE = 16.0f;
+    return std::min(magnitude / SHADING_MAGNITUDE, 1.0f);
+}
+
+// Opacity correction for a sample that stands in for several planes of the
+// reference spacing: the transparency compounds once per plane and the color
+// keeps its ratio to alpha.
+inline glm::vec4 correctOpacity(glm::vec4 src, float planes)
+{
+    if (src.a <= 0.0f)
+        return src;
+    float alpha = 1.0f - powf(1.0f - src.a, planes);
+    return glm::vec4(glm::vec3(src) * (alpha / src.a), alpha);
+}
+
+// Over operator for premultiplied colors, used when slices arrive back to front.
+inline void blendOver(glm::vec4& dst, glm::vec4 src)
+{
+    dst = src + (1.0f - src.a) * dst;
+}
+
+// Under operator for premultiplied colors, used when slices arrive front to back.
+inline void blendUnder(glm::vec4& dst, glm::vec4 src)
+{
+    dst += (1.0f - dst.a) * src;
+}
+
+struct CompositeStats
+{
+    unsigned long long shadedFragments = 0;
+    unsigned long long skippedFragments = 0;
+};
+
+// CPU reference of the slice renderer. Every pixel walks the same view-aligned
+// planes that calculatePlanes() produced and blends them in draw order. In
+// front-to-back mode the opacity mask is only refreshed every maskInterval
+// slices, exactly like the stencil pass on the GPU, so the skipped fragment
+// count matches what early termination saves there.
+class ReferenceCompositor
+{
+public:
+    const Volume& volume;
+    const TransferFunction& transferFunction;
+
+    ReferenceCompositor(const Volume& volume, const TransferFunction& transferFunction) : volume(volume), transferFunction(transferFunction)
+    {
+    }
+
+    // sliceDepths are view space z values in the order they were drawn.
+    // Image rows start at the bottom, like glReadPixels.
+    void render(const std::vector<float>& sliceDepths, glm::mat4 view, glm::mat4 projection,
+                int width, int height, bool frontToBack, float threshold, int maskInterval,
+                std::vector<glm::vec4>& image, CompositeStats& stats) const
+    {
+        glm::mat4 invView = glm::inverse(view);
+        glm::mat4 invProjection = glm::inverse(projection);
+        // Near plane distance, fragments in front of it are clipped away.
+        glm::vec4 nearPoint = invProjection * glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+        float nearZ = nearPoint.z / nearPoint.w;
+
+        image.assign((size_t)width * height, glm::vec4(0.0f));
+
+        for (int py = 0; py < height; py++)
+        {
+            for (int px = 0; px < width; px++)
+            {
+                //z = -1 so the plane z = zValue is hit at rayDir * -zValue
+                glm::vec3 rayDir = viewRayThroughPixel(px, py, width, height, invProjection);
+
+                glm::vec4 dst(0.0f);
+                bool masked = false;
+                for (size_t s = 0; s < sliceDepths.size(); s++)
+                {
+                    if (frontToBack && maskInterval > 0 && s % maskInterval == 0 && dst.a >= threshold)
+                        masked = true;
+
+                    float zValue = sliceDepths[s];
+                    if (zValue > nearZ)
+                        continue;
+
+                    glm::vec3 worldPos = glm::vec3(invView * glm::vec4(rayDir * -zValue, 1.0f));
+                    if (!insideProxyCube(worldPos))
+                        continue;
+
+                    if (masked)
+                    {
+                        stats.skippedFragments++;
+                        continue;
+                    }
+
+                    stats.shadedFragments++;
+                    glm::vec4 src = transferFunction.lookup(volume.sample(worldToTexCoord(worldPos)));
+                    if (frontToBack)
+                        blendUnder(dst, src);
+                    else
+                        blendOver(dst, src);
+                }
+                image[(size_t)py * width + px] = dst;
+            }
+        }
+    }
+
+    // Largest per channel difference between a reference image and an RGBA8 readback.
+    static float maxError(const std::vector<glm::vec4>& reference, const unsigned char* rgba, float* meanError = nullptr)
+    {
+        float maxErr = 0.0f;
+        double sumErr = 0.0;
+        for (size_t i = 0; i < reference.size(); i++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                float err = fabsf(glm::clamp(reference[i][c], 0.0f, 1.0f) - rgba[i * 4 + c] / 255.0f);
+                maxErr = std::max(maxErr, err);
+                sumErr += err;
+            }
+        }
+        if (meanError != nullptr)
+            *meanError = reference.empty() ? 0.0f : (float)(sumErr / (reference.size() * 3));
+        return maxErr;
+    }
+};
+#endif
@@ -0,0 +1,272 @@
+#ifndef FUSED_VOLUME_H
+#define FUSED_VOLUME_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "Volume.h"
+#include "Compositor.h"
+#include "TransferFunction.h"
+#include "MinMaxGrid.h"
+#include "TileScheduler.h"
+
+// How the classified sample of a FusedVolume combines with the primary
+// volume's at the same position, both premultiplied. All but the mask are
+// zero only where both samples are, so what either volume shows is drawn and
+// space can only be skipped where both are transparent; the mask shows the
+// primary volume where the fused one is opaque, within both boxes only.
+enum FusionOperator
+{
+    FUSION_OVER = 0, //the primary sample in front of the fused one
+    FUSION_ADD, //both emit, clamped to 1
+    FUSION_MAXIMUM, //the more opaque of the two
+    FUSION_BLEND, //weighted mean, FusedVolume::weight of the fused one
+    FUSION_MASK, //the primary sample times the fused opacity
+    FUSION_COUNT
+};
+
+inline const char* fusionName(FusionOperator op)
+{
+    static const char* names[FUSION_COUNT] = {"over", "add", "maximum", "blend", "mask"};
+    return names[op];
+}
+
+inline bool parseFusion(const char* name, FusionOperator& op)
+{
+    for(int i = 0; i < FUSION_COUNT; i++)
+    {
+        if (strcmp(name, fusionName((FusionOperator)i)) == 0)
+        {
+            op = (FusionOperator)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline glm::vec4 fuseSamples(FusionOperator op, glm::vec4 primary, glm::vec4 fused, float weight)
+{
+    switch (op)
+    {
+    case FUSION_OVER:
+        return primary + (1.0f - primary.a) * fused;
+    case FUSION_ADD:
+        return glm::min(primary + fused, glm::vec4(1.0f));
+    case FUSION_MAXIMUM:
+        return fused.a > primary.a ? fused : primary;
+    case FUSION_BLEND:
+        return primary + (fused - primary) * weight;
+    default:
+        return primary * fused.a;
+    }
+}
+
+// Texture coordinates of the primary volume are twice the world position (see
+// worldToTexCoord()).
+inline glm::mat4 primaryTexFromWorld()
+{
+    glm::mat4 scale(2.0f);
+    scale[3][3] = 1.0f;
+    return scale;
+}
+
+// World space box around texture coordinates [0,1] plus one voxel of linear
+// filtering into the border, for a volume of size voxels placed by
+// texFromWorld; axis aligned around the transformed corners.
+inline void volumeBounds(const glm::mat4& texFromWorld, glm::ivec3 size, glm::vec3& boxMin, glm::vec3& boxMax)
+{
+    glm::mat4 worldFromTex = glm::inverse(texFromWorld);
+    glm::vec3 border = 1.0f / glm::vec3(size);
+    boxMin = glm::vec3(INFINITY);
+    boxMax = glm::vec3(-INFINITY);
+    for(int i = 0; i < 8; i++)
+    {
+        glm::vec3 corner((i & 2) ? 1.0f + border.x : -border.x, (i & 1) ? 1.0f + border.y : -border.y, (i & 4) ? 1.0f + border.z : -border.z);
+        glm::vec3 p = glm::vec3(worldFromTex * glm::vec4(corner, 1.0f));
+        boxMin = glm::min(boxMin, p);
+        boxMax = glm::max(boxMax, p);
+    }
+}
+
+// A second volume rendered in the same pass as the primary one, e.g. another
+// modality or a field derived from it: its own resolution, its own placement
+// texFromWorld (world position to its texture coordinates, co-registered
+// with the primary volume it is primaryTexFromWorld()) and its own transfer
+// function. Every composited sample classifies both and combines them by op.
+// Rays and proxy slices cover proxyBounds(), the union of both boxes or
+// their intersection for the mask.
+// For empty-space skipping updateOccupancy() marks the primary grid's level
+// 0 bricks whose region holds a sample of this volume that can be visible,
+// read from a MinMaxGrid of its own classified with its transfer function;
+// MinMaxGrid::occupy() keeps those from being leapt over. The mask needs no
+// marks, where the primary volume is transparent so is the result.
+class FusedVolume
+{
+public:
+    const Volume& volume;
+    glm::mat4 texFromWorld;
+    TransferFunction transferFunction;
+    FusionOperator op;
+    float weight; //of the fused sample for FUSION_BLEND
+    unsigned int threadCount;
+    MinMaxGrid grid; //of volume, built on the first updateOccupancy()
+    std::vector<unsigned char> brickOccupied; //per level 0 brick of the primary grid, none for the mask
+    double occupancyMilliseconds; //of the last updateOccupancy() that changed anything
+
+    FusedVolume(const Volume& volume) : volume(volume), grid(volume)
+    {
+        texFromWorld = primaryTexFromWorld();
+        op = FUSION_OVER;
+        weight = 0.5f;
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        occupancyMilliseconds = 0.0;
+    }
+
+    glm::vec3 texCoord(glm::vec3 worldPos) const
+    {
+        return glm::vec3(texFromWorld * glm::vec4(worldPos, 1.0f));
+    }
+
+    // Premultiplied RGBA at a world position, the opacity corrected for the
+    // planes the sample spans like the primary one.
+    glm::vec4 classify(glm::vec3 worldPos, int planes) const
+    {
+        glm::vec4 src = transferFunction.lookup(volume.sample(texCoord(worldPos)));
+        return planes > 1 ? correctOpacity(src, (float)planes) : src;
+    }
+
+    void bounds(glm::vec3& boxMin, glm::vec3& boxMax) const
+    {
+        volumeBounds(texFromWorld, glm::ivec3(volume.width, volume.height, volume.depth), boxMin, boxMax);
+    }
+
+    // The box both volumes are rendered in, with a primary volume of primarySize
+    // voxels; empty (boxMin == boxMax) if a mask's boxes do not overlap.
+    void proxyBounds(glm::ivec3 primarySize, glm::vec3& boxMin, glm::vec3& boxMax) const
+    {
+        glm::vec3 primaryMin, primaryMax;
+        volumeBounds(primaryTexFromWorld(), primarySize, primaryMin, primaryMax);
+        bounds(boxMin, boxMax);
+        if (op == FUSION_MASK)
+        {
+            boxMin = glm::max(boxMin, primaryMin);
+            boxMax = glm::max(glm::min(boxMax, primaryMax), boxMin);
+        }
+        else
+        {
+            boxMin = glm::min(boxMin, primaryMin);
+            boxMax = glm::max(boxMax, primaryMax);
+        }
+    }
+
+    // Marks the bricks of primary, clipped to the world box samples are taken
+    // in, for the current transfer function, placement and operator. Returns
+    // whether brickOccupied changed, otherwise nothing was done.
+    bool updateOccupancy(const MinMaxGrid& primary, glm::vec3 boxMin, glm::vec3 boxMax)
+    {
+        const MinMaxGrid::Level& base = primary.levels[0];
+        std::vector<float> opacity = transferFunction.opacity();
+        glm::ivec4 layout(base.width, base.height, base.depth, primary.brickSize);
+        if (op == FUSION_MASK)
+        {
+            bool changed = !brickOccupied.empty();
+            brickOccupied.clear();
+            occupiedLayout = glm::ivec4(0);
+            return changed;
+        }
+        if (grid.levels.empty())
+            grid.build(threadCount);
+        if (opacity == classifiedOpacity && texFromWorld == occupiedTransform && boxMin == occupiedMin && boxMax == occupiedMax
+            && layout == occupiedLayout)
+            return false;
+
+        auto start = std::chrono::high_resolution_clock::now();
+        if (opacity != classifiedOpacity)
+        {
+            grid.classify(opacity, threadCount);
+            classifiedOpacity = opacity;
+        }
+        occupiedTransform = texFromWorld;
+        occupiedMin = boxMin;
+        occupiedMax = boxMax;
+        occupiedLayout = layout;
+
+        //Primary voxel u lies at world (u + 0.5) / size / 2, this volume's voxel coordinates are
+        //texCoord * size - 0.5.
+        glm::vec3 primarySize(primary.volume.width, primary.volume.height, primary.volume.depth);
+        glm::vec3 size(volume.width, volume.height, volume.depth);
+        glm::mat4 voxelFromTex(1.0f);
+        for(int a = 0; a < 3; a++)
+        {
+            voxelFromTex[a][a] = size[a];
+            voxelFromTex[3][a] = -0.5f;
+        }
+        glm::mat4 voxelFromWorld = voxelFromTex * texFromWorld;
+        const MinMaxGrid::Level& own = grid.levels[0];
+        glm::ivec3 count(base.width, base.height, base.depth), ownCount(own.width, own.height, own.depth);
+        brickOccupied.assign(base.minValue.size(), 0);
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)base.depth)));
+        scheduler.run(base.depth, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int bz = tile.x0; bz < tile.x1; bz++)
+            {
+                for(int by = 0; by < base.height; by++)
+                {
+                    for(int bx = 0; bx < base.width; bx++)
+                    {
+                        //The brick's region in world space; the outer ones reach to the box.
+                        glm::ivec3 brick(bx, by, bz);
+                        glm::vec3 lo, hi;
+                        for(int a = 0; a < 3; a++)
+                        {
+                            lo[a] = brick[a] == 0 ? boxMin[a] : (brick[a] * primary.brickSize + 0.5f) / primarySize[a] * 0.5f;
+                            hi[a] = brick[a] == count[a] - 1 ? boxMax[a] : ((brick[a] + 1) * primary.brickSize + 0.5f) / primarySize[a] * 0.5f;
+                            lo[a] = std::max(lo[a], boxMin[a]);
+                            hi[a] = std::min(hi[a], boxMax[a]);
+                        }
+                        if (lo.x > hi.x || lo.y > hi.y || lo.z > hi.z)
+                            continue;
+                        glm::vec3 uMin(INFINITY), uMax(-INFINITY);
+                        for(int i = 0; i < 8; i++)
+                        {
+                            glm::vec3 corner((i & 2) ? hi.x : lo.x, (i & 1) ? hi.y : lo.y, (i & 4) ? hi.z : lo.z);
+                            glm::vec3 u = glm::vec3(voxelFromWorld * glm::vec4(corner, 1.0f));
+                            uMin = glm::min(uMin, u);
+                            uMax = glm::max(uMax, u);
+                        }
+                        glm::ivec3 first = glm::clamp(glm::ivec3(glm::floor(uMin / (float)grid.brickSize)), glm::ivec3(0), ownCount - 1);
+                        glm::ivec3 last = glm::clamp(glm::ivec3(glm::floor(uMax / (float)grid.brickSize)), glm::ivec3(0), ownCount - 1);
+                        brickOccupied[base.index(bx, by, bz)] = anyVisible(first, last);
+                    }
+                }
+            }
+        });
+        occupancyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+private:
+    std::vector<float> classifiedOpacity; //table grid was last classified with
+    glm::mat4 occupiedTransform = glm::mat4(0.0f); //placement, box and primary grid brickOccupied is for
+    glm::vec3 occupiedMin = glm::vec3(0.0f), occupiedMax = glm::vec3(0.0f);
+    glm::ivec4 occupiedLayout = glm::ivec4(0); //primary bricks per axis and brick size
+
+    // Whether any level 0 brick of grid in [first, last] is not empty.
+    bool anyVisible(glm::ivec3 first, glm::ivec3 last) const
+    {
+        const MinMaxGrid::Level& own = grid.levels[0];
+        for(int z = first.z; z <= last.z; z++)
+            for(int y = first.y; y <= last.y; y++)
+                for(int x = first.x; x <= last.x; x++)
+                    if (!own.empty[own.index(x, y, z)])
+                        return true;
+        return false;
+    }
+};
+#endif
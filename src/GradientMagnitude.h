@@ -0,0 +1,168 @@
+#ifndef GRADIENT_MAGNITUDE_H
+#define GRADIENT_MAGNITUDE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+#include <cmath>
+
+#include "Volume.h"
+#include "RayPacket.h"
+#include "TileScheduler.h"
+
+// Gradient magnitude of every voxel as a second 8-bit volume, for transfer
+// functions over value and |gradient|. A voxel stores min(|d|, 255) of the
+// central differences d = v(+1) - v(-1) with the border color (0) outside the
+// grid, i.e. twice the gradient in values per voxel, so a hard 0 to 255 step
+// along an axis just saturates. Being a Volume it filters like texture1 and
+// interleave() packs both into the RG8 texture shader.fs samples once the
+// magnitudes are needed.
+// With quantizeNormals the direction of d is kept too, as two bytes of
+// octahedral coordinates (see GradientRow) that index normalTable(): a
+// shaded sample reads the normal of its nearest voxel, interleaveNormals()
+// in a texture of their own, and the table instead of six trilinear samples.
+// The normals are in voxel space, scaled by the volume's size they point
+// along the world space gradient.
+// build() runs the rows through the SIMD kernels of RayPacket.h in (y, z)
+// tiles of the TileScheduler; the first and last voxel of each row, with a
+// border x neighbour, and rows of the scalar path are done here. All paths
+// give the same bytes.
+class GradientMagnitude
+{
+public:
+    static const int NORMAL_TABLE_SIZE = 256 * 256;
+    const Volume& volume;
+    Volume magnitude;
+    bool quantizeNormals = false;
+    std::vector<unsigned char> normalU, normalV; //per voxel, filled by build() with quantizeNormals
+    double milliseconds; //of the last build()
+
+    GradientMagnitude(const Volume& volume) : volume(volume), magnitude(volume.width, volume.height, volume.depth)
+    {
+        milliseconds = 0.0;
+    }
+
+    void build(SimdIsa simd = detectSimd(), unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        const int W = volume.width, H = volume.height, D = volume.depth;
+        normalU.resize(quantizeNormals ? volume.voxelCount() : 0);
+        normalV.resize(normalU.size());
+        std::vector<unsigned char> zeros(W, 0);
+        TileScheduler scheduler(std::max(1u, threadCount));
+        scheduler.run(H, D, H, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int z = tile.y0; z < tile.y1; z++)
+            {
+                for(int y = tile.x0; y < tile.x1; y++)
+                {
+                    size_t first = ((size_t)z * H + y) * W;
+                    const unsigned char* row = &volume.data[first];
+                    const unsigned char* ym = y > 0 ? row - W : zeros.data();
+                    const unsigned char* yp = y + 1 < H ? row + W : zeros.data();
+                    const unsigned char* zm = z > 0 ? row - (size_t)W * H : zeros.data();
+                    const unsigned char* zp = z + 1 < D ? row + (size_t)W * H : zeros.data();
+                    unsigned char* u = quantizeNormals ? &normalU[first] : nullptr;
+                    unsigned char* v = quantizeNormals ? &normalV[first] : nullptr;
+                    unsigned char* out = &magnitude.data[first];
+                    encode(W > 1 ? row[1] : 0, yp[0] - ym[0], zp[0] - zm[0], out, u, v);
+                    if (W < 2)
+                        continue;
+                    encode(-row[W - 2], yp[W - 1] - ym[W - 1], zp[W - 1] - zm[W - 1], out + W - 1, u ? u + W - 1 : u, v ? v + W - 1 : v);
+                    if (W < 3)
+                        continue;
+                    GradientRow inner = {row, row + 2, ym + 1, yp + 1, zm + 1, zp + 1, out + 1, W - 2, u ? u + 1 : u, v ? v + 1 : v};
+                    if (gradientRow(simd, inner))
+                        continue;
+                    for(int i = 0; i < inner.count; i++)
+                        encode(inner.xp[i] - inner.xm[i], inner.yp[i] - inner.ym[i], inner.zp[i] - inner.zm[i], inner.out + i,
+                               u ? inner.normalU + i : u, v ? inner.normalV + i : v);
+                }
+            }
+        });
+        milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // (value, magnitude) pairs in voxel order for a two channel texture.
+    std::vector<unsigned char> interleave() const
+    {
+        std::vector<unsigned char> packed(volume.voxelCount() * 2);
+        for(size_t i = 0; i < volume.voxelCount(); i++)
+        {
+            packed[2 * i] = volume.data[i];
+            packed[2 * i + 1] = magnitude.data[i];
+        }
+        return packed;
+    }
+
+    // (u, v) pairs of the quantized normals in voxel order, for their own two
+    // channel texture.
+    std::vector<unsigned char> interleaveNormals() const
+    {
+        std::vector<unsigned char> packed(normalU.size() * 2);
+        for(size_t i = 0; i < normalU.size(); i++)
+        {
+            packed[2 * i] = normalU[i];
+            packed[2 * i + 1] = normalV[i];
+        }
+        return packed;
+    }
+
+    // Voxel texture lookups with GL_NEAREST would read at texCoord.
+    size_t nearestVoxel(glm::vec3 texCoord) const
+    {
+        glm::ivec3 size(volume.width, volume.height, volume.depth);
+        glm::ivec3 voxel = glm::clamp(glm::ivec3(glm::floor(texCoord * glm::vec3(size))), glm::ivec3(0), size - 1);
+        return ((size_t)voxel.z * size.y + voxel.y) * size.x + voxel.x;
+    }
+
+    size_t normalIndex(size_t voxel) const
+    {
+        return (size_t)normalV[voxel] << 8 | normalU[voxel];
+    }
+
+    // Unit voxel space normals by index (v << 8) | u, the octahedron unfolded
+    // again; shader.fs uploads the same table.
+    static const std::vector<glm::vec3>& normalTable()
+    {
+        static const std::vector<glm::vec3> table = []()
+        {
+            std::vector<glm::vec3> normals(NORMAL_TABLE_SIZE);
+            for(int v = 0; v < 256; v++)
+            {
+                for(int u = 0; u < 256; u++)
+                {
+                    float x = u / 127.5f - 1.0f, y = v / 127.5f - 1.0f, z = 1.0f - fabsf(x) - fabsf(y);
+                    if (z < 0.0f)
+                    {
+                        float foldedX = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+                        y = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+                        x = foldedX;
+                    }
+                    normals[v * 256 + u] = glm::normalize(glm::vec3(x, y, z));
+                }
+            }
+            return normals;
+        }();
+        return table;
+    }
+
+private:
+    static void encode(int dx, int dy, int dz, unsigned char* out, unsigned char* u, unsigned char* v)
+    {
+        float squares = (float)(dx * dx + dy * dy + dz * dz);
+        *out = (unsigned char)(std::min(sqrtf(squares), 255.0f) + 0.5f);
+        if (u == nullptr)
+            return;
+        int l1 = abs(dx) + abs(dy) + abs(dz);
+        int x = dz >= 0 ? dx : (dx >= 0 ? 1 : -1) * (l1 - abs(dy)), y = dz >= 0 ? dy : (dy >= 0 ? 1 : -1) * (l1 - abs(dx));
+        int denominator = std::max(2 * l1, 1);
+        *u = (unsigned char)(((x + l1) * 255 + l1) / denominator);
+        *v = (unsigned char)(((y + l1) * 255 + l1) / denominator);
+    }
+};
+#endif
@@ -0,0 +1,175 @@
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <algorithm>
+
+// Float RGBA framebuffer for the CPU renderers. Row 0 is the bottom row, like
+// glReadPixels, and is flipped when written to disk.
+class Image
+{
+public:
+    int width, height;
+    std::vector<glm::vec4> pixels;
+
+    Image(int width = 0, int height = 0)
+    {
+        resize(width, height);
+    }
+
+    void resize(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        pixels.assign((size_t)width * height, glm::vec4(0.0f));
+    }
+
+    glm::vec4& at(int x, int y)
+    {
+        return pixels[(size_t)y * width + x];
+    }
+
+    const glm::vec4& at(int x, int y) const
+    {
+        return pixels[(size_t)y * width + x];
+    }
+
+    // PNG for names ending in .png, binary PPM otherwise.
+    bool write(const std::string& path) const
+    {
+        if (path.size() >= 4 && path.compare(path.size() - 4, 4, ".png") == 0)
+            return writePNG(path);
+        return writePPM(path);
+    }
+
+    bool writePPM(const std::string& path) const
+    {
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (fp == NULL)
+            return false;
+        fprintf(fp, "P6\n%d %d\n255\n", width, height);
+        std::vector<unsigned char> rows = rgbRows();
+        fwrite(rows.data(), 1, rows.size(), fp);
+        fclose(fp);
+        return true;
+    }
+
+    // 8-bit RGB PNG. The pixels go into stored (uncompressed) deflate blocks, which
+    // keeps the writer free of a zlib dependency at the cost of file size.
+    bool writePNG(const std::string& path) const
+    {
+        FILE* fp = fopen(path.c_str(), "wb");
+        if (fp == NULL)
+            return false;
+
+        static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+        fwrite(signature, 1, 8, fp);
+
+        std::vector<unsigned char> header;
+        put32(header, width);
+        put32(header, height);
+        header.push_back(8); //bit depth
+        header.push_back(2); //truecolor
+        header.push_back(0);
+        header.push_back(0);
+        header.push_back(0);
+        writeChunk(fp, "IHDR", header);
+
+        //Every scanline starts with filter type 0.
+        std::vector<unsigned char> rows = rgbRows();
+        std::vector<unsigned char> raw;
+        raw.reserve(rows.size() + height);
+        for(int y = 0; y < height; y++)
+        {
+            raw.push_back(0);
+            raw.insert(raw.end(), rows.begin() + (size_t)y * width * 3, rows.begin() + (size_t)(y + 1) * width * 3);
+        }
+
+        std::vector<unsigned char> zlib;
+        zlib.push_back(0x78);
+        zlib.push_back(0x01);
+        size_t offset = 0;
+        do
+        {
+            size_t len = std::min<size_t>(65535, raw.size() - offset);
+            zlib.push_back(offset + len == raw.size() ? 1 : 0);
+            zlib.push_back(len & 0xFF);
+            zlib.push_back((len >> 8) & 0xFF);
+            zlib.push_back(~len & 0xFF);
+            zlib.push_back((~len >> 8) & 0xFF);
+            zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + len);
+            offset += len;
+        } while (offset < raw.size());
+        put32(zlib, adler32(raw));
+        writeChunk(fp, "IDAT", zlib);
+
+        writeChunk(fp, "IEND", std::vector<unsigned char>());
+        fclose(fp);
+        return true;
+    }
+
+private:
+    // Top row first, clamped to 8 bits.
+    std::vector<unsigned char> rgbRows() const
+    {
+        std::vector<unsigned char> rows((size_t)width * height * 3);
+        for(int y = 0; y < height; y++)
+        {
+            for(int x = 0; x < width; x++)
+            {
+                glm::vec4 c = glm::clamp(at(x, height - 1 - y), 0.0f, 1.0f);
+                unsigned char* dst = &rows[((size_t)y * width + x) * 3];
+                dst[0] = (unsigned char)(c.r * 255.0f + 0.5f);
+                dst[1] = (unsigned char)(c.g * 255.0f + 0.5f);
+                dst[2] = (unsigned char)(c.b * 255.0f + 0.5f);
+            }
+        }
+        return rows;
+    }
+
+    static void put32(std::vector<unsigned char>& out, uint32_t value)
+    {
+        out.push_back((value >> 24) & 0xFF);
+        out.push_back((value >> 16) & 0xFF);
+        out.push_back((value >> 8) & 0xFF);
+        out.push_back(value & 0xFF);
+    }
+
+    static uint32_t adler32(const std::vector<unsigned char>& data)
+    {
+        uint32_t a = 1, b = 0;
+        for(size_t i = 0; i < data.size(); i++)
+        {
+            a = (a + data[i]) % 65521;
+            b = (b + a) % 65521;
+        }
+        return (b << 16) | a;
+    }
+
+    static uint32_t crc32(const unsigned char* data, size_t length, uint32_t crc = 0xFFFFFFFFu)
+    {
+        for(size_t i = 0; i < length; i++)
+        {
+            crc ^= data[i];
+            for(int k = 0; k < 8; k++)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+        return crc;
+    }
+
+    static void writeChunk(FILE* fp, const char* type, const std::vector<unsigned char>& data)
+    {
+        std::vector<unsigned char> chunk;
+        put32(chunk, (uint32_t)data.size());
+        chunk.insert(chunk.end(), type, type + 4);
+        chunk.insert(chunk.end(), data.begin(), data.end());
+        put32(chunk, crc32(chunk.data() + 4, chunk.size() - 4) ^ 0xFFFFFFFFu);
+        fwrite(chunk.data(), 1, chunk.size(), fp);
+    }
+};
+#endif
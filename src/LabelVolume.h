@@ -0,0 +1,319 @@
+#ifndef LABEL_VOLUME_H
+#define LABEL_VOLUME_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+#include "Volume.h"
+#include "TileScheduler.h"
+
+// How the samples of one label are drawn: the transfer function's color tinted
+// by color and its opacity scaled by opacity, nothing at all when hidden.
+struct LabelStyle
+{
+    glm::vec3 color = glm::vec3(1.0f);
+    float opacity = 1.0f;
+    bool visible = true;
+};
+
+// Segmentation of a Volume into labels, 8 or 16 bits per voxel as loaded, so
+// the intensities stay a single 8-bit copy next to it. Labels are read with
+// nearest filtering, the voxel whose cell holds the sample and the edge voxel
+// outside the grid (GL_NEAREST with GL_CLAMP_TO_EDGE), so ids are never
+// interpolated across a boundary. A classified sample is multiplied by
+// table[label] = (color * s, s) with s the opacity, or 0 when hidden, which
+// keeps it premultiplied; label 0, white and opaque by default, leaves the
+// unlabeled voxels to the transfer function alone. shader.fs uploads the same
+// table, 256 labels per row.
+// For empty-space skipping, buildBricks() lists the labels the nearest samples
+// in every MinMaxGrid brick can read and counts the shown ones. Showing or
+// hiding a label with setStyle() only visits the bricks listing it and queues
+// those whose count reaches or leaves zero in changedBricks, for
+// MinMaxGrid::updateHidden().
+class LabelVolume
+{
+public:
+    int width, height, depth;
+    int bytesPerLabel;
+    std::vector<unsigned char> data; //bytesPerLabel per voxel, little-endian
+    int labelCount; //one more than the largest label
+    std::vector<LabelStyle> styles;
+    std::vector<glm::vec4> table;
+    unsigned int threadCount;
+    int brickSize; //of the last buildBricks(), 0 before
+    std::vector<unsigned char> brickHidden; //no shown label in reach, per brick in MinMaxGrid order
+    std::vector<size_t> changedBricks; //whose brickHidden flipped since the grid last took them
+    double brickMilliseconds; //of the last buildBricks()
+    double styleMilliseconds; //of the last setStyle()
+    size_t visitedBricks; //by the last setStyle()
+
+    LabelVolume(int width, int height, int depth, int bytesPerLabel = 1)
+    {
+        this->width = width;
+        this->height = height;
+        this->depth = depth;
+        this->bytesPerLabel = bytesPerLabel;
+        data.resize((size_t)width * height * depth * bytesPerLabel, 0);
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        brickSize = 0;
+        brickMilliseconds = styleMilliseconds = 0.0;
+        visitedBricks = 0;
+        resetStyles(1);
+    }
+
+    // Raw labels of the volume's size, 8 or 16 bits per voxel by the file size.
+    bool load(const char* path)
+    {
+        FILE* fp = fopen(path, "rb");
+        if (fp == NULL)
+            return false;
+        fseek(fp, 0, SEEK_END);
+        long size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        size_t voxels = voxelCount();
+        bytesPerLabel = size == (long)(2 * voxels) ? 2 : 1;
+        data.resize(voxels * bytesPerLabel);
+        size_t count = fread(data.data(), 1, data.size(), fp);
+        fclose(fp);
+        if (count != data.size())
+            return false;
+        int largest = 0;
+        for(size_t i = 0; i < voxels; i++)
+            largest = std::max(largest, (int)label(i));
+        resetStyles(largest + 1);
+        return true;
+    }
+
+    // Synthetic segmentation for volumes without one: voxels of value 0 keep
+    // label 0, the others are cut into bands of equal width labelled 1 to bands.
+    void segmentByValue(const Volume& volume, int bands)
+    {
+        bands = std::min(std::max(bands, 1), 255);
+        bytesPerLabel = 1;
+        data.resize(volume.voxelCount());
+        for(size_t i = 0; i < data.size(); i++)
+            data[i] = volume.data[i] == 0 ? 0 : (unsigned char)(1 + (volume.data[i] - 1) * bands / 255);
+        resetStyles(bands + 1);
+    }
+
+    // One "label r g b opacity visible" line per label, # starts a comment;
+    // labels not listed keep their style.
+    bool loadStyles(const std::string& path)
+    {
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == NULL)
+            return false;
+        char line[256];
+        bool valid = true;
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            char* comment = strchr(line, '#');
+            if (comment != NULL)
+                *comment = '\0';
+            int label, visible;
+            LabelStyle style;
+            int fields = sscanf(line, "%d %f %f %f %f %d", &label, &style.color.r, &style.color.g, &style.color.b, &style.opacity, &visible);
+            if (fields <= 0)
+                continue;
+            if (fields != 6 || label < 0)
+            {
+                valid = false;
+                break;
+            }
+            if (label >= labelCount)
+                continue;
+            style.color = glm::clamp(style.color, 0.0f, 1.0f);
+            style.opacity = glm::clamp(style.opacity, 0.0f, 1.0f);
+            style.visible = visible != 0;
+            setStyle(label, style);
+        }
+        fclose(fp);
+        return valid;
+    }
+
+    size_t voxelCount() const
+    {
+        return (size_t)width * height * depth;
+    }
+
+    unsigned int label(size_t voxel) const
+    {
+        return bytesPerLabel == 1 ? data[voxel] : (unsigned int)(data[2 * voxel] | data[2 * voxel + 1] << 8);
+    }
+
+    bool shown(int label) const
+    {
+        return styles[label].visible && styles[label].opacity > 0.0f;
+    }
+
+    // Label of the voxel nearest to texCoord, the edge voxel outside the grid.
+    unsigned int labelAt(glm::vec3 texCoord) const
+    {
+        int x = std::min(std::max((int)floorf(texCoord.x * width), 0), width - 1);
+        int y = std::min(std::max((int)floorf(texCoord.y * height), 0), height - 1);
+        int z = std::min(std::max((int)floorf(texCoord.z * depth), 0), depth - 1);
+        return label(((size_t)z * height + y) * width + x);
+    }
+
+    // What a classified sample at texCoord is multiplied by.
+    glm::vec4 lookup(glm::vec3 texCoord) const
+    {
+        return table[labelAt(texCoord)];
+    }
+
+    // Sets the style and its table entry; if that shows or hides the label,
+    // the shown count of every brick listing it moves by one.
+    void setStyle(int label, const LabelStyle& style)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        bool wasShown = shown(label);
+        styles[label] = style;
+        table[label] = entry(style);
+        visitedBricks = 0;
+        if (brickSize > 0 && wasShown != shown(label))
+        {
+            int delta = shown(label) ? 1 : -1;
+            for(unsigned int b = labelFirst[label]; b < labelFirst[label + 1]; b++)
+            {
+                size_t brick = labelBricks[b];
+                shownCount[brick] += delta;
+                unsigned char hidden = shownCount[brick] == 0;
+                if (hidden != brickHidden[brick])
+                {
+                    brickHidden[brick] = hidden;
+                    changedBricks.push_back(brick);
+                }
+            }
+            visitedBricks = labelFirst[label + 1] - labelFirst[label];
+        }
+        styleMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Label lists of the bricks of a MinMaxGrid with this brickSize, in z-slab
+    // tiles of the TileScheduler. Nearest samples in brick b along an axis read
+    // voxels b * brickSize to (b + 1) * brickSize, the last voxel included.
+    void buildBricks(int brickSize)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        this->brickSize = brickSize;
+        bricksX = (width + brickSize - 1) / brickSize;
+        bricksY = (height + brickSize - 1) / brickSize;
+        bricksZ = (depth + brickSize - 1) / brickSize;
+        size_t brickCount = (size_t)bricksX * bricksY * bricksZ;
+        std::vector<std::vector<unsigned short>> lists(brickCount);
+
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)bricksZ)));
+        std::vector<std::vector<unsigned int>> seen(scheduler.threadCount, std::vector<unsigned int>(labelCount, 0));
+        std::vector<unsigned int> stamps(scheduler.threadCount, 0);
+        scheduler.run(bricksZ, 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+        {
+            //marks[l] == stamp marks the labels already listed for the current brick.
+            std::vector<unsigned int>& marks = seen[worker];
+            unsigned int& stamp = stamps[worker];
+            for(int bz = tile.x0; bz < tile.x1; bz++)
+            {
+                for(int by = 0; by < bricksY; by++)
+                {
+                    for(int bx = 0; bx < bricksX; bx++)
+                    {
+                        stamp++;
+                        std::vector<unsigned short>& list = lists[((size_t)bz * bricksY + by) * bricksX + bx];
+                        int x1 = std::min((bx + 1) * brickSize, width - 1), y1 = std::min((by + 1) * brickSize, height - 1);
+                        int z1 = std::min((bz + 1) * brickSize, depth - 1);
+                        for(int z = bz * brickSize; z <= z1; z++)
+                        {
+                            for(int y = by * brickSize; y <= y1; y++)
+                            {
+                                size_t row = ((size_t)z * height + y) * width;
+                                for(int x = bx * brickSize; x <= x1; x++)
+                                {
+                                    unsigned int l = label(row + x);
+                                    if (marks[l] != stamp)
+                                    {
+                                        marks[l] = stamp;
+                                        list.push_back((unsigned short)l);
+                                    }
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        });
+
+        //Bricks per label by a counting sort of the lists.
+        labelFirst.assign(labelCount + 1, 0);
+        for(const std::vector<unsigned short>& list : lists)
+            for(unsigned short l : list)
+                labelFirst[l + 1]++;
+        for(int l = 0; l < labelCount; l++)
+            labelFirst[l + 1] += labelFirst[l];
+        labelBricks.resize(labelFirst[labelCount]);
+        std::vector<unsigned int> next(labelFirst.begin(), labelFirst.end() - 1);
+        shownCount.assign(brickCount, 0);
+        for(size_t brick = 0; brick < brickCount; brick++)
+        {
+            for(unsigned short l : lists[brick])
+            {
+                labelBricks[next[l]++] = (unsigned int)brick;
+                shownCount[brick] += shown(l) ? 1 : 0;
+            }
+        }
+        brickHidden.resize(brickCount);
+        for(size_t brick = 0; brick < brickCount; brick++)
+            brickHidden[brick] = shownCount[brick] == 0;
+        changedBricks.clear();
+        brickMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Bytes of the brick lists, per label and per brick.
+    size_t brickBytes() const
+    {
+        return labelFirst.size() * sizeof(unsigned int) + labelBricks.size() * sizeof(unsigned int) + shownCount.size() * sizeof(unsigned short)
+               + brickHidden.size();
+    }
+
+    // Rows of 256 table entries, as shader.fs reads them.
+    int tableRows() const
+    {
+        return (labelCount + 255) / 256;
+    }
+
+private:
+    int bricksX = 0, bricksY = 0, bricksZ = 0;
+    std::vector<unsigned int> labelFirst; //bricks of label l are labelBricks[labelFirst[l]] to labelBricks[labelFirst[l + 1] - 1]
+    std::vector<unsigned int> labelBricks;
+    std::vector<unsigned short> shownCount; //per brick
+
+    static glm::vec4 entry(const LabelStyle& style)
+    {
+        float s = style.visible ? style.opacity : 0.0f;
+        return glm::vec4(style.color * s, s);
+    }
+
+    // Label 0 white, the others from a small palette; all shown.
+    void resetStyles(int count)
+    {
+        static const glm::vec3 PALETTE[] = {{0.90f, 0.45f, 0.30f}, {0.40f, 0.70f, 1.00f}, {1.00f, 0.85f, 0.40f}, {0.60f, 1.00f, 0.50f},
+                                            {0.85f, 0.50f, 1.00f}, {0.40f, 1.00f, 0.90f}, {1.00f, 0.55f, 0.70f}, {0.75f, 0.75f, 0.40f}};
+        labelCount = count;
+        styles.assign(count, LabelStyle());
+        for(int l = 1; l < count; l++)
+            styles[l].color = PALETTE[(l - 1) % 8];
+        table.resize(count);
+        for(int l = 0; l < count; l++)
+            table[l] = entry(styles[l]);
+        brickSize = 0;
+        brickHidden.clear();
+        changedBricks.clear();
+    }
+};
+#endif
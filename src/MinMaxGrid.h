@@ -0,0 +1,357 @@
+#ifndef MIN_MAX_GRID_H
+#define MIN_MAX_GRID_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "Volume.h"
+#include "TileScheduler.h"
+
+// Hierarchy of min-max bricks for empty-space skipping. Level 0 splits the
+// volume into brickSize^3 bricks, every further level merges 2x2x2 nodes of the
+// one below until a single node is left. A node stores the value range of all
+// voxels a trilinear sample inside it can touch, i.e. its voxels plus the next
+// one on each axis and the border color (0) where it reaches outside the grid;
+// with a filterRadius of 2, for the cubic B-spline, one more on either side.
+// classify() marks nodes whose whole range maps to zero opacity; samples in
+// them contribute nothing, so rays can leap to the node's exit. It runs after
+// every transfer function edit, so it looks a range up in a prefix count of
+// the opaque entries, O(1) per node whatever its width.
+// With a segmentation, hide() marks the bricks where no shown label can be
+// read (see LabelVolume) and their parents where all children are hidden;
+// those are empty too. updateHidden() redoes only the bricks a label toggle
+// changed and their ancestors.
+// With a FusedVolume, occupy() marks the bricks where its samples can be
+// visible and their parents where any child is; those are never empty, so
+// rays only leap where neither volume shows anything.
+//
+// Positions are in voxel coordinates u = texCoord * size - 0.5, the frame
+// Volume::sample() filters in. Node i of a level covers [i * S, (i + 1) * S)
+// with S = brickSize << level, the first and last node on each axis reach out
+// to infinity so the whole filtered border belongs to some node.
+class MinMaxGrid
+{
+public:
+    struct Level
+    {
+        int width, height, depth; //in nodes
+        std::vector<unsigned char> minValue, maxValue;
+        std::vector<unsigned char> empty; //set by classify()
+        std::vector<unsigned char> hidden; //set by hide(), none when empty
+        std::vector<unsigned char> occupied; //set by occupy(), none when empty
+
+        size_t index(int x, int y, int z) const
+        {
+            return ((size_t)z * height + y) * width + x;
+        }
+    };
+
+    const Volume& volume;
+    int brickSize;
+    int filterRadius = 1; //a sample touches the voxels floor(u) - filterRadius + 1 to floor(u) + filterRadius, set before build()
+    std::vector<Level> levels;
+    double classifyMilliseconds = 0.0; //of the last classify()
+    double hideMilliseconds = 0.0; //of the last hide() or updateHidden()
+    double occupyMilliseconds = 0.0; //of the last occupy()
+    size_t hiddenUpdates = 0; //nodes redone by the last updateHidden()
+
+    MinMaxGrid(const Volume& volume, int brickSize = 8) : volume(volume)
+    {
+        this->brickSize = brickSize;
+        invBrickSize = 1.0f / brickSize;
+    }
+
+    // Level 0 from the voxels in z-slab tiles of the TileScheduler, then the coarser levels.
+    void build(unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        levels.clear();
+        Level base;
+        base.width = (volume.width + brickSize - 1) / brickSize;
+        base.height = (volume.height + brickSize - 1) / brickSize;
+        base.depth = (volume.depth + brickSize - 1) / brickSize;
+        base.minValue.resize((size_t)base.width * base.height * base.depth);
+        base.maxValue.resize(base.minValue.size());
+        levels.push_back(base);
+
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)base.depth)));
+        scheduler.run(base.depth, 1, 1, 1, [this](const WorkTile& tile, unsigned int)
+        {
+            for(int bz = tile.x0; bz < tile.x1; bz++)
+                buildBrickSlab(bz);
+        });
+
+        while (levels.back().width > 1 || levels.back().height > 1 || levels.back().depth > 1)
+            levels.push_back(reduce(levels.back()));
+    }
+
+    // Marks the nodes whose value range has zero opacity in a 256 entry table,
+    // runs of CLASSIFY_GRAIN nodes spread over the TileScheduler.
+    void classify(const std::vector<float>& opacity, unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        opaque[0] = 0;
+        for(int v = 0; v < 256; v++)
+            opaque[v + 1] = opaque[v] + (opacity[v] > 0.0f ? 1 : 0);
+
+        //All levels in one run, node n of the concatenation is node n - first[l] of level l.
+        std::vector<int> first(levels.size() + 1, 0);
+        for(size_t l = 0; l < levels.size(); l++)
+        {
+            levels[l].empty.resize(levels[l].minValue.size());
+            first[l + 1] = first[l] + (int)levels[l].minValue.size();
+        }
+        TileScheduler scheduler(std::max(1u, threadCount));
+        scheduler.run(first.back(), 1, CLASSIFY_GRAIN, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(size_t l = 0; l < levels.size(); l++)
+            {
+                Level& level = levels[l];
+                for(int n = std::max(tile.x0, first[l]); n < std::min(tile.x1, first[l + 1]); n++)
+                {
+                    size_t i = n - first[l];
+                    level.empty[i] = isEmpty(level, i);
+                }
+            }
+        });
+        classifyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Hidden flags per level 0 brick, all levels derived from them; an empty
+    // vector shows everything again. classify() keeps applying them, build()
+    // drops them.
+    void hide(const std::vector<unsigned char>& brickHidden)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        levels[0].hidden = brickHidden;
+        for(size_t l = 1; l < levels.size(); l++)
+        {
+            Level& level = levels[l];
+            level.hidden.clear();
+            if (brickHidden.empty())
+                continue;
+            level.hidden.resize(level.minValue.size());
+            for(size_t i = 0; i < level.hidden.size(); i++)
+                level.hidden[i] = allChildren(l, i, &Level::hidden, true);
+        }
+        for(Level& level : levels)
+            for(size_t i = 0; i < level.empty.size(); i++)
+                level.empty[i] = isEmpty(level, i);
+        hideMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Takes the new flags of the given bricks, which may repeat, and redoes
+    // them and their ancestors only. Needs hide() and classify() first.
+    void updateHidden(const std::vector<size_t>& bricks, const std::vector<unsigned char>& brickHidden)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        std::vector<size_t> nodes = bricks;
+        std::sort(nodes.begin(), nodes.end());
+        nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        hiddenUpdates = 0;
+        for(size_t l = 0; l < levels.size() && !nodes.empty(); l++)
+        {
+            Level& level = levels[l];
+            for(size_t i : nodes)
+            {
+                level.hidden[i] = l == 0 ? brickHidden[i] : allChildren(l, i, &Level::hidden, true);
+                level.empty[i] = isEmpty(level, i);
+            }
+            hiddenUpdates += nodes.size();
+            if (l + 1 == levels.size())
+                break;
+            //Parents in the same order, so duplicates are neighbours.
+            const Level& parent = levels[l + 1];
+            for(size_t& i : nodes)
+            {
+                size_t x = i % level.width, y = i / level.width % level.height, z = i / ((size_t)level.width * level.height);
+                i = parent.index((int)x / 2, (int)y / 2, (int)z / 2);
+            }
+            std::sort(nodes.begin(), nodes.end());
+            nodes.erase(std::unique(nodes.begin(), nodes.end()), nodes.end());
+        }
+        hideMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Occupied flags per level 0 brick, a parent is occupied if any child is;
+    // an empty vector clears them. Kept like the hidden flags.
+    void occupy(const std::vector<unsigned char>& brickOccupied)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        levels[0].occupied = brickOccupied;
+        for(size_t l = 1; l < levels.size(); l++)
+        {
+            Level& level = levels[l];
+            level.occupied.clear();
+            if (brickOccupied.empty())
+                continue;
+            level.occupied.resize(level.minValue.size());
+            for(size_t i = 0; i < level.occupied.size(); i++)
+                level.occupied[i] = !allChildren(l, i, &Level::occupied, false);
+        }
+        for(Level& level : levels)
+            for(size_t i = 0; i < level.empty.size(); i++)
+                level.empty[i] = isEmpty(level, i);
+        occupyMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // Coarsest empty node around voxel position u. Returns false if the brick
+    // there is occupied; either way nodeMin/nodeMax receive the bounds of the
+    // node found (the level 0 brick when occupied), in voxel coordinates.
+    bool emptyNode(glm::vec3 u, glm::vec3& nodeMin, glm::vec3& nodeMax) const
+    {
+        return coarsestNode(u, [](const Level& level, size_t i) { return level.empty[i] != 0; }, nodeMin, nodeMax);
+    }
+
+    // Like emptyNode() for any node test skippable(level, index) that holds
+    // for the parent only if it holds for all its children, e.g. a bound on
+    // maxValue.
+    template<class Test>
+    bool coarsestNode(glm::vec3 u, Test skippable, glm::vec3& nodeMin, glm::vec3& nodeMax) const
+    {
+        const Level& base = levels[0];
+        glm::ivec3 node(clampIndex(u.x, base.width), clampIndex(u.y, base.height), clampIndex(u.z, base.depth));
+        bool found = skippable(base, base.index(node.x, node.y, node.z));
+        int level = 0;
+        while (found && level + 1 < (int)levels.size())
+        {
+            const Level& parent = levels[level + 1];
+            glm::ivec3 parentNode = node / 2;
+            if (!skippable(parent, parent.index(parentNode.x, parentNode.y, parentNode.z)))
+                break;
+            node = parentNode;
+            level++;
+        }
+
+        const Level& match = levels[level];
+        float size = (float)(brickSize << level);
+        glm::ivec3 count(match.width, match.height, match.depth);
+        for(int a = 0; a < 3; a++)
+        {
+            nodeMin[a] = node[a] == 0 ? -INFINITY : node[a] * size;
+            nodeMax[a] = node[a] == count[a] - 1 ? INFINITY : (node[a] + 1) * size;
+        }
+        return found;
+    }
+
+    // Level 0 brick containing voxel position u.
+    size_t brickIndex(glm::vec3 u) const
+    {
+        const Level& base = levels[0];
+        return base.index(clampIndex(u.x, base.width), clampIndex(u.y, base.height), clampIndex(u.z, base.depth));
+    }
+
+    size_t nodeCount() const
+    {
+        size_t count = 0;
+        for(size_t l = 0; l < levels.size(); l++)
+            count += levels[l].minValue.size();
+        return count;
+    }
+
+    // Fraction of the level 0 bricks classified empty.
+    float emptyFraction() const
+    {
+        const Level& base = levels[0];
+        size_t count = std::count(base.empty.begin(), base.empty.end(), (unsigned char)1);
+        return base.empty.empty() ? 0.0f : (float)count / base.empty.size();
+    }
+
+private:
+    static const int CLASSIFY_GRAIN = 16384;
+    float invBrickSize;
+    //opaque[v] counts the entries below v with nonzero opacity, [a, b] is transparent if opaque[b + 1] == opaque[a].
+    int opaque[257] = {};
+
+    bool isEmpty(const Level& level, size_t i) const
+    {
+        bool transparent = opaque[level.maxValue[i] + 1] == opaque[level.minValue[i]] || (!level.hidden.empty() && level.hidden[i]);
+        return transparent && (level.occupied.empty() || !level.occupied[i]);
+    }
+
+    // Whether the flags of all children of node i of level l > 0 are set, or all clear.
+    bool allChildren(size_t l, size_t i, std::vector<unsigned char> Level::*flags, bool set) const
+    {
+        const Level& level = levels[l];
+        const Level& child = levels[l - 1];
+        int x = (int)(i % level.width), y = (int)(i / level.width % level.height), z = (int)(i / ((size_t)level.width * level.height));
+        for(int cz = 2 * z; cz < std::min(2 * z + 2, child.depth); cz++)
+            for(int cy = 2 * y; cy < std::min(2 * y + 2, child.height); cy++)
+                for(int cx = 2 * x; cx < std::min(2 * x + 2, child.width); cx++)
+                    if (((child.*flags)[child.index(cx, cy, cz)] != 0) != set)
+                        return false;
+        return true;
+    }
+
+    int clampIndex(float u, int count) const
+    {
+        return std::min(std::max((int)floorf(u * invBrickSize), 0), count - 1);
+    }
+
+    void buildBrickSlab(int bz)
+    {
+        Level& base = levels[0];
+        const int W = volume.width, H = volume.height, D = volume.depth;
+        //A trilinear sample at u interpolates floor(u) and floor(u) + 1, so a brick also covers
+        //the voxel after it, a B-spline one more either side. The outer bricks, and those
+        //whose reach passes the last voxel, reach into the border, which reads as 0.
+        const int before = filterRadius - 1, after = filterRadius - 1;
+        int z0 = std::max(bz * brickSize - before, 0), z1 = std::min((bz + 1) * brickSize + after, D - 1);
+        bool borderZ = bz == 0 || bz == base.depth - 1 || (bz + 1) * brickSize + after > D - 1;
+        for(int by = 0; by < base.height; by++)
+        {
+            int y0 = std::max(by * brickSize - before, 0), y1 = std::min((by + 1) * brickSize + after, H - 1);
+            bool borderY = by == 0 || by == base.height - 1 || (by + 1) * brickSize + after > H - 1;
+            for(int bx = 0; bx < base.width; bx++)
+            {
+                int x0 = std::max(bx * brickSize - before, 0), x1 = std::min((bx + 1) * brickSize + after, W - 1);
+                bool border = borderZ || borderY || bx == 0 || bx == base.width - 1 || (bx + 1) * brickSize + after > W - 1;
+                unsigned char minValue = border ? 0 : 255, maxValue = 0;
+                for(int z = z0; z <= z1; z++)
+                {
+                    for(int y = y0; y <= y1; y++)
+                    {
+                        const unsigned char* row = &volume.data[((size_t)z * H + y) * W];
+                        for(int x = x0; x <= x1; x++)
+                        {
+                            minValue = std::min(minValue, row[x]);
+                            maxValue = std::max(maxValue, row[x]);
+                        }
+                    }
+                }
+                size_t i = base.index(bx, by, bz);
+                base.minValue[i] = minValue;
+                base.maxValue[i] = maxValue;
+            }
+        }
+    }
+
+    static Level reduce(const Level& child)
+    {
+        Level level;
+        level.width = (child.width + 1) / 2;
+        level.height = (child.height + 1) / 2;
+        level.depth = (child.depth + 1) / 2;
+        level.minValue.assign((size_t)level.width * level.height * level.depth, 255);
+        level.maxValue.assign(level.minValue.size(), 0);
+        for(int z = 0; z < child.depth; z++)
+        {
+            for(int y = 0; y < child.height; y++)
+            {
+                for(int x = 0; x < child.width; x++)
+                {
+                    size_t src = child.index(x, y, z);
+                    size_t dst = level.index(x / 2, y / 2, z / 2);
+                    level.minValue[dst] = std::min(level.minValue[dst], child.minValue[src]);
+                    level.maxValue[dst] = std::max(level.maxValue[dst], child.maxValue[src]);
+                }
+            }
+        }
+        return level;
+    }
+};
+#endif
@@ -0,0 +1,158 @@
+#ifndef PRE_INTEGRATION_H
+#define PRE_INTEGRATION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "TransferFunction.h"
+#include "TileScheduler.h"
+
+// Pre-integrated classification: entry (front, back) holds the premultiplied
+// RGBA of a whole ray segment along which the value runs linearly from front
+// to back, so a sample pair classifies everything between two slices and a
+// thin feature of the transfer function no longer falls between them.
+// segmentRatio is the segment length in units of the distance the transfer
+// function's opacity is meant for.
+// The table is built from two integral functions of the transfer function,
+// T(s) for the extinction -ln(1 - a) and K(s) for the extinction-weighted
+// color, each extended by one entry after the other. A segment then takes the
+// mean extinction (T(b) - T(f)) / (b - f) and mean color (K(b) - K(f)) /
+// (T(b) - T(f)) in O(1), O(n^2) for the table, without self-attenuation
+// inside the segment. Equal ends fall back to the transfer function with its
+// opacity corrected to the segment length.
+// update() compares the transfer function with the one the table was built
+// from and rebuilds only the segments whose value range overlaps the entries
+// that changed, rows spread over the TileScheduler.
+class PreIntegrationTable
+{
+public:
+    static const int SIZE = TransferFunction::SIZE;
+    std::vector<glm::vec4> table; //SIZE * SIZE, row by front value, column by back value
+    unsigned int threadCount;
+    double buildMilliseconds = 0.0; //last update() that changed anything
+    size_t rebuiltEntries = 0; //by that update()
+
+    PreIntegrationTable()
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        segmentRatio = 0.0f;
+    }
+
+    // Returns whether the table changed.
+    bool update(const TransferFunction& transferFunction, float ratio)
+    {
+        int first = 0, last = SIZE - 1;
+        if (ratio == segmentRatio && table.size() == (size_t)SIZE * SIZE)
+        {
+            first = SIZE;
+            last = -1;
+            for(int v = 0; v < SIZE; v++)
+            {
+                if (built[v] == transferFunction.table[v])
+                    continue;
+                first = std::min(first, v);
+                last = v;
+            }
+            if (first > last)
+                return false;
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        built = transferFunction.table;
+        segmentRatio = ratio;
+        table.resize((size_t)SIZE * SIZE);
+        integrate();
+
+        //A segment sees the entries between its two ends, and the one at both ends when they are equal.
+        std::vector<size_t> counts(SIZE, 0);
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)SIZE)));
+        scheduler.run(SIZE, 1, 8, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int f = tile.x0; f < tile.x1; f++)
+            {
+                int from = f <= last ? std::max(f, first) : SIZE;
+                for(int b = from; b < SIZE; b++)
+                {
+                    glm::vec4 color = segment(f, b);
+                    table[(size_t)f * SIZE + b] = color;
+                    table[(size_t)b * SIZE + f] = color;
+                }
+                counts[f] = SIZE - from;
+            }
+        });
+
+        rebuiltEntries = 0;
+        for(int f = 0; f < SIZE; f++)
+            rebuiltEntries += counts[f];
+        buildMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        return true;
+    }
+
+    // Segment from a sample in [0,1] to the next, bilinear between the
+    // entries like the GL_LINEAR fetch shader.fs does.
+    glm::vec4 lookup(float front, float back) const
+    {
+        float x = glm::clamp(back, 0.0f, 1.0f) * (SIZE - 1), y = glm::clamp(front, 0.0f, 1.0f) * (SIZE - 1);
+        int i = std::min((int)x, SIZE - 2), j = std::min((int)y, SIZE - 2);
+        float fx = x - i, fy = y - j;
+        const glm::vec4* row = &table[(size_t)j * SIZE + i];
+        glm::vec4 top = row[0] + (row[1] - row[0]) * fx;
+        glm::vec4 bottom = row[SIZE] + (row[SIZE + 1] - row[SIZE]) * fx;
+        return top + (bottom - top) * fy;
+    }
+
+    float ratio() const
+    {
+        return segmentRatio;
+    }
+
+private:
+    float segmentRatio;
+    std::vector<glm::vec4> built; //transfer function table the entries were computed from
+    std::vector<float> extinction; //T(s)
+    std::vector<glm::vec3> emission; //K(s)
+
+    static float extinctionOf(float alpha)
+    {
+        return -logf(1.0f - std::min(alpha, 0.9999f));
+    }
+
+    // Trapezoids between the entries, exact for the linear pieces of the extinction.
+    void integrate()
+    {
+        extinction.assign(SIZE, 0.0f);
+        emission.assign(SIZE, glm::vec3(0.0f));
+        for(int v = 1; v < SIZE; v++)
+        {
+            float tau0 = extinctionOf(built[v - 1].a), tau1 = extinctionOf(built[v].a);
+            extinction[v] = extinction[v - 1] + 0.5f * (tau0 + tau1);
+            emission[v] = emission[v - 1] + 0.5f * (chromaticity(v - 1) * tau0 + chromaticity(v) * tau1);
+        }
+    }
+
+    glm::vec3 chromaticity(int v) const
+    {
+        return built[v].a > 0.0f ? glm::vec3(built[v]) / built[v].a : glm::vec3(0.0f);
+    }
+
+    glm::vec4 segment(int f, int b) const
+    {
+        int lo = std::min(f, b), hi = std::max(f, b);
+        if (lo == hi)
+        {
+            float alpha = 1.0f - powf(1.0f - std::min(built[lo].a, 0.9999f), segmentRatio);
+            return glm::vec4(chromaticity(lo) * alpha, alpha);
+        }
+        float tau = extinction[hi] - extinction[lo];
+        if (tau <= 0.0f)
+            return glm::vec4(0.0f);
+        float alpha = 1.0f - expf(-segmentRatio * tau / (hi - lo));
+        return glm::vec4((emission[hi] - emission[lo]) / tau * alpha, alpha);
+    }
+};
+#endif
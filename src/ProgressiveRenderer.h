@@ -0,0 +1,262 @@
+#ifndef PROGRESSIVE_RENDERER_H
+#define PROGRESSIVE_RENDERER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+
+#include "Image.h"
+#include "RayCaster.h"
+#include "TileScheduler.h"
+
+struct ProgressiveStats
+{
+    double firstImageMilliseconds = -1.0; //since restart(), -1 until the first pass finished
+    double convergedMilliseconds = -1.0; //since restart(), -1 until the last pass finished
+    std::vector<double> passMilliseconds; //since restart(), when each pass finished
+    unsigned long long rays = 0;
+    unsigned long long samples = 0;
+    unsigned long long cancelledTiles = 0; //left undone by cancel() or restart()
+    int restarts = 0;
+};
+
+// Progressive refinement on top of the RayCaster for interactive viewing.
+// Pass 0 casts one ray per coarseBlock^2 pixels with coarseStride planes per
+// sample and fills the blocks with it, which is the first image; every further
+// pass halves the block edge and the stride, casting only the pixels that are
+// not exact yet and filling their smaller blocks in place. The last pass casts
+// every pixel at full sample rate, so the converged frame equals render().
+// Passes are cut into regionSize tiles handed out by priority: closeness to
+// the screen centre and the variance the previous pass saw in the tile, so
+// the middle of the view and edges sharpen first.
+// refine() works for a time budget and returns, keeping its place; restart()
+// for a new camera drops the remaining work, and cancel() stops a refine()
+// running on another thread after the tiles in flight; nothing more is done
+// until the next restart().
+class ProgressiveRenderer
+{
+public:
+    RayCaster& rayCaster;
+    Image image;
+    int coarseBlock; //pixel edge of pass 0 blocks, a power of two
+    int coarseStride; //planes per sample in pass 0, at most RAY_PACKET_MAX_STEP
+    int regionSize; //pixel edge of the tiles passes are scheduled in, a multiple of coarseBlock
+    float centreWeight; //share of the centre in the tile priority, the rest is variance
+    ProgressiveStats stats;
+
+    ProgressiveRenderer(RayCaster& rayCaster, int width, int height) : rayCaster(rayCaster), image(width, height)
+    {
+        coarseBlock = 8;
+        coarseStride = 4;
+        regionSize = 32;
+        centreWeight = 0.5f;
+        cancelled = false;
+        pass = passCount = 0;
+        exact.assign((size_t)width * height, 0);
+    }
+
+    // Starts over for a new camera, pending tiles of the old one are dropped.
+    void restart(glm::mat4 view, glm::mat4 projection)
+    {
+        //Times start over, the counts of dropped work carry on.
+        unsigned long long cancelledTiles = stats.cancelledTiles;
+        if (pass < passCount)
+            cancelledTiles += std::count(tileDone.begin(), tileDone.end(), (unsigned char)0);
+        int restarts = stats.restarts + (passCount > 0 ? 1 : 0);
+        stats = ProgressiveStats();
+        stats.cancelledTiles = cancelledTiles;
+        stats.restarts = restarts;
+
+        this->view = view;
+        this->projection = projection;
+        cancelled = false;
+        std::fill(exact.begin(), exact.end(), (unsigned char)0);
+        passCount = 1;
+        for(int block = std::max(coarseBlock, 1); block > 1; block /= 2)
+            passCount++;
+        pass = 0;
+        start = std::chrono::high_resolution_clock::now();
+        beginPass();
+    }
+
+    // Safe to call from another thread while refine() runs.
+    void cancel()
+    {
+        cancelled = true;
+    }
+
+    bool converged() const
+    {
+        return pass >= passCount;
+    }
+
+    // Refines for about budgetMilliseconds (tiles already started finish),
+    // returns true once converged. A negative budget runs to convergence.
+    bool refine(double budgetMilliseconds)
+    {
+        auto begin = std::chrono::high_resolution_clock::now();
+        auto elapsed = [&begin]()
+        {
+            return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+        };
+
+        while (!converged() && !cancelled)
+        {
+            //Highest priority first: the owner walks the list from the front, thieves take the far half.
+            std::vector<int> pending;
+            for(size_t t = 0; t < order.size(); t++)
+                if (!tileDone[order[t]])
+                    pending.push_back(order[t]);
+
+            std::vector<RayCastStats> counts(rayCaster.threadCount);
+            TileScheduler scheduler(rayCaster.threadCount);
+            scheduler.run((int)pending.size(), 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+            {
+                if (cancelled || (budgetMilliseconds >= 0.0 && elapsed() > budgetMilliseconds))
+                    return;
+                refineTile(pending[tile.x0], counts[worker]);
+                tileDone[pending[tile.x0]] = 1;
+            });
+            for(size_t t = 0; t < counts.size(); t++)
+            {
+                stats.rays += counts[t].rays;
+                stats.samples += counts[t].samples;
+            }
+
+            if (std::count(tileDone.begin(), tileDone.end(), (unsigned char)0) > 0)
+                break;
+            double now = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+            stats.passMilliseconds.push_back(now);
+            if (pass == 0)
+                stats.firstImageMilliseconds = now;
+            pass++;
+            if (converged())
+                stats.convergedMilliseconds = now;
+            else
+                beginPass();
+            if (budgetMilliseconds >= 0.0 && elapsed() > budgetMilliseconds)
+                break;
+        }
+        return converged();
+    }
+
+    int passIndex() const
+    {
+        return pass;
+    }
+
+private:
+    glm::mat4 view, projection;
+    std::chrono::high_resolution_clock::time_point start;
+    std::atomic<bool> cancelled;
+    int pass, passCount;
+    int block, stride; //of the current pass
+    std::vector<unsigned char> exact; //per pixel, cast at full resolution and sample rate
+    std::vector<int> order; //tiles of the current pass by falling priority
+    std::vector<unsigned char> tileDone;
+
+    int regionsX() const
+    {
+        return (image.width + regionSize - 1) / regionSize;
+    }
+
+    int regionsY() const
+    {
+        return (image.height + regionSize - 1) / regionSize;
+    }
+
+    void beginPass()
+    {
+        block = std::max(coarseBlock, 1) >> pass;
+        stride = std::max(1, std::min(coarseStride, RAY_PACKET_MAX_STEP) >> pass);
+        if (block <= 1)
+            stride = 1;
+        rayCaster.sampleStride = stride;
+        rayCaster.beginFrame(view, projection, image.width, image.height);
+
+        int count = regionsX() * regionsY();
+        std::vector<float> priority(count);
+        float maxVariance = 0.0f;
+        for(int t = 0; t < count; t++)
+        {
+            priority[t] = pass == 0 ? 0.0f : tileVariance(t);
+            maxVariance = std::max(maxVariance, priority[t]);
+        }
+
+        glm::vec2 centre(image.width * 0.5f, image.height * 0.5f);
+        float farthest = glm::length(centre);
+        for(int t = 0; t < count; t++)
+        {
+            glm::vec2 middle(((t % regionsX()) + 0.5f) * regionSize, ((t / regionsX()) + 0.5f) * regionSize);
+            float closeness = 1.0f - std::min(glm::length(middle - centre) / farthest, 1.0f);
+            float variance = maxVariance > 0.0f ? priority[t] / maxVariance : 0.0f;
+            priority[t] = centreWeight * closeness + (1.0f - centreWeight) * variance;
+        }
+
+        order.resize(count);
+        for(int t = 0; t < count; t++)
+            order[t] = t;
+        std::stable_sort(order.begin(), order.end(), [&priority](int a, int b) { return priority[a] > priority[b]; });
+        tileDone.assign(count, 0);
+    }
+
+    // Alpha variance over the samples the previous pass cast in tile t.
+    float tileVariance(int t) const
+    {
+        int previous = block * 2;
+        int x0 = (t % regionsX()) * regionSize, y0 = (t / regionsX()) * regionSize;
+        int x1 = std::min(x0 + regionSize, image.width), y1 = std::min(y0 + regionSize, image.height);
+        double sum = 0.0, squares = 0.0;
+        int n = 0;
+        for(int y = y0; y < y1; y += previous)
+        {
+            for(int x = x0; x < x1; x += previous)
+            {
+                float a = image.at(x, y).a;
+                sum += a;
+                squares += a * a;
+                n++;
+            }
+        }
+        return n > 0 ? (float)std::max(0.0, squares / n - (sum / n) * (sum / n)) : 0.0f;
+    }
+
+    // Casts the block corners of tile t that are not exact and fills their
+    // blocks. Packets cast every corner of a row, exact ones come out the same.
+    void refineTile(int t, RayCastStats& counts)
+    {
+        int x0 = (t % regionsX()) * regionSize, y0 = (t / regionsX()) * regionSize;
+        int x1 = std::min(x0 + regionSize, image.width), y1 = std::min(y0 + regionSize, image.height);
+        bool packets = rayCaster.packetsEnabled();
+        for(int y = y0; y < y1; y += block)
+        {
+            if (packets)
+            {
+                rayCaster.castPacketRow(x0, x1, y, image, counts, block);
+                counts.rays += (x1 - x0 + block - 1) / block;
+            }
+            for(int x = x0; x < x1; x += block)
+            {
+                size_t corner = (size_t)y * image.width + x;
+                if (!packets)
+                {
+                    if (exact[corner])
+                        continue;
+                    image.at(x, y) = rayCaster.castRay(x, y, counts);
+                    counts.rays++;
+                }
+                glm::vec4 color = image.at(x, y);
+                for(int by = y; by < std::min(y + block, y1); by++)
+                    for(int bx = x; bx < std::min(x + block, x1); bx++)
+                        if (!exact[(size_t)by * image.width + bx])
+                            image.at(bx, by) = color;
+                exact[corner] = stride == 1;
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,190 @@
+#ifndef PROXY_GEOMETRY_H
+#define PROXY_GEOMETRY_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+
+// Slice polygons computed per vertex, following Rezk-Salama and Kolb's
+// view-aligned slicing on the vertex processor. proxy.vs runs the same code
+// for every (slice, vertexIndex) pair out of a static index buffer, this class
+// keeps the tables the shader needs and a CPU copy of the intersection logic.
+class SliceProxy
+{
+public:
+    // Each polygon vertex walks up to four edges, P0/P2/P4 follow one of the three
+    // front to back paths and P1/P3/P5 first try a connecting edge.
+    static constexpr int v1[24] = {0,1,4,4, 1,0,1,4, 0,2,5,5, 2,0,2,5, 0,3,6,6, 3,0,3,6};
+    static constexpr int v2[24] = {1,4,7,7, 5,1,4,7, 2,5,7,7, 6,2,5,7, 3,6,7,7, 4,3,6,7};
+
+    // Triangle fan of the six polygon vertices as an indexed triangle list.
+    static constexpr unsigned int indices[12] = {0,1,2, 0,2,3, 0,3,4, 0,4,5};
+
+    static constexpr float LAMBDA_EPSILON = 1e-4f;
+
+    glm::vec3 vertices[8];
+    int nSequence[64]; //cube vertex of path vertex j when vertex i is in front: nSequence[i*8 + j]
+
+    // per view state
+    int frontIdx;
+    glm::vec3 vecView; //third row of the view matrix, dot(vecView, p) + viewOffset is view space z
+    float viewOffset;
+    float dPlaneStart;
+    float dPlaneIncr;
+    int sliceCount;
+
+    SliceProxy(const glm::vec3 cubeVertices[8])
+    {
+        for(int i = 0; i < 8; i++)
+            vertices[i] = cubeVertices[i];
+
+        for(int front = 0; front < 8; front++)
+        {
+            int* seq = &nSequence[front * 8];
+            int n = 0;
+            int neighbors[3];
+            for(int i = 0; i < 8; i++)
+                if (adjacent(front, i))
+                    neighbors[n++] = i;
+
+            seq[0] = front;
+            seq[1] = neighbors[0];
+            seq[2] = neighbors[1];
+            seq[3] = neighbors[2];
+            seq[4] = commonNeighbor(seq[1], seq[3], front);
+            seq[5] = commonNeighbor(seq[1], seq[2], front);
+            seq[6] = commonNeighbor(seq[2], seq[3], front);
+            seq[7] = commonNeighbor(seq[4], seq[5], seq[1]);
+        }
+
+        frontIdx = 0;
+        vecView = glm::vec3(0.0f, 0.0f, 1.0f);
+        viewOffset = 0.0f;
+        dPlaneStart = 0.0f;
+        dPlaneIncr = 0.0f;
+        sliceCount = 0;
+    }
+
+    // Same slice planes as calculatePlanes(): spacing apart, starting at the farthest vertex.
+    void update(glm::mat4 view, float spacing, bool frontToBack)
+    {
+        updateAxis(glm::vec3(view[0][2], view[1][2], view[2][2]), view[3][2], spacing, frontToBack);
+    }
+
+    // Slices perpendicular to an arbitrary unit axis, e.g. the half-angle vector.
+    // With frontToBack the first slice is the one farthest along the axis.
+    void updateAxis(glm::vec3 axis, float offset, float spacing, bool frontToBack)
+    {
+        vecView = axis;
+        viewOffset = offset;
+
+        int backIdx = 0;
+        frontIdx = 0;
+        for(int i = 0; i < 8; i++)
+        {
+            if (dot(vecView, vertices[i]) < dot(vecView, vertices[backIdx]))
+                backIdx = i;
+            if (dot(vecView, vertices[i]) > dot(vecView, vertices[frontIdx]))
+                frontIdx = i;
+        }
+
+        float minD = dot(vecView, vertices[backIdx]);
+        float maxD = dot(vecView, vertices[frontIdx]);
+        sliceCount = (int)ceil((maxD - minD) / spacing);
+        dPlaneStart = frontToBack ? minD + (sliceCount - 1) * spacing : minD;
+        dPlaneIncr = frontToBack ? -spacing : spacing;
+    }
+
+    float planeDistance(int slice) const
+    {
+        return dPlaneStart + slice * dPlaneIncr;
+    }
+
+    // View space z of a slice, as stored in sliceDepths.
+    float sliceDepth(int slice) const
+    {
+        return planeDistance(slice) + viewOffset;
+    }
+
+    // CPU mirror of proxy.vs, returns the world space position of one polygon vertex.
+    glm::vec3 sliceVertex(int slice, int vertexIndex) const
+    {
+        float dPlane = planeDistance(slice);
+        glm::vec3 position = vertices[frontIdx];
+        bool nearMiss = false;
+
+        for(int e = 0; e < 4; e++)
+        {
+            int vidx1 = nSequence[frontIdx * 8 + v1[vertexIndex * 4 + e]];
+            int vidx2 = nSequence[frontIdx * 8 + v2[vertexIndex * 4 + e]];
+            glm::vec3 vecV1 = vertices[vidx1];
+            glm::vec3 vecV2 = vertices[vidx2];
+            glm::vec3 vecDir = vecV2 - vecV1;
+            float denom = dot(vecDir, vecView);
+            float lambda = (denom != 0.0f) ? (dPlane - dot(vecV1, vecView)) / denom : -1.0f;
+            if (lambda >= 0.0f && lambda <= 1.0f)
+            {
+                position = vecV1 + lambda * vecDir;
+                break;
+            }
+            //The first plane passes exactly through the back vertex, tolerate rounding there.
+            //A near miss only counts if no later edge is cut: clamped onto a vertex whose next
+            //edge is almost parallel to the plane, it can lie far from the polygon.
+            if (!nearMiss && lambda >= -LAMBDA_EPSILON && lambda <= 1.0f + LAMBDA_EPSILON)
+            {
+                position = vecV1 + glm::clamp(lambda, 0.0f, 1.0f) * vecDir;
+                nearMiss = true;
+            }
+        }
+        return position;
+    }
+
+    void slicePolygon(int slice, std::vector<glm::vec3>& polygon) const
+    {
+        polygon.resize(6);
+        for(int i = 0; i < 6; i++)
+            polygon[i] = sliceVertex(slice, i);
+    }
+
+    // Largest distance from a CPU sliced polygon vertex (view space, as produced by
+    // calculatePlanes()) to the polygon generated here for the same slice.
+    float maxDeviation(int slice, const std::vector<glm::vec3>& viewSpacePolygon, glm::mat4 view) const
+    {
+        std::vector<glm::vec3> polygon;
+        slicePolygon(slice, polygon);
+        for(size_t j = 0; j < polygon.size(); j++)
+            polygon[j] = glm::vec3(view * glm::vec4(polygon[j], 1.0f));
+
+        return fmaxf(oneSidedDistance(viewSpacePolygon, polygon), oneSidedDistance(polygon, viewSpacePolygon));
+    }
+
+private:
+    static float oneSidedDistance(const std::vector<glm::vec3>& from, const std::vector<glm::vec3>& to)
+    {
+        float maxDist = 0.0f;
+        for(size_t i = 0; i < from.size(); i++)
+        {
+            float best = INFINITY;
+            for(size_t j = 0; j < to.size(); j++)
+                best = fminf(best, glm::length(from[i] - to[j]));
+            maxDist = fmaxf(maxDist, best);
+        }
+        return maxDist;
+    }
+
+    bool adjacent(int a, int b) const
+    {
+        glm::bvec3 same = glm::equal(vertices[a], vertices[b]);
+        return (int)same.x + (int)same.y + (int)same.z == 2;
+    }
+
+    int commonNeighbor(int a, int b, int exclude) const
+    {
+        for(int i = 0; i < 8; i++)
+            if (i != exclude && adjacent(a, i) && adjacent(b, i))
+                return i;
+        return exclude;
+    }
+};
+#endif
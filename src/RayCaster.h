@@ -0,0 +1,834 @@
+#ifndef RAY_CASTER_H
+#define RAY_CASTER_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <climits>
+#include <cstring>
+
+#include "Volume.h"
+#include "Image.h"
+#include "Compositor.h"
+#include "RayPacket.h"
+#include "TileScheduler.h"
+#include "MinMaxGrid.h"
+#include "TransferFunction.h"
+#include "PreIntegration.h"
+#include "GradientMagnitude.h"
+#include "AmbientOcclusion.h"
+#include "LabelVolume.h"
+#include "FusedVolume.h"
+
+struct RayCastStats
+{
+    unsigned long long rays = 0;
+    unsigned long long samples = 0;
+    unsigned long long skippedSamples = 0; //leapt over by empty-space skipping
+    double milliseconds = 0.0;
+
+    void add(const RayCastStats& other)
+    {
+        rays += other.rays;
+        samples += other.samples;
+        skippedSamples += other.skippedSamples;
+        milliseconds += other.milliseconds;
+    }
+};
+
+// Headless CPU ray caster. Rays sample exactly where the slice renderer's
+// view-aligned planes cut them (sliceSpacing apart in view space z, with the
+// same phase as calculatePlanes()) and composite front to back with the under
+// operator, so the result equals the blended slices of shader.fs without a GL
+// context. Samples are classified by transferFunction, the table shader.fs
+// reads as its lookup texture. Tiles are handed out by the work-stealing
+// TileScheduler, which subdivides the image down to tileSize squares where
+// the work is.
+// Tile rows are cast as packets of simdWidth(simd) rays by the kernels of
+// RayPacket.h, castRay() is the scalar path and reference.
+// With emptySpaceSkipping, rays leap over the nodes of a MinMaxGrid that are
+// transparent under the transfer function, classified again whenever it
+// changed. Only samples of exactly zero opacity are skipped, so the image
+// does not change.
+// Two further options trade exactness for samples: rays stop once their
+// opacity reaches opacityThreshold, and with adaptiveStep a sample in a brick
+// whose values vary little spans up to maxStep planes, opacity corrected.
+// The other ProjectionModes take the maximum, minimum or mean sample value
+// instead, in castProjection(); with projectionSkipping, maximum and minimum
+// rays leap over grid nodes that cannot beat the value found so far and stop
+// at the volume's extreme, the mean leaps over zero nodes. The isosurface
+// mode stops at the first plane past a crossing of isoValue, refines it with
+// ISO_REFINEMENT_STEPS of regula falsi and shades it with the gradient there;
+// its rays leap over nodes whose range does not contain the iso-value, so a
+// new iso-value needs nothing but the grid.
+// filter picks how composited and projected samples are reconstructed,
+// isosurfaces stay trilinear. Pre-integration, 2D classification, shading,
+// ambient occlusion, labels, fusion and the 64-voxel cubic reference need the
+// scalar path (see packetsEnabled()).
+class RayCaster
+{
+public:
+    const Volume& volume;
+    float sliceSpacing;
+    int tileSize;
+    unsigned int threadCount;
+    SimdIsa simd;
+    bool emptySpaceSkipping;
+    float opacityThreshold; //1 disables early ray termination
+    bool adaptiveStep;
+    int maxStep; //planes one sample may span, at most RAY_PACKET_MAX_STEP
+    float stepTolerance; //value range (of [0,1]) a brick may vary over per plane skipped
+    int sampleStride; //planes every sample spans at least, opacity corrected; 1 samples all of them
+    VolumeFilter filter; //the grid is built for the cubic B-spline's wider reach
+    TransferFunction transferFunction; //the grid is classified with its opacity
+    // Composited samples classify the segment to the next sample's plane, so
+    // coarse strides keep the thin features of the transfer function.
+    bool preIntegrated;
+    PreIntegrationTable preIntegration; //for sampleStride planes, updated by beginFrame()
+    const Volume* gradientMagnitude; //GradientMagnitude::magnitude of volume for transferFunction2D, nullptr classifies by value alone
+    TransferFunction2D transferFunction2D; //by value and trilinear magnitude
+    ShadingMode shading; //headlight on composited samples, see shade()
+    const GradientMagnitude* gradients; //with quantizeNormals, for SHADING_PRECOMPUTED
+    bool ambientOcclusion; //dims composited samples by the visibility in occlusion
+    AmbientOcclusion occlusion; //updated by beginFrame() for the opacity the grid is classified with
+    // Segmentation of volume, nullptr renders without one. Composited samples
+    // are multiplied by the table entry of their nearest label, and the grid
+    // also leaps over bricks of hidden labels only, redoing just the bricks of
+    // a label toggled since the last frame.
+    LabelVolume* labels;
+    // Second volume combined with every composited sample after all of the
+    // above, nullptr renders volume alone. Rays cover the box of both (see
+    // FusedVolume), the grid keeps the bricks where it may show something and
+    // steps stay fixed, the brick ranges know nothing of it.
+    FusedVolume* fusion;
+    ProjectionMode projectionMode;
+    bool projectionSkipping;
+    float isoValue; //in [0,1], for PROJECTION_ISOSURFACE
+    SchedulerStats scheduling; //of the last render()
+    MinMaxGrid grid;
+    double gridMilliseconds; //building and classifying the grid, in the last render()
+
+    RayCaster(const Volume& volume, float sliceSpacing = 0.005f) : volume(volume), occlusion(volume), grid(volume)
+    {
+        this->sliceSpacing = sliceSpacing;
+        tileSize = 16;
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        simd = detectSimd();
+        emptySpaceSkipping = true;
+        opacityThreshold = 1.0f;
+        adaptiveStep = false;
+        maxStep = 4;
+        stepTolerance = 0.05f;
+        sampleStride = 1;
+        filter = FILTER_TRILINEAR;
+        preIntegrated = false;
+        gradientMagnitude = nullptr;
+        shading = SHADING_NONE;
+        gradients = nullptr;
+        ambientOcclusion = false;
+        labels = nullptr;
+        hiddenLabels = nullptr;
+        fusion = nullptr;
+        occupiedFusion = nullptr;
+        projectionMode = PROJECTION_COMPOSITE;
+        projectionSkipping = true;
+        isoValue = 0.3f;
+        leaping = false;
+        gridMilliseconds = 0.0;
+    }
+
+    // depth, if given, receives a representative depth per pixel (see castRay()).
+    void render(glm::mat4 view, glm::mat4 projection, Image& image, RayCastStats* stats = nullptr, std::vector<float>* depth = nullptr)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        beginFrame(view, projection, image.width, image.height);
+        bool packets = packetsEnabled();
+        if (depth != nullptr)
+            depth->resize((size_t)image.width * image.height);
+
+        std::vector<RayCastStats> counts(threadCount);
+        TileScheduler scheduler(threadCount);
+        scheduler.run(image.width, image.height, tileSize, tileSize, [&](const WorkTile& tile, unsigned int worker)
+        {
+            //Counted locally, the per-worker slots share cache lines.
+            RayCastStats tileCounts;
+            for(int y = tile.y0; y < tile.y1; y++)
+            {
+                if (packets)
+                {
+                    castPacketRow(tile.x0, tile.x1, y, image, tileCounts, 1, depth);
+                    continue;
+                }
+                for(int x = tile.x0; x < tile.x1; x++)
+                    image.at(x, y) = castRay(x, y, tileCounts, depth != nullptr ? &(*depth)[(size_t)y * image.width + x] : nullptr);
+            }
+            counts[worker].add(tileCounts);
+        }, &scheduling);
+
+        if (stats != nullptr)
+        {
+            for(size_t t = 0; t < counts.size(); t++)
+                stats->add(counts[t]);
+            stats->rays += (unsigned long long)image.width * image.height;
+            stats->milliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+    // Sets up the camera, the padded volume and the grid for castRay() and
+    // castPacketRow(); render() starts with it, callers that pick their own
+    // pixels call it once per frame.
+    void beginFrame(glm::mat4 view, glm::mat4 projection, int width, int height)
+    {
+        setupFrame(view, projection, width, height);
+        if (packetsEnabled())
+            createPaddedVolume();
+        int radius = filter == FILTER_TRILINEAR ? 1 : 2;
+        if (grid.filterRadius != radius)
+        {
+            grid.filterRadius = radius;
+            grid.levels.clear();
+        }
+        packetFrame.cubic = filter == FILTER_CUBIC;
+        gridMilliseconds = 0.0;
+        packetFrame.bricks.steps = nullptr;
+        packetFrame.maxStep = 1;
+        leaping = false;
+        if (emptySpaceSkipping || adaptiveStep)
+            updateGrid();
+        if (projectionMode != PROJECTION_COMPOSITE && projectionSkipping && grid.levels.empty())
+        {
+            auto start = std::chrono::high_resolution_clock::now();
+            grid.build(threadCount);
+            classifiedOpacity.clear();
+            hiddenLabels = nullptr;
+            occupiedFusion = nullptr;
+            gridMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+        frame.sampleStride = std::min(std::max(sampleStride, 1), RAY_PACKET_MAX_STEP);
+        packetFrame.sampleStride = frame.sampleStride;
+        packetFrame.maxStep = std::max(packetFrame.maxStep, frame.sampleStride);
+        if (preIntegrated && gradientMagnitude == nullptr && projectionMode == PROJECTION_COMPOSITE)
+        {
+            preIntegration.threadCount = threadCount;
+            preIntegration.update(transferFunction, (float)frame.sampleStride);
+        }
+        if (ambientOcclusion && projectionMode == PROJECTION_COMPOSITE)
+        {
+            occlusion.threadCount = threadCount;
+            occlusion.update(gradientMagnitude != nullptr ? transferFunction2D.opacity() : transferFunction.opacity());
+        }
+    }
+
+    // The kernels composite, the other projections are cast by castRay().
+    bool packetsEnabled() const
+    {
+        return simd != SIMD_SCALAR && simdAvailable(simd) && projectionMode == PROJECTION_COMPOSITE && !preIntegrated && gradientMagnitude == nullptr
+               && shading == SHADING_NONE && !ambientOcclusion && filter != FILTER_CUBIC_REFERENCE
+               && labels == nullptr && fusion == nullptr;
+    }
+
+    // Premultiplied RGBA of one pixel, the frame must have been set up by beginFrame().
+    // depth receives the view distance s the samples lie at on average, weighted
+    // by what they add to the alpha; the middle of the sampled range if nothing
+    // is visible and -1 if the ray misses the data.
+    glm::vec4 castRay(int px, int py, RayCastStats& counts, float* depth = nullptr) const
+    {
+        if (projectionMode == PROJECTION_ISOSURFACE)
+            return castIsosurface(px, py, counts, depth);
+        if (projectionMode != PROJECTION_COMPOSITE)
+            return castProjection(px, py, counts, depth);
+
+        glm::vec3 worldDir;
+        int kFirst, kLast;
+        if (depth != nullptr)
+            *depth = -1.0f;
+        if (!sliceRange(px, py, worldDir, kFirst, kLast))
+            return glm::vec4(0.0f);
+
+        glm::vec4 dst(0.0f);
+        float weightedDepth = 0.0f;
+        unsigned long long taken = 0;
+        int kRecheck = kFirst;
+        int steps = 1;
+        int kNext = kFirst + 1; //plane nextValue was sampled at, for pre-integration
+        float nextValue = 0.0f;
+        for(int k = kFirst; k >= kLast && dst.a < opacityThreshold; k -= steps)
+        {
+            if (leaping && k <= kRecheck)
+            {
+                k = leap(k, kLast, worldDir, kRecheck, [](const MinMaxGrid::Level& level, size_t i) { return level.empty[i] != 0; });
+                if (k < kLast)
+                    break;
+            }
+            float s = -(frame.minZ + k * sliceSpacing);
+            glm::vec3 position = frame.eye + s * worldDir;
+            glm::vec3 texCoord = worldToTexCoord(position);
+            float value = k == kNext ? nextValue : volume.sample(texCoord, filter);
+            //The last sample only spans the planes left.
+            steps = std::min(frame.sampleStride, k - kLast + 1);
+            if (adaptiveStep && fusion == nullptr)
+                steps = std::max(steps, std::min(brickStepsAt(position * frame.voxelScale - 0.5f, worldDir * frame.voxelScale, k), k - kLast + 1));
+            glm::vec4 src;
+            if (gradientMagnitude != nullptr)
+            {
+                src = transferFunction2D.lookup(value, gradientMagnitude->sample(texCoord));
+                if (steps > 1)
+                    src = correctOpacity(src, (float)steps);
+            }
+            else if (preIntegrated)
+            {
+                //The segment ends where the next sample starts, the table holds sampleStride planes.
+                kNext = k - steps;
+                nextValue = volume.sample(worldToTexCoord(frame.eye - (frame.minZ + kNext * sliceSpacing) * worldDir), filter);
+                src = preIntegration.lookup(value, nextValue);
+                if (steps != frame.sampleStride)
+                    src = correctOpacity(src, (float)steps / frame.sampleStride);
+            }
+            else
+            {
+                src = transferFunction.lookup(value);
+                if (steps > 1)
+                    src = correctOpacity(src, (float)steps);
+            }
+            if (labels != nullptr && src.a > 0.0f)
+                src *= labels->lookup(texCoord);
+            if (shading != SHADING_NONE && src.a > 0.0f)
+                src = shade(src, texCoord, worldDir);
+            if (ambientOcclusion && src.a > 0.0f)
+                src = glm::vec4(glm::vec3(src) * occlusion.sample(texCoord), src.a);
+            if (fusion != nullptr)
+                src = fuseSamples(fusion->op, src, fusion->classify(position, steps), fusion->weight);
+            weightedDepth += (1.0f - dst.a) * src.a * s;
+            blendUnder(dst, src);
+            taken++;
+        }
+        counts.samples += taken;
+        counts.skippedSamples += (unsigned long long)(kFirst - kLast + 1) - taken;
+        if (depth != nullptr)
+            *depth = representativeDepth(weightedDepth, dst.a, kFirst, kLast);
+        return dst;
+    }
+
+    // Whether the ray through the pixel crosses any slice plane inside the data.
+    bool hitsData(int px, int py) const
+    {
+        glm::vec3 worldDir;
+        int kFirst, kLast;
+        return sliceRange(px, py, worldDir, kFirst, kLast);
+    }
+
+    // World space box the frame set up by beginFrame() casts over: the volume's
+    // plus its filtered border, with a fusion the box of both.
+    void frameBox(glm::vec3& boxMin, glm::vec3& boxMax) const
+    {
+        boxMin = frame.boxMin;
+        boxMax = frame.boxMax;
+    }
+
+    // Pixels y * width + x from a list, in packets where enabled.
+    void castPixels(const int* pixels, int count, Image& image, RayCastStats& counts, std::vector<float>* depth = nullptr) const
+    {
+        if (!packetsEnabled())
+        {
+            for(int i = 0; i < count; i++)
+            {
+                int x = pixels[i] % image.width, y = pixels[i] / image.width;
+                image.at(x, y) = castRay(x, y, counts, depth != nullptr ? &(*depth)[pixels[i]] : nullptr);
+            }
+            return;
+        }
+        const int lanes = simdWidth(simd);
+        int xs[RAY_PACKET_MAX_LANES], ys[RAY_PACKET_MAX_LANES];
+        for(int i = 0; i < count; i += lanes)
+        {
+            int n = std::min(lanes, count - i);
+            for(int j = 0; j < n; j++)
+            {
+                xs[j] = pixels[i + j] % image.width;
+                ys[j] = pixels[i + j] / image.width;
+            }
+            castLanes(xs, ys, n, image, counts, depth);
+        }
+    }
+
+    // Pixels x0, x0 + xStep, ... below x1 of row y in packets, lanes past x1 stay idle.
+    // Skipping, termination and step sizes are handled in the kernel (see castPacketKernel()).
+    void castPacketRow(int x0, int x1, int y, Image& image, RayCastStats& counts, int xStep = 1, std::vector<float>* depth = nullptr) const
+    {
+        const int lanes = simdWidth(simd);
+        int xs[RAY_PACKET_MAX_LANES], ys[RAY_PACKET_MAX_LANES];
+        for(int x = x0; x < x1; x += lanes * xStep)
+        {
+            int n = 0;
+            for(; n < lanes && x + n * xStep < x1; n++)
+            {
+                xs[n] = x + n * xStep;
+                ys[n] = y;
+            }
+            castLanes(xs, ys, n, image, counts, depth);
+        }
+    }
+
+private:
+    std::vector<unsigned char> paddedData;
+    PacketFrame packetFrame;
+    std::vector<float> classifiedOpacity; //table the grid was last classified with
+    const LabelVolume* hiddenLabels; //whose hidden bricks the grid holds
+    const FusedVolume* occupiedFusion; //whose occupied bricks the grid holds
+    std::vector<unsigned char> brickSteps; //PacketBricks::steps
+    bool leaping; //skipping is on and the grid has empty bricks
+
+    struct FrameSetup
+    {
+        glm::mat4 invView, invProjection;
+        glm::vec3 eye; //camera position in world space
+        glm::vec3 boxMin, boxMax; //world space region where samples can be non-zero
+        glm::vec3 voxelScale; //world position to voxel coordinates: p * voxelScale - 0.5
+        float minZ; //view space z of the farthest proxy cube vertex, the first slice plane
+        int sliceCount;
+        int sampleStride;
+        float nearDepth, farDepth;
+        int width, height;
+    } frame;
+
+    void setupFrame(glm::mat4 view, glm::mat4 projection, int width, int height)
+    {
+        frame.invView = glm::inverse(view);
+        frame.invProjection = glm::inverse(projection);
+        frame.eye = glm::vec3(frame.invView[3]);
+        frame.width = width;
+        frame.height = height;
+
+        glm::vec4 nearPoint = frame.invProjection * glm::vec4(0.0f, 0.0f, -1.0f, 1.0f);
+        glm::vec4 farPoint = frame.invProjection * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        frame.nearDepth = -nearPoint.z / nearPoint.w;
+        frame.farDepth = -farPoint.z / farPoint.w;
+
+        //Texture coordinates in [0,1] plus one voxel of linear filtering into the border.
+        glm::vec3 border(1.0f / volume.width, 1.0f / volume.height, 1.0f / volume.depth);
+        frame.boxMin = (-border) * 0.5f;
+        frame.boxMax = (1.0f + border) * 0.5f;
+        frame.voxelScale = 2.0f * glm::vec3(volume.width, volume.height, volume.depth);
+
+        //Slice planes span the proxy cube exactly like calculatePlanes(), fused volumes
+        //the box of both, which is where their samples can be non-zero as well.
+        glm::vec3 proxyMin(-0.5f), proxyMax(0.5f);
+        if (fusion != nullptr && projectionMode == PROJECTION_COMPOSITE)
+        {
+            fusion->proxyBounds(glm::ivec3(volume.width, volume.height, volume.depth), proxyMin, proxyMax);
+            frame.boxMin = proxyMin;
+            frame.boxMax = proxyMax;
+        }
+        float minZ = INFINITY, maxZ = -INFINITY;
+        for(int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 2) ? proxyMax.x : proxyMin.x, (i & 1) ? proxyMax.y : proxyMin.y, (i & 4) ? proxyMax.z : proxyMin.z);
+            float z = (view * glm::vec4(corner, 1.0f)).z;
+            minZ = std::min(minZ, z);
+            maxZ = std::max(maxZ, z);
+        }
+        frame.minZ = minZ;
+        frame.sliceCount = (int)ceil((maxZ - minZ) / sliceSpacing);
+
+        packetFrame.eye[0] = frame.eye.x;
+        packetFrame.eye[1] = frame.eye.y;
+        packetFrame.eye[2] = frame.eye.z;
+        packetFrame.minZ = frame.minZ;
+        packetFrame.sliceSpacing = sliceSpacing;
+        packetFrame.opacityThreshold = opacityThreshold;
+        packetFrame.transfer = &transferFunction.table[0][0];
+    }
+
+    // World direction of the ray through a pixel and the slice planes it samples,
+    // false if it misses the data or no plane lies between its entry and exit.
+    bool sliceRange(int px, int py, glm::vec3& worldDir, int& kFirst, int& kLast) const
+    {
+        glm::vec3 rayDir = viewRayThroughPixel(px, py, frame.width, frame.height, frame.invProjection);
+        //World position at view depth s (= -z) is eye + s * worldDir.
+        worldDir = glm::mat3(frame.invView) * rayDir;
+
+        float sEnter, sExit;
+        if (!intersectBox(frame.eye, worldDir, sEnter, sExit))
+            return false;
+        sEnter = std::max(sEnter, frame.nearDepth);
+        sExit = std::min(sExit, frame.farDepth);
+
+        //Slice k lies at z = minZ + k * sliceSpacing, walk from the nearest one inside the box.
+        kFirst = std::min((int)floorf((-sEnter - frame.minZ) / sliceSpacing), frame.sliceCount - 1);
+        kLast = std::max((int)ceilf((-sExit - frame.minZ) / sliceSpacing), 0);
+        return kFirst >= kLast;
+    }
+
+    // First slice index from k down to kLast whose sample may matter, below
+    // kLast if there is none. Nodes passing skippable (see
+    // MinMaxGrid::coarsestNode(), for compositing the empty ones) are left
+    // through their exit face in one step; for any other brick, kRecheck
+    // receives the index where the ray leaves it and the grid has to be asked
+    // again.
+    template<class Test>
+    int leap(int k, int kLast, glm::vec3 worldDir, int& kRecheck, Test skippable) const
+    {
+        glm::vec3 origin = frame.eye * frame.voxelScale - 0.5f;
+        glm::vec3 dir = worldDir * frame.voxelScale;
+        glm::vec3 invDir = 1.0f / dir;
+        while (k >= kLast)
+        {
+            float s = -(frame.minZ + k * sliceSpacing);
+            glm::vec3 nodeMin, nodeMax;
+            bool empty = grid.coarsestNode(origin + s * dir, skippable, nodeMin, nodeMax);
+
+            float sExit = INFINITY;
+            for(int a = 0; a < 3; a++)
+            {
+                if (dir[a] > 0.0f)
+                    sExit = std::min(sExit, (nodeMax[a] - origin[a]) * invDir[a]);
+                else if (dir[a] < 0.0f)
+                    sExit = std::min(sExit, (nodeMin[a] - origin[a]) * invDir[a]);
+            }
+            //First slice at or beyond the exit, s grows as k goes down.
+            float kExit = floorf((-sExit - frame.minZ) / sliceSpacing);
+            int next = kExit < (float)kLast ? kLast - 1 : (int)std::min(kExit, (float)(k - 1));
+
+            if (!empty)
+            {
+                kRecheck = next;
+                return k;
+            }
+            k = next;
+        }
+        return k;
+    }
+
+    // Maximum, minimum or mean of the samples on the ray's slice planes as
+    // opaque gray, or transparent black if it misses the data. depth receives
+    // the s of the extreme sample (the middle of the range for the mean or if
+    // no sample beat the start value).
+    glm::vec4 castProjection(int px, int py, RayCastStats& counts, float* depth) const
+    {
+        glm::vec3 worldDir;
+        int kFirst, kLast;
+        if (depth != nullptr)
+            *depth = -1.0f;
+        if (!sliceRange(px, py, worldDir, kFirst, kLast))
+            return glm::vec4(0.0f);
+
+        //Samples lie in [0,1], so starting there changes no result and lets the first nodes be skipped.
+        const bool maximum = projectionMode == PROJECTION_MAXIMUM, minimum = projectionMode == PROJECTION_MINIMUM;
+        float extreme = minimum ? 1.0f : 0.0f;
+        float extremeDepth = -(frame.minZ + 0.5f * (kFirst + kLast) * sliceSpacing);
+        double sum = 0.0;
+        const bool skipping = projectionSkipping && !grid.levels.empty();
+        //The value no sample can go beyond.
+        float bound = minimum ? 0.0f : 1.0f;
+        if (skipping)
+            bound = (minimum ? grid.levels.back().minValue[0] : grid.levels.back().maxValue[0]) / 255.0f;
+
+        unsigned long long taken = 0;
+        int kRecheck = kFirst;
+        int steps = 1;
+        for(int k = kFirst; k >= kLast; k -= steps)
+        {
+            if (skipping && k <= kRecheck)
+            {
+                //Nodes whose range lies within what the ray has already seen; for the mean, the zero ones.
+                int ceiling = maximum ? (int)floorf(extreme * 255.0f + 1e-3f) : 0;
+                int floorValue = (int)ceilf(extreme * 255.0f - 1e-3f);
+                if (minimum)
+                    k = leap(k, kLast, worldDir, kRecheck, [floorValue](const MinMaxGrid::Level& level, size_t i) { return level.minValue[i] >= floorValue; });
+                else
+                    k = leap(k, kLast, worldDir, kRecheck, [ceiling](const MinMaxGrid::Level& level, size_t i) { return level.maxValue[i] <= ceiling; });
+                if (k < kLast)
+                    break;
+            }
+            float s = -(frame.minZ + k * sliceSpacing);
+            float value = volume.sample(worldToTexCoord(frame.eye + s * worldDir), filter);
+            steps = std::min(frame.sampleStride, k - kLast + 1);
+            taken++;
+            if (maximum ? value > extreme : minimum ? value < extreme : false)
+            {
+                extreme = value;
+                extremeDepth = s;
+                //Nothing further along can beat the volume's extreme.
+                if (skipping && (maximum ? extreme >= bound : extreme <= bound))
+                    break;
+            }
+            sum += (double)value * steps;
+        }
+        counts.samples += taken;
+        counts.skippedSamples += (unsigned long long)(kFirst - kLast + 1) - taken;
+
+        if (!maximum && !minimum)
+            extreme = (float)(sum / (kFirst - kLast + 1));
+        if (depth != nullptr)
+            *depth = extremeDepth;
+        return glm::vec4(extreme, extreme, extreme, 1.0f);
+    }
+
+    // Shaded first crossing of isoValue in either direction, depth receives its
+    // s; transparent black with depth -1 if the ray misses the data, with the
+    // middle of the range if it crosses nothing. A crossing is found between
+    // two consecutive samples (the one before the first plane lies outside
+    // the data or, like shader.fs, one plane nearer), even with a leap
+    // between them, since a skipped node cannot hold the crossing point.
+    glm::vec4 castIsosurface(int px, int py, RayCastStats& counts, float* depth) const
+    {
+        const int ISO_REFINEMENT_STEPS = 4;
+        glm::vec3 worldDir;
+        int kFirst, kLast;
+        if (depth != nullptr)
+            *depth = -1.0f;
+        if (!sliceRange(px, py, worldDir, kFirst, kLast))
+            return glm::vec4(0.0f);
+
+        auto valueAt = [&](float s) { return volume.sample(worldToTexCoord(frame.eye + s * worldDir)) - isoValue; };
+        const bool skipping = projectionSkipping && !grid.levels.empty();
+        const float iso = isoValue * 255.0f;
+        auto noCrossing = [iso](const MinMaxGrid::Level& level, size_t i) { return level.maxValue[i] < iso || level.minValue[i] > iso; };
+
+        float sPrevious = -(frame.minZ + (kFirst + 1) * sliceSpacing);
+        float fPrevious = valueAt(sPrevious);
+        unsigned long long taken = 1, planes = 0;
+        int kRecheck = kFirst;
+        int steps = 1;
+        glm::vec4 color(0.0f);
+        float hitDepth = -(frame.minZ + 0.5f * (kFirst + kLast) * sliceSpacing);
+        for(int k = kFirst; k >= kLast; k -= steps)
+        {
+            if (skipping && k <= kRecheck)
+            {
+                k = leap(k, kLast, worldDir, kRecheck, noCrossing);
+                if (k < kLast)
+                    break;
+            }
+            float s = -(frame.minZ + k * sliceSpacing);
+            float f = valueAt(s);
+            steps = std::min(frame.sampleStride, k - kLast + 1);
+            taken++;
+            planes++;
+            if ((fPrevious < 0.0f) != (f < 0.0f))
+            {
+                //Regula falsi keeps the crossing bracketed between s0 and s1.
+                float s0 = sPrevious, f0 = fPrevious, s1 = s, f1 = f;
+                for(int i = 0; i < ISO_REFINEMENT_STEPS && f1 != f0; i++)
+                {
+                    float sMid = s0 + (s1 - s0) * f0 / (f0 - f1);
+                    float fMid = valueAt(sMid);
+                    if ((fMid < 0.0f) == (f0 < 0.0f))
+                    {
+                        s0 = sMid;
+                        f0 = fMid;
+                    }
+                    else
+                    {
+                        s1 = sMid;
+                        f1 = fMid;
+                    }
+                }
+                hitDepth = f1 != f0 ? s0 + (s1 - s0) * f0 / (f0 - f1) : s1;
+                color = shadeIsosurface(volume.gradient(worldToTexCoord(frame.eye + hitDepth * worldDir)), worldDir);
+                taken += ISO_REFINEMENT_STEPS;
+                break;
+            }
+            sPrevious = s;
+            fPrevious = f;
+        }
+        counts.samples += taken;
+        counts.skippedSamples += (unsigned long long)(kFirst - kLast + 1) - planes;
+
+        if (depth != nullptr)
+            *depth = hitDepth;
+        return color;
+    }
+
+    // Planes a sample at voxel position u on slice k may span: its brick's step,
+    // cut where the ray leaves the brick so the span sees no other data.
+    int brickStepsAt(glm::vec3 u, glm::vec3 dir, int k) const
+    {
+        size_t brick = grid.brickIndex(u);
+        int steps = std::max((int)brickSteps[brick], 1);
+        if (steps == 1)
+            return 1;
+
+        float size = (float)grid.brickSize;
+        float sExit = INFINITY;
+        glm::vec3 origin = frame.eye * frame.voxelScale - 0.5f;
+        for(int a = 0; a < 3; a++)
+        {
+            float lower = floorf(u[a] / size) * size;
+            if (dir[a] > 0.0f)
+                sExit = std::min(sExit, (lower + size - origin[a]) / dir[a]);
+            else if (dir[a] < 0.0f)
+                sExit = std::min(sExit, (lower - origin[a]) / dir[a]);
+        }
+        float kExit = floorf((-sExit - frame.minZ) / sliceSpacing);
+        return std::max(1, (int)std::min((float)steps, k - kExit));
+    }
+
+    // Lights a composited sample at texCoord, see ShadingMode.
+    glm::vec4 shade(glm::vec4 src, glm::vec3 texCoord, glm::vec3 worldDir) const
+    {
+        glm::vec3 size(volume.width, volume.height, volume.depth);
+        if (shading == SHADING_PRECOMPUTED && gradients != nullptr && !gradients->normalU.empty())
+        {
+            size_t voxel = gradients->nearestVoxel(texCoord);
+            //A voxel space normal scaled by the size points along the texture (and world) space gradient.
+            glm::vec3 normal = GradientMagnitude::normalTable()[gradients->normalIndex(voxel)] * size;
+            return shadeSample(src, normal, worldDir, shadingStrength(gradients->magnitude.data[voxel]));
+        }
+        //Volume::gradient() is per unit of texture coordinate, the magnitude per two voxels in 0-255.
+        glm::vec3 gradient = volume.gradient(texCoord);
+        return shadeSample(src, gradient, worldDir, shadingStrength(glm::length(gradient * 2.0f / size) * 255.0f));
+    }
+
+    void updateGrid()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (grid.levels.empty())
+        {
+            grid.build(threadCount);
+            classifiedOpacity.clear();
+            hiddenLabels = nullptr;
+            occupiedFusion = nullptr;
+        }
+        std::vector<float> opacity = gradientMagnitude != nullptr ? transferFunction2D.opacity() : transferFunction.opacity();
+        if (classifiedOpacity != opacity)
+        {
+            grid.classify(opacity, threadCount);
+            classifiedOpacity = opacity;
+        }
+        if (labels != nullptr && labels->brickSize != grid.brickSize)
+        {
+            labels->threadCount = threadCount;
+            labels->buildBricks(grid.brickSize);
+            hiddenLabels = nullptr;
+        }
+        if (labels != hiddenLabels)
+        {
+            grid.hide(labels != nullptr ? labels->brickHidden : std::vector<unsigned char>());
+            hiddenLabels = labels;
+            if (labels != nullptr)
+                labels->changedBricks.clear();
+        }
+        else if (labels != nullptr && !labels->changedBricks.empty())
+        {
+            grid.updateHidden(labels->changedBricks, labels->brickHidden);
+            labels->changedBricks.clear();
+        }
+        if (fusion != nullptr)
+        {
+            fusion->threadCount = threadCount;
+            if (fusion->updateOccupancy(grid, frame.boxMin, frame.boxMax) || fusion != occupiedFusion)
+                grid.occupy(fusion->brickOccupied);
+            occupiedFusion = fusion;
+        }
+        else if (occupiedFusion != nullptr)
+        {
+            grid.occupy(std::vector<unsigned char>());
+            occupiedFusion = nullptr;
+        }
+
+        const MinMaxGrid::Level& base = grid.levels[0];
+        int stepLimit = adaptiveStep && fusion == nullptr ? std::min(std::max(maxStep, 1), RAY_PACKET_MAX_STEP) : 1;
+        brickSteps.resize(base.empty.size() + 4, 0);
+        for(size_t i = 0; i < base.empty.size(); i++)
+        {
+            int range = std::max(base.maxValue[i] - base.minValue[i], 1);
+            int steps = std::min(std::max((int)(stepTolerance * 255.0f / range), 1), stepLimit);
+            brickSteps[i] = emptySpaceSkipping && base.empty[i] ? 0 : (unsigned char)steps;
+        }
+        PacketBricks& bricks = packetFrame.bricks;
+        bricks.width = base.width;
+        bricks.height = base.height;
+        bricks.depth = base.depth;
+        bricks.invBrickSize = 1.0f / grid.brickSize;
+
+        //Nothing to leap over and fixed steps, the lookups would only cost time.
+        leaping = emptySpaceSkipping && grid.emptyFraction() > 0.0f;
+        bricks.steps = leaping || stepLimit > 1 ? brickSteps.data() : nullptr;
+        packetFrame.maxStep = stepLimit;
+        gridMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // One packet over count pixels, the remaining lanes stay idle.
+    void castLanes(const int* xs, const int* ys, int count, Image& image, RayCastStats& counts, std::vector<float>* depth) const
+    {
+        const int lanes = simdWidth(simd);
+        PacketRays rays;
+        unsigned long long rangeSamples = 0;
+        for(int i = 0; i < lanes; i++)
+        {
+            glm::vec3 worldDir(0.0f);
+            int kFirst, kLast;
+            if (i >= count || !sliceRange(xs[i], ys[i], worldDir, kFirst, kLast))
+            {
+                kFirst = -1;
+                kLast = INT_MAX;
+            }
+            else
+                rangeSamples += kFirst - kLast + 1;
+            rays.dirX[i] = worldDir.x;
+            rays.dirY[i] = worldDir.y;
+            rays.dirZ[i] = worldDir.z;
+            rays.kFirst[i] = kFirst;
+            rays.kLast[i] = kLast;
+        }
+        rays.samples = 0;
+        castPacket(simd, packetFrame, rays);
+        for(int i = 0; i < count; i++)
+        {
+            image.at(xs[i], ys[i]) = glm::vec4(rays.r[i], rays.g[i], rays.b[i], rays.a[i]);
+            if (depth != nullptr)
+                (*depth)[(size_t)ys[i] * image.width + xs[i]] = rays.kFirst[i] < rays.kLast[i] ? -1.0f : representativeDepth(rays.depth[i], rays.a[i], rays.kFirst[i], rays.kLast[i]);
+        }
+        counts.samples += rays.samples;
+        counts.skippedSamples += rangeSamples - rays.samples;
+    }
+
+    float representativeDepth(float weightedDepth, float alpha, int kFirst, int kLast) const
+    {
+        if (alpha > 0.0f)
+            return weightedDepth / alpha;
+        return -(frame.minZ + 0.5f * (kFirst + kLast) * sliceSpacing);
+    }
+
+    // Zero border of RAY_PACKET_PAD voxels, plays the role of GL_CLAMP_TO_BORDER
+    // for the packet kernels. Built once per volume size.
+    void createPaddedVolume()
+    {
+        const int P = RAY_PACKET_PAD;
+        const int W = volume.width + 2 * P, H = volume.height + 2 * P, D = volume.depth + 2 * P;
+        PacketVolume& pv = packetFrame.volume;
+        if (!paddedData.empty() && pv.width == volume.width && pv.height == volume.height && pv.depth == volume.depth)
+            return;
+
+        //4 slack bytes for the 32-bit gathers of the last voxel.
+        paddedData.assign((size_t)W * H * D + 4, 0);
+        for(int z = 0; z < volume.depth; z++)
+            for(int y = 0; y < volume.height; y++)
+                memcpy(&paddedData[((size_t)(z + P) * H + y + P) * W + P], &volume.data[((size_t)z * volume.height + y) * volume.width], volume.width);
+
+        pv.data = paddedData.data();
+        pv.width = volume.width;
+        pv.height = volume.height;
+        pv.depth = volume.depth;
+        pv.strideY = W;
+        pv.strideZ = W * H;
+    }
+
+    bool intersectBox(glm::vec3 origin, glm::vec3 dir, float& tEnter, float& tExit) const
+    {
+        glm::vec3 invDir = 1.0f / dir;
+        glm::vec3 t0 = (frame.boxMin - origin) * invDir;
+        glm::vec3 t1 = (frame.boxMax - origin) * invDir;
+        glm::vec3 tMin = glm::min(t0, t1);
+        glm::vec3 tMax = glm::max(t0, t1);
+        tEnter = std::max(std::max(tMin.x, tMin.y), tMin.z);
+        tExit = std::min(std::min(tMax.x, tMax.y), tMax.z);
+        return tExit >= std::max(tEnter, 0.0f);
+    }
+};
+#endif
@@ -0,0 +1,230 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+// Interface of the SIMD ray packet kernels. The kernels are compiled once per
+// instruction set from RayPacketKernel.h, each in its own translation unit with
+// its own compiler flags (see CMakeLists.txt), and picked at runtime. This
+// header is shared by all of them, so the part they see only holds plain data:
+// inline code compiled with a wider ISA could be picked by the linker for
+// every caller.
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#define RAY_PACKET_MAX_LANES 16
+#define RAY_PACKET_PAD 3 //zero voxels around the padded volume on every side, room for the B-spline of samples just outside
+#define RAY_PACKET_MAX_STEP 8 //planes one adaptive sample may span
+
+enum SimdIsa
+{
+    SIMD_SCALAR = 0,
+    SIMD_SSE42,
+    SIMD_AVX2,
+    SIMD_AVX512
+};
+
+// Volume copy with RAY_PACKET_PAD border voxels of 0 on each side and 4 slack
+// bytes at the end, so the trilinear and cubic gathers need no bounds checks.
+struct PacketVolume
+{
+    const unsigned char* data;
+    int width, height, depth; //unpadded size
+    int strideY, strideZ; //padded row and slice pitch
+};
+
+// Level 0 of the MinMaxGrid as one byte per brick, with 4 slack bytes like the
+// volume: 0 where the brick is transparent, otherwise how many slice planes
+// one sample inside it may span.
+struct PacketBricks
+{
+    const unsigned char* steps; //nullptr: no skipping, one plane per sample
+    int width, height, depth; //in bricks
+    float invBrickSize;
+};
+
+struct PacketFrame
+{
+    PacketVolume volume;
+    PacketBricks bricks;
+    float eye[3]; //world space camera position
+    float minZ; //view space z of slice 0
+    float sliceSpacing;
+    float opacityThreshold; //rays stop once their alpha reaches it
+    const float* transfer; //TransferFunction::table, 256 premultiplied RGBA entries
+    int maxStep; //most planes a sample spans, from bricks.steps or sampleStride
+    int sampleStride; //fewest planes a sample spans, 1 samples every plane
+    bool cubic; //B-spline samples from 8 trilinear ones like Volume::sampleCubic()
+};
+
+// One packet of coherent rays in SoA layout. Every ray samples the slice planes
+// kFirst down to kLast, at world position eye + s * dir with s = -(minZ + k * sliceSpacing).
+// Lanes with kFirst < kLast are idle.
+struct PacketRays
+{
+    float dirX[RAY_PACKET_MAX_LANES];
+    float dirY[RAY_PACKET_MAX_LANES];
+    float dirZ[RAY_PACKET_MAX_LANES];
+    int kFirst[RAY_PACKET_MAX_LANES];
+    int kLast[RAY_PACKET_MAX_LANES];
+
+    // premultiplied result
+    float r[RAY_PACKET_MAX_LANES];
+    float g[RAY_PACKET_MAX_LANES];
+    float b[RAY_PACKET_MAX_LANES];
+    float a[RAY_PACKET_MAX_LANES];
+    float depth[RAY_PACKET_MAX_LANES]; //sum of s weighted by each sample's share of a
+    unsigned long long samples;
+};
+
+// One row of count voxels for the gradient magnitude kernels. The six
+// neighbour pointers already point at the neighbours of the row's first voxel;
+// out receives min(|d|, 255) rounded, with d the central differences
+// v(+1) - v(-1), i.e. twice the gradient in values per voxel.
+// normalU and normalV, unless null, receive the octahedral coordinates of d:
+// with l = |dx| + |dy| + |dz| and (x, y) = (dx, dy) if dz >= 0, else
+// (s(dx) (l - |dy|), s(dy) (l - |dx|)) where s is the sign (+1 at 0),
+// u = floor(((x + l) * 255 + l) / max(2 l, 1)) and likewise v. All terms are
+// integers well inside float precision, so every kernel gets the same bytes.
+struct GradientRow
+{
+    const unsigned char* xm;
+    const unsigned char* xp;
+    const unsigned char* ym;
+    const unsigned char* yp;
+    const unsigned char* zm;
+    const unsigned char* zp;
+    unsigned char* out;
+    int count;
+    unsigned char* normalU;
+    unsigned char* normalV;
+};
+
+// Each returns false when its translation unit was built without that ISA.
+bool castPacketSSE42(const PacketFrame& frame, PacketRays& rays);
+bool castPacketAVX2(const PacketFrame& frame, PacketRays& rays);
+bool castPacketAVX512(const PacketFrame& frame, PacketRays& rays);
+bool gradientRowSSE42(const GradientRow& row);
+bool gradientRowAVX2(const GradientRow& row);
+bool gradientRowAVX512(const GradientRow& row);
+extern const bool SSE42_PACKET_KERNEL;
+extern const bool AVX2_PACKET_KERNEL;
+extern const bool AVX512_PACKET_KERNEL;
+
+// The kernel translation units define RAY_PACKET_KERNEL and only see the plain
+// declarations above, the inline dispatch helpers stay in baseline ISA code.
+#ifndef RAY_PACKET_KERNEL
+
+#include <cstring>
+
+inline bool packetKernelCompiled(SimdIsa isa)
+{
+    return isa == SIMD_AVX512 ? AVX512_PACKET_KERNEL : (isa == SIMD_AVX2 ? AVX2_PACKET_KERNEL : (isa == SIMD_SSE42 ? SSE42_PACKET_KERNEL : true));
+}
+
+inline int simdWidth(SimdIsa isa)
+{
+    return isa == SIMD_AVX512 ? 16 : (isa == SIMD_AVX2 ? 8 : (isa == SIMD_SSE42 ? 4 : 1));
+}
+
+inline const char* simdName(SimdIsa isa)
+{
+    return isa == SIMD_AVX512 ? "AVX-512" : (isa == SIMD_AVX2 ? "AVX2" : (isa == SIMD_SSE42 ? "SSE4.2" : "scalar"));
+}
+
+// Command line spelling: scalar, sse4.2, avx2 or avx512.
+inline bool parseSimd(const char* name, SimdIsa& isa)
+{
+    static const char* names[4] = {"scalar", "sse4.2", "avx2", "avx512"};
+    for(int i = 0; i < 4; i++)
+    {
+        if (strcmp(name, names[i]) == 0)
+        {
+            isa = (SimdIsa)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+inline bool cpuSupports(SimdIsa isa)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    __builtin_cpu_init();
+    if (isa == SIMD_AVX512)
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+    if (isa == SIMD_AVX2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (isa == SIMD_SSE42)
+        return __builtin_cpu_supports("sse4.2");
+    return true;
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+    int info[4];
+    __cpuid(info, 1);
+    bool sse42 = (info[2] & (1 << 20)) != 0;
+    bool osAvx = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 0x6) == 0x6;
+    bool fma = (info[2] & (1 << 12)) != 0;
+    __cpuidex(info, 7, 0);
+    bool avx2 = osAvx && fma && (info[1] & (1 << 5)) != 0;
+    bool avx512 = avx2 && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0 && (_xgetbv(0) & 0xE6) == 0xE6;
+    if (isa == SIMD_AVX512)
+        return avx512;
+    if (isa == SIMD_AVX2)
+        return avx2;
+    if (isa == SIMD_SSE42)
+        return sse42;
+    return true;
+#else
+    return isa == SIMD_SCALAR;
+#endif
+}
+
+inline bool simdAvailable(SimdIsa isa)
+{
+    return isa == SIMD_SCALAR || (cpuSupports(isa) && packetKernelCompiled(isa));
+}
+
+// Widest kernel that is both compiled in and supported by this CPU.
+inline SimdIsa detectSimd()
+{
+    if (simdAvailable(SIMD_AVX512))
+        return SIMD_AVX512;
+    if (simdAvailable(SIMD_AVX2))
+        return SIMD_AVX2;
+    if (simdAvailable(SIMD_SSE42))
+        return SIMD_SSE42;
+    return SIMD_SCALAR;
+}
+
+inline bool castPacket(SimdIsa isa, const PacketFrame& frame, PacketRays& rays)
+{
+    switch (isa)
+    {
+    case SIMD_AVX512:
+        return castPacketAVX512(frame, rays);
+    case SIMD_AVX2:
+        return castPacketAVX2(frame, rays);
+    case SIMD_SSE42:
+        return castPacketSSE42(frame, rays);
+    default:
+        return false;
+    }
+}
+
+inline bool gradientRow(SimdIsa isa, const GradientRow& row)
+{
+    switch (isa)
+    {
+    case SIMD_AVX512:
+        return gradientRowAVX512(row);
+    case SIMD_AVX2:
+        return gradientRowAVX2(row);
+    case SIMD_SSE42:
+        return gradientRowSSE42(row);
+    default:
+        return false;
+    }
+}
+
+#endif
+#endif
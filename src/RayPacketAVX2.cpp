@@ -0,0 +1,30 @@
+// Ray packet kernel for AVX2 and FMA, built with the flags set in CMakeLists.txt.
+#include "RayPacketKernel.h"
+
+#if defined(__AVX2__)
+extern const bool AVX2_PACKET_KERNEL = true;
+
+bool castPacketAVX2(const PacketFrame& frame, PacketRays& rays)
+{
+    castPacketKernel<Avx2Ops>(frame, rays);
+    return true;
+}
+
+bool gradientRowAVX2(const GradientRow& row)
+{
+    gradientRowKernel<Avx2Ops>(row);
+    return true;
+}
+#else
+extern const bool AVX2_PACKET_KERNEL = false;
+
+bool castPacketAVX2(const PacketFrame&, PacketRays&)
+{
+    return false;
+}
+
+bool gradientRowAVX2(const GradientRow&)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,30 @@
+// Ray packet kernel for AVX-512F, built with the flags set in CMakeLists.txt.
+#include "RayPacketKernel.h"
+
+#if defined(__AVX512F__)
+extern const bool AVX512_PACKET_KERNEL = true;
+
+bool castPacketAVX512(const PacketFrame& frame, PacketRays& rays)
+{
+    castPacketKernel<Avx512Ops>(frame, rays);
+    return true;
+}
+
+bool gradientRowAVX512(const GradientRow& row)
+{
+    gradientRowKernel<Avx512Ops>(row);
+    return true;
+}
+#else
+extern const bool AVX512_PACKET_KERNEL = false;
+
+bool castPacketAVX512(const PacketFrame&, PacketRays&)
+{
+    return false;
+}
+
+bool gradientRowAVX512(const GradientRow&)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,475 @@
+#ifndef RAY_PACKET_KERNEL_H
+#define RAY_PACKET_KERNEL_H
+
+// Templated ray packet kernel, instantiated by RayPacketSSE42.cpp,
+// RayPacketAVX2.cpp and RayPacketAVX512.cpp with the matching ops below. Only
+// the ops for the ISA the including file is compiled for are defined, and
+// everything lives in an anonymous namespace so no code compiled for a wider
+// ISA can be shared with other translation units. Templates declared outside
+// it, std::min and the other algorithms included, would still be emitted as
+// weak symbols the linker may keep for every caller, so the kernels do not
+// call them.
+
+#define RAY_PACKET_KERNEL
+#include "RayPacket.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+
+namespace
+{
+
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(_M_X64))
+struct Sse42Ops
+{
+    static const int N = 4;
+    typedef __m128 F;
+    typedef __m128i I;
+
+    static F set1(float v) { return _mm_set1_ps(v); }
+    static I set1i(int v) { return _mm_set1_epi32(v); }
+    static F load(const float* p) { return _mm_loadu_ps(p); }
+    static I loadi(const int* p) { return _mm_loadu_si128((const __m128i*)p); }
+    static void store(float* p, F v) { _mm_storeu_ps(p, v); }
+    static F add(F a, F b) { return _mm_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm_div_ps(a, b); }
+    static F fmadd(F a, F b, F c) { return _mm_add_ps(_mm_mul_ps(a, b), c); }
+    static F min(F a, F b) { return _mm_min_ps(a, b); }
+    static F max(F a, F b) { return _mm_max_ps(a, b); }
+    static F floor(F a) { return _mm_floor_ps(a); }
+    static I toInt(F a) { return _mm_cvttps_epi32(a); }
+    static F toFloat(I a) { return _mm_cvtepi32_ps(a); }
+    static I addi(I a, I b) { return _mm_add_epi32(a, b); }
+    static I mulli(I a, I b) { return _mm_mullo_epi32(a, b); }
+    static bool any(F a) { return _mm_movemask_ps(_mm_cmpgt_ps(a, _mm_setzero_ps())) != 0; }
+    static float hsum(F a)
+    {
+        alignas(16) float v[4];
+        _mm_store_ps(v, a);
+        return v[0] + v[1] + v[2] + v[3];
+    }
+
+    // 1.0 where the comparison holds, 0.0 elsewhere.
+    static F greaterEqual(F a, F b) { return _mm_and_ps(_mm_cmpge_ps(a, b), _mm_set1_ps(1.0f)); }
+    static F less(F a, F b) { return _mm_and_ps(_mm_cmplt_ps(a, b), _mm_set1_ps(1.0f)); }
+
+    // No gather instruction before AVX2, the four bytes are read one by one.
+    static F gather(const unsigned char* base, I idx)
+    {
+        alignas(16) int i[4];
+        _mm_store_si128((__m128i*)i, idx);
+        return _mm_cvtepi32_ps(_mm_setr_epi32(base[i[0]], base[i[1]], base[i[2]], base[i[3]]));
+    }
+
+    static F gatherf(const float* base, I idx)
+    {
+        alignas(16) int i[4];
+        _mm_store_si128((__m128i*)i, idx);
+        return _mm_setr_ps(base[i[0]], base[i[1]], base[i[2]], base[i[3]]);
+    }
+
+    // N consecutive bytes as floats, and N ints in [0,255] back to bytes.
+    static F loadBytes(const unsigned char* p)
+    {
+        int v;
+        memcpy(&v, p, 4);
+        return _mm_cvtepi32_ps(_mm_cvtepu8_epi32(_mm_cvtsi32_si128(v)));
+    }
+
+    static void storeBytes(unsigned char* p, I v)
+    {
+        __m128i words = _mm_packus_epi32(v, v);
+        int bytes = _mm_cvtsi128_si32(_mm_packus_epi16(words, words));
+        memcpy(p, &bytes, 4);
+    }
+
+    static F sqrt(F a) { return _mm_sqrt_ps(a); }
+};
+#endif
+
+#if defined(__AVX2__)
+struct Avx2Ops
+{
+    static const int N = 8;
+    typedef __m256 F;
+    typedef __m256i I;
+
+    static F set1(float v) { return _mm256_set1_ps(v); }
+    static I set1i(int v) { return _mm256_set1_epi32(v); }
+    static F load(const float* p) { return _mm256_loadu_ps(p); }
+    static I loadi(const int* p) { return _mm256_loadu_si256((const __m256i*)p); }
+    static void store(float* p, F v) { _mm256_storeu_ps(p, v); }
+    static F add(F a, F b) { return _mm256_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm256_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm256_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm256_div_ps(a, b); }
+    static F fmadd(F a, F b, F c) { return _mm256_fmadd_ps(a, b, c); }
+    static F min(F a, F b) { return _mm256_min_ps(a, b); }
+    static F max(F a, F b) { return _mm256_max_ps(a, b); }
+    static F floor(F a) { return _mm256_floor_ps(a); }
+    static I toInt(F a) { return _mm256_cvttps_epi32(a); }
+    static F toFloat(I a) { return _mm256_cvtepi32_ps(a); }
+    static I addi(I a, I b) { return _mm256_add_epi32(a, b); }
+    static I mulli(I a, I b) { return _mm256_mullo_epi32(a, b); }
+    static bool any(F a) { return _mm256_movemask_ps(_mm256_cmp_ps(a, _mm256_setzero_ps(), _CMP_GT_OQ)) != 0; }
+    static float hsum(F a)
+    {
+        __m128 s = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        s = _mm_hadd_ps(s, s);
+        s = _mm_hadd_ps(s, s);
+        return _mm_cvtss_f32(s);
+    }
+
+    static F greaterEqual(F a, F b) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_GE_OQ), _mm256_set1_ps(1.0f)); }
+    static F less(F a, F b) { return _mm256_and_ps(_mm256_cmp_ps(a, b, _CMP_LT_OQ), _mm256_set1_ps(1.0f)); }
+
+    // 32-bit gathers at byte offsets, the low byte is the voxel.
+    static F gather(const unsigned char* base, I idx)
+    {
+        __m256i v = _mm256_i32gather_epi32((const int*)base, idx, 1);
+        return _mm256_cvtepi32_ps(_mm256_and_si256(v, _mm256_set1_epi32(0xFF)));
+    }
+
+    static F gatherf(const float* base, I idx) { return _mm256_i32gather_ps(base, idx, 4); }
+
+    static F loadBytes(const unsigned char* p) { return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)p))); }
+
+    static void storeBytes(unsigned char* p, I v)
+    {
+        __m128i words = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        _mm_storel_epi64((__m128i*)p, _mm_packus_epi16(words, words));
+    }
+
+    static F sqrt(F a) { return _mm256_sqrt_ps(a); }
+};
+#endif
+
+#if defined(__AVX512F__)
+struct Avx512Ops
+{
+    static const int N = 16;
+    typedef __m512 F;
+    typedef __m512i I;
+
+    static F set1(float v) { return _mm512_set1_ps(v); }
+    static I set1i(int v) { return _mm512_set1_epi32(v); }
+    static F load(const float* p) { return _mm512_loadu_ps(p); }
+    static I loadi(const int* p) { return _mm512_loadu_si512((const void*)p); }
+    static void store(float* p, F v) { _mm512_storeu_ps(p, v); }
+    static F add(F a, F b) { return _mm512_add_ps(a, b); }
+    static F sub(F a, F b) { return _mm512_sub_ps(a, b); }
+    static F mul(F a, F b) { return _mm512_mul_ps(a, b); }
+    static F div(F a, F b) { return _mm512_div_ps(a, b); }
+    static F fmadd(F a, F b, F c) { return _mm512_fmadd_ps(a, b, c); }
+    static F min(F a, F b) { return _mm512_min_ps(a, b); }
+    static F max(F a, F b) { return _mm512_max_ps(a, b); }
+    static F floor(F a) { return _mm512_roundscale_ps(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+    static I toInt(F a) { return _mm512_cvttps_epi32(a); }
+    static F toFloat(I a) { return _mm512_cvtepi32_ps(a); }
+    static I addi(I a, I b) { return _mm512_add_epi32(a, b); }
+    static I mulli(I a, I b) { return _mm512_mullo_epi32(a, b); }
+    static bool any(F a) { return _mm512_cmp_ps_mask(a, _mm512_setzero_ps(), _CMP_GT_OQ) != 0; }
+    static float hsum(F a) { return _mm512_reduce_add_ps(a); }
+
+    static F greaterEqual(F a, F b) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_GE_OQ), _mm512_set1_ps(1.0f)); }
+    static F less(F a, F b) { return _mm512_maskz_mov_ps(_mm512_cmp_ps_mask(a, b, _CMP_LT_OQ), _mm512_set1_ps(1.0f)); }
+
+    static F gather(const unsigned char* base, I idx)
+    {
+        __m512i v = _mm512_i32gather_epi32(idx, (const void*)base, 1);
+        return _mm512_cvtepi32_ps(_mm512_and_si512(v, _mm512_set1_epi32(0xFF)));
+    }
+
+    static F gatherf(const float* base, I idx) { return _mm512_i32gather_ps(idx, base, 4); }
+
+    static F loadBytes(const unsigned char* p) { return _mm512_cvtepi32_ps(_mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)p))); }
+    static void storeBytes(unsigned char* p, I v) { _mm_storeu_si128((__m128i*)p, _mm512_cvtepi32_epi8(v)); }
+    static F sqrt(F a) { return _mm512_sqrt_ps(a); }
+};
+#endif
+
+// Trilinear samples at padded voxel coordinates, which must keep both taps
+// inside the padded volume: the eight corners come from vector gathers.
+template <class Ops>
+typename Ops::F trilinear(const PacketVolume& vol, typename Ops::F u, typename Ops::F v, typename Ops::F w)
+{
+    typedef typename Ops::F F;
+    typedef typename Ops::I I;
+    const I strideY = Ops::set1i(vol.strideY), strideZ = Ops::set1i(vol.strideZ);
+    const I offX = Ops::set1i(1), offY = Ops::set1i(vol.strideY), offZ = Ops::set1i(vol.strideZ);
+
+    F u0 = Ops::floor(u), v0 = Ops::floor(v), w0 = Ops::floor(w);
+    F fx = Ops::sub(u, u0), fy = Ops::sub(v, v0), fz = Ops::sub(w, w0);
+    I idx = Ops::addi(Ops::addi(Ops::mulli(Ops::toInt(w0), strideZ), Ops::mulli(Ops::toInt(v0), strideY)), Ops::toInt(u0));
+
+    F c000 = Ops::gather(vol.data, idx);
+    F c100 = Ops::gather(vol.data, Ops::addi(idx, offX));
+    F c010 = Ops::gather(vol.data, Ops::addi(idx, offY));
+    F c110 = Ops::gather(vol.data, Ops::addi(idx, Ops::addi(offX, offY)));
+    I idz = Ops::addi(idx, offZ);
+    F c001 = Ops::gather(vol.data, idz);
+    F c101 = Ops::gather(vol.data, Ops::addi(idz, offX));
+    F c011 = Ops::gather(vol.data, Ops::addi(idz, offY));
+    F c111 = Ops::gather(vol.data, Ops::addi(idz, Ops::addi(offX, offY)));
+
+    //lerp(a, b, t) = a + (b - a) * t
+    F c00 = Ops::fmadd(Ops::sub(c100, c000), fx, c000);
+    F c10 = Ops::fmadd(Ops::sub(c110, c010), fx, c010);
+    F c01 = Ops::fmadd(Ops::sub(c101, c001), fx, c001);
+    F c11 = Ops::fmadd(Ops::sub(c111, c011), fx, c011);
+    F c0 = Ops::fmadd(Ops::sub(c10, c00), fy, c00);
+    F c1 = Ops::fmadd(Ops::sub(c11, c01), fy, c01);
+    return Ops::fmadd(Ops::sub(c1, c0), fz, c0);
+}
+
+// cubicOffsets() lane-parallel: the positions of the two linear samples
+// along one axis and the weight g0 of the first.
+template <class Ops>
+void cubicOffsets(typename Ops::F u, typename Ops::F& p0, typename Ops::F& p1, typename Ops::F& g0)
+{
+    typedef typename Ops::F F;
+    const F one = Ops::set1(1.0f), half = Ops::set1(0.5f), sixth = Ops::set1(1.0f / 6.0f), twoThirds = Ops::set1(2.0f / 3.0f);
+    F i = Ops::floor(u), a = Ops::sub(u, i), b = Ops::sub(one, a);
+    F a2 = Ops::mul(a, a), a3 = Ops::mul(a2, a);
+    F w0 = Ops::mul(Ops::mul(Ops::mul(b, b), b), sixth);
+    F w1 = Ops::add(Ops::sub(Ops::mul(half, a3), a2), twoThirds);
+    F w3 = Ops::mul(a3, sixth);
+    g0 = Ops::add(w0, w1);
+    p0 = Ops::add(i, Ops::sub(Ops::div(w1, g0), one));
+    p1 = Ops::add(i, Ops::add(Ops::div(w3, Ops::sub(one, g0)), one));
+}
+
+// Cubic B-spline from eight trilinear samples, Volume::sampleCubic() at
+// padded voxel coordinates in [1, size + 2 pad - 2), where all 64 voxels lie
+// inside the padded volume.
+template <class Ops>
+typename Ops::F cubic(const PacketVolume& vol, typename Ops::F u, typename Ops::F v, typename Ops::F w)
+{
+    typedef typename Ops::F F;
+    F x0, x1, gx, y0, y1, gy, z0, z1, gz;
+    cubicOffsets<Ops>(u, x0, x1, gx);
+    cubicOffsets<Ops>(v, y0, y1, gy);
+    cubicOffsets<Ops>(w, z0, z1, gz);
+    F c00 = trilinear<Ops>(vol, x1, y0, z0), c10 = trilinear<Ops>(vol, x1, y1, z0);
+    F c01 = trilinear<Ops>(vol, x1, y0, z1), c11 = trilinear<Ops>(vol, x1, y1, z1);
+    c00 = Ops::fmadd(Ops::sub(trilinear<Ops>(vol, x0, y0, z0), c00), gx, c00);
+    c10 = Ops::fmadd(Ops::sub(trilinear<Ops>(vol, x0, y1, z0), c10), gx, c10);
+    c01 = Ops::fmadd(Ops::sub(trilinear<Ops>(vol, x0, y0, z1), c01), gx, c01);
+    c11 = Ops::fmadd(Ops::sub(trilinear<Ops>(vol, x0, y1, z1), c11), gx, c11);
+    F c0 = Ops::fmadd(Ops::sub(c00, c10), gy, c10);
+    F c1 = Ops::fmadd(Ops::sub(c01, c11), gy, c11);
+    return Ops::fmadd(Ops::sub(c0, c1), gz, c1);
+}
+
+// Front-to-back compositing of Ops::N rays at once. Each lane walks its own
+// slice index k from kFirst down to kLast: positions, trilinear weights and
+// gather indices are computed lane-parallel, the eight corners come from vector
+// gathers, the transfer function entries on either side of the value from
+// float gathers, and classification and the under operator stay in registers. A lane
+// retires when it passes kLast or its opacity reaches frame.opacityThreshold,
+// and the packet ends when all lanes have.
+// With frame.bricks, every sample looks up its brick first. A step whose
+// active lanes all lie in transparent bricks moves them one plane on without
+// touching the volume, which keeps the packet coherent where per-ray leaps
+// would not; elsewhere a sample spans as many planes as its brick allows, but
+// at least frame.sampleStride, with the opacity corrected to 1 - (1 - a)^steps.
+// With frame.cubic the value is the B-spline of eight trilinear samples.
+template <class Ops>
+void castPacketKernel(const PacketFrame& frame, PacketRays& rays)
+{
+    typedef typename Ops::F F;
+    typedef typename Ops::I I;
+    const PacketVolume& vol = frame.volume;
+
+    const F dirX = Ops::load(rays.dirX), dirY = Ops::load(rays.dirY), dirZ = Ops::load(rays.dirZ);
+    const F kLast = Ops::toFloat(Ops::loadi(rays.kLast));
+    F k = Ops::toFloat(Ops::loadi(rays.kFirst));
+
+    //Padded voxel coordinate of world position p: p * 2 * size - 0.5 + pad.
+    const F scaleX = Ops::set1(2.0f * vol.width), scaleY = Ops::set1(2.0f * vol.height), scaleZ = Ops::set1(2.0f * vol.depth);
+    const F offset = Ops::set1(RAY_PACKET_PAD - 0.5f);
+    //Both taps are border voxels outside this range, so clamping keeps the result.
+    const F zero = Ops::set1(0.0f), one = Ops::set1(1.0f);
+    const F maxX = Ops::set1((float)(vol.width + 2 * RAY_PACKET_PAD - 2));
+    const F maxY = Ops::set1((float)(vol.height + 2 * RAY_PACKET_PAD - 2));
+    const F maxZ = Ops::set1((float)(vol.depth + 2 * RAY_PACKET_PAD - 2));
+    //The B-spline reaches one voxel further each way: outside [1, max) its taps would leave the padding,
+    //which is wide enough that samples on the volume or just outside it keep their place.
+    const F cubicMin = frame.cubic ? one : zero, cubicLess = Ops::set1(frame.cubic ? 1.0f / 256.0f : 0.0f);
+    const F lastEntry = Ops::set1(254.0f);
+    const I four = Ops::set1i(4), channel1 = Ops::set1i(1), channel2 = Ops::set1i(2), channel3 = Ops::set1i(3);
+    //s = -(minZ + k * sliceSpacing)
+    const F negSpacing = Ops::set1(-frame.sliceSpacing), negMinZ = Ops::set1(-frame.minZ);
+    const F threshold = Ops::set1(frame.opacityThreshold);
+
+    const PacketBricks& bricks = frame.bricks;
+    const F invBrick = Ops::set1(bricks.invBrickSize), pad = Ops::set1((float)RAY_PACKET_PAD);
+    const F lastBrickX = Ops::set1((float)(bricks.width - 1));
+    const F lastBrickY = Ops::set1((float)(bricks.height - 1));
+    const F lastBrickZ = Ops::set1((float)(bricks.depth - 1));
+    const I brickStrideY = Ops::set1i(bricks.width), brickStrideZ = Ops::set1i(bricks.width * bricks.height);
+
+    //Brick exits for adaptive steps, in padded voxel coordinates along s. The
+    //far face of a brick is 0 or one brick edge from its corner, per direction sign.
+    const F originX = Ops::fmadd(Ops::set1(frame.eye[0]), scaleX, offset);
+    const F originY = Ops::fmadd(Ops::set1(frame.eye[1]), scaleY, offset);
+    const F originZ = Ops::fmadd(Ops::set1(frame.eye[2]), scaleZ, offset);
+    const F invDirX = Ops::div(one, Ops::mul(dirX, scaleX));
+    const F invDirY = Ops::div(one, Ops::mul(dirY, scaleY));
+    const F invDirZ = Ops::div(one, Ops::mul(dirZ, scaleZ));
+    const F brickEdge = Ops::set1(1.0f / bricks.invBrickSize);
+    const F brickX = Ops::mul(Ops::greaterEqual(dirX, zero), brickEdge);
+    const F brickY = Ops::mul(Ops::greaterEqual(dirY, zero), brickEdge);
+    const F brickZ = Ops::mul(Ops::greaterEqual(dirZ, zero), brickEdge);
+    const F invSpacing = Ops::set1(1.0f / frame.sliceSpacing);
+
+    F accR = zero, accG = zero, accB = zero, accAlpha = zero, accDepth = zero, sampleCount = zero;
+
+    for(;;)
+    {
+        F active = Ops::mul(Ops::greaterEqual(k, kLast), Ops::less(accAlpha, threshold));
+        if (!Ops::any(active))
+            break;
+        F s = Ops::fmadd(k, negSpacing, negMinZ);
+
+        F u = Ops::fmadd(Ops::fmadd(s, dirX, Ops::set1(frame.eye[0])), scaleX, offset);
+        F v = Ops::fmadd(Ops::fmadd(s, dirY, Ops::set1(frame.eye[1])), scaleY, offset);
+        F w = Ops::fmadd(Ops::fmadd(s, dirZ, Ops::set1(frame.eye[2])), scaleZ, offset);
+        u = Ops::min(Ops::max(u, cubicMin), Ops::sub(maxX, cubicLess));
+        v = Ops::min(Ops::max(v, cubicMin), Ops::sub(maxY, cubicLess));
+        w = Ops::min(Ops::max(w, cubicMin), Ops::sub(maxZ, cubicLess));
+
+        F steps = one;
+        if (bricks.steps != nullptr)
+        {
+            F bx = Ops::min(Ops::max(Ops::floor(Ops::mul(Ops::sub(u, pad), invBrick)), zero), lastBrickX);
+            F by = Ops::min(Ops::max(Ops::floor(Ops::mul(Ops::sub(v, pad), invBrick)), zero), lastBrickY);
+            F bz = Ops::min(Ops::max(Ops::floor(Ops::mul(Ops::sub(w, pad), invBrick)), zero), lastBrickZ);
+            I brick = Ops::addi(Ops::addi(Ops::mulli(Ops::toInt(bz), brickStrideZ), Ops::mulli(Ops::toInt(by), brickStrideY)), Ops::toInt(bx));
+            F brickSteps = Ops::gather(bricks.steps, brick);
+            if (!Ops::any(Ops::mul(active, brickSteps)))
+            {
+                k = Ops::sub(k, active);
+                continue;
+            }
+            //Transparent bricks sample zero with one step, the last sample only spans the planes left.
+            steps = Ops::min(Ops::max(brickSteps, one), Ops::add(Ops::sub(k, kLast), one));
+            if (frame.maxStep > 1)
+            {
+                //A span must not leave its brick: planes up to the exit along each axis.
+                F exitX = Ops::mul(Ops::sub(Ops::add(Ops::fmadd(bx, brickEdge, brickX), pad), originX), invDirX);
+                F exitY = Ops::mul(Ops::sub(Ops::add(Ops::fmadd(by, brickEdge, brickY), pad), originY), invDirY);
+                F exitZ = Ops::mul(Ops::sub(Ops::add(Ops::fmadd(bz, brickEdge, brickZ), pad), originZ), invDirZ);
+                F sExit = Ops::min(exitX, Ops::min(exitY, exitZ));
+                F kExit = Ops::floor(Ops::mul(Ops::sub(Ops::sub(zero, sExit), Ops::set1(frame.minZ)), invSpacing));
+                steps = Ops::max(Ops::min(steps, Ops::sub(k, kExit)), one);
+            }
+        }
+        if (frame.sampleStride > 1)
+            steps = Ops::max(steps, Ops::min(Ops::set1((float)frame.sampleStride), Ops::add(Ops::sub(k, kLast), one)));
+
+        F value = frame.cubic ? cubic<Ops>(vol, u, v, w) : trilinear<Ops>(vol, u, v, w);
+
+        //TransferFunction::lookup(): entries i and i + 1 around the value, 4 floats each.
+        F entry = Ops::min(Ops::floor(value), lastEntry);
+        F fv = Ops::sub(value, entry);
+        I lo = Ops::mulli(Ops::toInt(entry), four), hi = Ops::addi(lo, four);
+        F r0 = Ops::gatherf(frame.transfer, lo), r1 = Ops::gatherf(frame.transfer, hi);
+        F g0 = Ops::gatherf(frame.transfer, Ops::addi(lo, channel1)), g1 = Ops::gatherf(frame.transfer, Ops::addi(hi, channel1));
+        F b0 = Ops::gatherf(frame.transfer, Ops::addi(lo, channel2)), b1 = Ops::gatherf(frame.transfer, Ops::addi(hi, channel2));
+        F a0 = Ops::gatherf(frame.transfer, Ops::addi(lo, channel3)), a1 = Ops::gatherf(frame.transfer, Ops::addi(hi, channel3));
+        F red = Ops::fmadd(Ops::sub(r1, r0), fv, r0);
+        F green = Ops::fmadd(Ops::sub(g1, g0), fv, g0);
+        F blue = Ops::fmadd(Ops::sub(b1, b0), fv, b0);
+        F alpha = Ops::fmadd(Ops::sub(a1, a0), fv, a0);
+
+        //blendUnder(), the color scaled like alpha by correctOpacity(): over several
+        //planes the transparency 1 - a multiplies once per plane.
+        F transmit = Ops::mul(Ops::sub(one, accAlpha), active);
+        F colorScale = transmit;
+        if (frame.maxStep > 1)
+        {
+            F transparency = Ops::sub(one, alpha), product = transparency;
+            for(int j = 1; j < frame.maxStep; j++)
+            {
+                F spans = Ops::min(Ops::max(Ops::sub(steps, Ops::set1((float)j)), zero), one);
+                product = Ops::mul(product, Ops::fmadd(spans, Ops::sub(transparency, one), one));
+            }
+            F corrected = Ops::sub(one, product);
+            //Zero alpha has zero color and a zero corrected alpha, any divisor does.
+            colorScale = Ops::mul(transmit, Ops::div(corrected, Ops::max(alpha, Ops::set1(1e-30f))));
+            alpha = corrected;
+        }
+
+        F weight = Ops::mul(transmit, alpha);
+        accR = Ops::fmadd(colorScale, red, accR);
+        accG = Ops::fmadd(colorScale, green, accG);
+        accB = Ops::fmadd(colorScale, blue, accB);
+        accAlpha = Ops::add(accAlpha, weight);
+        accDepth = Ops::fmadd(weight, s, accDepth);
+        sampleCount = Ops::add(sampleCount, active);
+        k = Ops::sub(k, Ops::mul(steps, active));
+    }
+
+    Ops::store(rays.r, accR);
+    Ops::store(rays.g, accG);
+    Ops::store(rays.b, accB);
+    Ops::store(rays.a, accAlpha);
+    Ops::store(rays.depth, accDepth);
+    rays.samples += (unsigned long long)Ops::hsum(sampleCount);
+}
+
+// Gradient magnitudes of one row, Ops::N voxels per step and the rest one by
+// one. The differences are integers, so every path rounds the same way.
+template<class Ops>
+void gradientRowKernel(const GradientRow& row)
+{
+    typedef typename Ops::F F;
+    const F limit = Ops::set1(255.0f), half = Ops::set1(0.5f);
+    const F zero = Ops::set1(0.0f), one = Ops::set1(1.0f), two = Ops::set1(2.0f), scale = Ops::set1(255.0f);
+    int i = 0;
+    for(; i + Ops::N <= row.count; i += Ops::N)
+    {
+        F dx = Ops::sub(Ops::loadBytes(row.xp + i), Ops::loadBytes(row.xm + i));
+        F dy = Ops::sub(Ops::loadBytes(row.yp + i), Ops::loadBytes(row.ym + i));
+        F dz = Ops::sub(Ops::loadBytes(row.zp + i), Ops::loadBytes(row.zm + i));
+        F length = Ops::sqrt(Ops::fmadd(dz, dz, Ops::fmadd(dy, dy, Ops::mul(dx, dx))));
+        Ops::storeBytes(row.out + i, Ops::toInt(Ops::add(Ops::min(length, limit), half)));
+        if (row.normalU == nullptr)
+            continue;
+        //Masks are 1 or 0 and every value an integer, so the selects are exact products.
+        F ax = Ops::max(dx, Ops::sub(zero, dx)), ay = Ops::max(dy, Ops::sub(zero, dy)), az = Ops::max(dz, Ops::sub(zero, dz));
+        F l1 = Ops::add(Ops::add(ax, ay), az);
+        F upper = Ops::greaterEqual(dz, zero);
+        F signX = Ops::sub(Ops::mul(Ops::greaterEqual(dx, zero), two), one), signY = Ops::sub(Ops::mul(Ops::greaterEqual(dy, zero), two), one);
+        F x = Ops::add(Ops::mul(upper, dx), Ops::mul(Ops::sub(one, upper), Ops::mul(signX, Ops::sub(l1, ay))));
+        F y = Ops::add(Ops::mul(upper, dy), Ops::mul(Ops::sub(one, upper), Ops::mul(signY, Ops::sub(l1, ax))));
+        F denominator = Ops::max(Ops::add(l1, l1), one);
+        Ops::storeBytes(row.normalU + i, Ops::toInt(Ops::div(Ops::add(Ops::mul(Ops::add(x, l1), scale), l1), denominator)));
+        Ops::storeBytes(row.normalV + i, Ops::toInt(Ops::div(Ops::add(Ops::mul(Ops::add(y, l1), scale), l1), denominator)));
+    }
+    for(; i < row.count; i++)
+    {
+        int dx = row.xp[i] - row.xm[i], dy = row.yp[i] - row.ym[i], dz = row.zp[i] - row.zm[i];
+        float magnitude = sqrtf((float)(dx * dx + dy * dy + dz * dz));
+        row.out[i] = (unsigned char)((magnitude < 255.0f ? magnitude : 255.0f) + 0.5f);
+        if (row.normalU == nullptr)
+            continue;
+        int l1 = abs(dx) + abs(dy) + abs(dz);
+        int x = dz >= 0 ? dx : (dx >= 0 ? 1 : -1) * (l1 - abs(dy)), y = dz >= 0 ? dy : (dy >= 0 ? 1 : -1) * (l1 - abs(dx));
+        int denominator = l1 > 0 ? 2 * l1 : 1;
+        row.normalU[i] = (unsigned char)(((x + l1) * 255 + l1) / denominator);
+        row.normalV[i] = (unsigned char)(((y + l1) * 255 + l1) / denominator);
+    }
+}
+
+}
+#endif
@@ -0,0 +1,30 @@
+// Ray packet kernel for SSE 4.2, built with the flags set in CMakeLists.txt.
+#include "RayPacketKernel.h"
+
+#if defined(__SSE4_2__) || (defined(_MSC_VER) && defined(_M_X64))
+extern const bool SSE42_PACKET_KERNEL = true;
+
+bool castPacketSSE42(const PacketFrame& frame, PacketRays& rays)
+{
+    castPacketKernel<Sse42Ops>(frame, rays);
+    return true;
+}
+
+bool gradientRowSSE42(const GradientRow& row)
+{
+    gradientRowKernel<Sse42Ops>(row);
+    return true;
+}
+#else
+extern const bool SSE42_PACKET_KERNEL = false;
+
+bool castPacketSSE42(const PacketFrame&, PacketRays&)
+{
+    return false;
+}
+
+bool gradientRowSSE42(const GradientRow&)
+{
+    return false;
+}
+#endif
@@ -0,0 +1,321 @@
+#ifndef REPROJECTION_CACHE_H
+#define REPROJECTION_CACHE_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "Image.h"
+#include "Compositor.h"
+#include "RayCaster.h"
+#include "TileScheduler.h"
+
+struct ReprojectionStats
+{
+    unsigned long long pixels = 0;
+    unsigned long long reprojected = 0; //taken over from the previous frame
+    unsigned long long filled = 0; //resampling holes closed from their neighbours
+    unsigned long long background = 0; //rays that miss the data, nothing to cast
+    unsigned long long disoccluded = 0; //re-cast, nothing landed there
+    unsigned long long edges = 0; //re-cast, next to a depth discontinuity
+    unsigned long long refreshed = 0; //re-cast, their turn in the refresh pattern
+    unsigned long long samples = 0;
+    double milliseconds = 0.0;
+
+    unsigned long long recast() const
+    {
+        return disoccluded + edges + refreshed;
+    }
+
+    // Share of a full frame's rays that were cast.
+    double recastFraction() const
+    {
+        return pixels > 0 ? (double)recast() / pixels : 0.0;
+    }
+};
+
+// Temporal reprojection for small camera moves. Every frame keeps its colors
+// and, per pixel, the representative depth the RayCaster reports. The next
+// frame scatters those pixels to where their depth puts them under the new
+// view, nearest depth winning, and only casts what the old frame cannot
+// answer: pixels nothing landed on (disocclusions, newly covered data),
+// pixels beside a depth discontinuity, whose source is ambiguous, and a
+// rotating 1 / refreshInterval of the rest, so every pixel is cast anew at
+// least that often and reprojection errors cannot pile up. One pixel wide
+// holes between consistent neighbours are resampling gaps, not
+// disocclusions, and get their neighbours' average.
+class ReprojectionCache
+{
+public:
+    RayCaster& rayCaster;
+    int refreshInterval;
+    float depthTolerance; //relative depth step between neighbours that counts as an edge
+
+    ReprojectionCache(RayCaster& rayCaster) : rayCaster(rayCaster)
+    {
+        refreshInterval = 16;
+        depthTolerance = 0.02f;
+        frameIndex = 0;
+        valid = false;
+    }
+
+    // Drops the previous frame, the next render() casts everything.
+    void invalidate()
+    {
+        valid = false;
+    }
+
+    void render(glm::mat4 view, glm::mat4 projection, Image& image, ReprojectionStats* stats = nullptr)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        ReprojectionStats frameStats;
+        const int W = image.width, H = image.height;
+        const size_t count = (size_t)W * H;
+        frameStats.pixels = count;
+
+        if (!valid || previous.width != W || previous.height != H)
+        {
+            RayCastStats counts;
+            rayCaster.render(view, projection, image, &counts, &depth);
+            for(size_t i = 0; i < count; i++)
+            {
+                if (depth[i] < 0.0f)
+                    frameStats.background++;
+                else
+                    frameStats.disoccluded++;
+            }
+            frameStats.samples = counts.samples;
+        }
+        else
+        {
+            rayCaster.beginFrame(view, projection, W, H);
+            currentView = view;
+            currentProjection = projection;
+            scatter(view, projection, W, H);
+            std::vector<int> recast = resolve(image, frameStats);
+
+            std::vector<RayCastStats> counts(rayCaster.threadCount);
+            const int CHUNK = 256;
+            TileScheduler scheduler(rayCaster.threadCount);
+            scheduler.run((int)((recast.size() + CHUNK - 1) / CHUNK), 1, 1, 1, [&](const WorkTile& tile, unsigned int worker)
+            {
+                size_t first = (size_t)tile.x0 * CHUNK;
+                int n = (int)std::min((size_t)CHUNK, recast.size() - first);
+                rayCaster.castPixels(&recast[first], n, image, counts[worker], &depth);
+            });
+            for(size_t t = 0; t < counts.size(); t++)
+                frameStats.samples += counts[t].samples;
+        }
+
+        previous = image;
+        previousDepth = depth;
+        previousView = view;
+        previousProjection = projection;
+        valid = true;
+        frameIndex++;
+
+        frameStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        if (stats != nullptr)
+            *stats = frameStats;
+    }
+
+private:
+    bool valid;
+    unsigned int frameIndex;
+    Image previous;
+    std::vector<float> previousDepth, depth;
+    glm::mat4 previousView, previousProjection;
+    glm::mat4 currentView, currentProjection;
+    //Per new pixel: depth bits << 32 | source pixel, the smallest wins.
+    std::unique_ptr<std::atomic<unsigned long long>[]> targets;
+    size_t targetCount = 0;
+
+    static const unsigned long long NO_TARGET = ~0ull;
+
+    void scatter(glm::mat4 view, glm::mat4 projection, int W, int H)
+    {
+        size_t count = (size_t)W * H;
+        if (targetCount != count)
+        {
+            targets.reset(new std::atomic<unsigned long long>[count]);
+            targetCount = count;
+        }
+        for(size_t i = 0; i < count; i++)
+            targets[i].store(NO_TARGET, std::memory_order_relaxed);
+
+        glm::mat4 invView = glm::inverse(previousView), invProjection = glm::inverse(previousProjection);
+        glm::vec3 eye(invView[3]);
+        glm::mat4 viewProjection = projection * view;
+        TileScheduler scheduler(rayCaster.threadCount);
+        scheduler.run(W, H, W, 8, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int y = tile.y0; y < tile.y1; y++)
+            {
+                for(int x = 0; x < W; x++)
+                {
+                    size_t source = (size_t)y * W + x;
+                    float s = previousDepth[source];
+                    if (s < 0.0f)
+                        continue;
+                    glm::vec3 point = eye + s * (glm::mat3(invView) * viewRayThroughPixel(x, y, W, H, invProjection));
+                    glm::vec4 clip = viewProjection * glm::vec4(point, 1.0f);
+                    if (clip.w <= 0.0f)
+                        continue;
+                    int px = (int)floorf((clip.x / clip.w * 0.5f + 0.5f) * W);
+                    int py = (int)floorf((clip.y / clip.w * 0.5f + 0.5f) * H);
+                    if (px < 0 || py < 0 || px >= W || py >= H)
+                        continue;
+
+                    //Positive floats order like their bit patterns.
+                    float newDepth = clip.w;
+                    unsigned int bits;
+                    memcpy(&bits, &newDepth, sizeof(bits));
+                    unsigned long long key = (unsigned long long)bits << 32 | source;
+                    std::atomic<unsigned long long>& target = targets[(size_t)py * W + px];
+                    unsigned long long current = target.load(std::memory_order_relaxed);
+                    while (key < current && !target.compare_exchange_weak(current, key, std::memory_order_relaxed))
+                        ;
+                }
+            }
+        });
+    }
+
+    // New pixel's depth from the scatter, -1 for a hole.
+    float targetDepth(size_t pixel) const
+    {
+        unsigned long long key = targets[pixel].load(std::memory_order_relaxed);
+        if (key == NO_TARGET)
+            return -1.0f;
+        unsigned int bits = (unsigned int)(key >> 32);
+        float d;
+        memcpy(&d, &bits, sizeof(d));
+        return d;
+    }
+
+    // Takes over the reprojected pixels and returns the ones to cast.
+    std::vector<int> resolve(Image& image, ReprojectionStats& frameStats)
+    {
+        const int W = image.width, H = image.height;
+        depth.assign((size_t)W * H, -1.0f);
+        glm::ivec4 footprint = dataFootprint(W, H);
+        std::vector<std::vector<int> > rowRecast(H);
+        std::vector<ReprojectionStats> rowStats(H);
+
+        TileScheduler scheduler(rayCaster.threadCount);
+        scheduler.run(W, H, W, 8, [&](const WorkTile& tile, unsigned int)
+        {
+            for(int y = tile.y0; y < tile.y1; y++)
+            {
+                ReprojectionStats& counts = rowStats[y];
+                for(int x = 0; x < W; x++)
+                {
+                    size_t pixel = (size_t)y * W + x;
+                    float d = targetDepth(pixel);
+                    float neighbours[4] = {
+                        x > 0 ? targetDepth(pixel - 1) : -1.0f, x + 1 < W ? targetDepth(pixel + 1) : -1.0f,
+                        y > 0 ? targetDepth(pixel - W) : -1.0f, y + 1 < H ? targetDepth(pixel + W) : -1.0f};
+                    float nearest = INFINITY, farthest = 0.0f;
+                    int found = 0;
+                    for(int n = 0; n < 4; n++)
+                    {
+                        if (neighbours[n] < 0.0f)
+                            continue;
+                        nearest = std::min(nearest, neighbours[n]);
+                        farthest = std::max(farthest, neighbours[n]);
+                        found++;
+                    }
+
+                    if (d < 0.0f)
+                    {
+                        bool inside = x >= footprint.x && y >= footprint.y && x <= footprint.z && y <= footprint.w;
+                        if (!inside || !rayCaster.hitsData(x, y))
+                        {
+                            image.pixels[pixel] = glm::vec4(0.0f);
+                            counts.background++;
+                        }
+                        else if (found == 4 && farthest - nearest <= depthTolerance * nearest)
+                        {
+                            glm::vec4 color(0.0f);
+                            for(int n = 0; n < 4; n++)
+                                color += previous.pixels[sourceOf(n == 0 ? pixel - 1 : n == 1 ? pixel + 1 : n == 2 ? pixel - W : pixel + W)];
+                            image.pixels[pixel] = color * 0.25f;
+                            depth[pixel] = 0.5f * (nearest + farthest);
+                            counts.filled++;
+                        }
+                        else
+                        {
+                            rowRecast[y].push_back((int)pixel);
+                            counts.disoccluded++;
+                        }
+                        continue;
+                    }
+
+                    bool edge = found > 0 && (fabsf(farthest - d) > depthTolerance * d || fabsf(d - nearest) > depthTolerance * d);
+                    if (edge)
+                    {
+                        rowRecast[y].push_back((int)pixel);
+                        counts.edges++;
+                    }
+                    else if ((x + 5 * y + frameIndex) % refreshInterval == 0)
+                    {
+                        rowRecast[y].push_back((int)pixel);
+                        counts.refreshed++;
+                    }
+                    else
+                    {
+                        image.pixels[pixel] = previous.pixels[sourceOf(pixel)];
+                        depth[pixel] = d;
+                        counts.reprojected++;
+                    }
+                }
+            }
+        });
+
+        std::vector<int> recast;
+        for(int y = 0; y < H; y++)
+        {
+            recast.insert(recast.end(), rowRecast[y].begin(), rowRecast[y].end());
+            frameStats.reprojected += rowStats[y].reprojected;
+            frameStats.filled += rowStats[y].filled;
+            frameStats.background += rowStats[y].background;
+            frameStats.disoccluded += rowStats[y].disoccluded;
+            frameStats.edges += rowStats[y].edges;
+            frameStats.refreshed += rowStats[y].refreshed;
+        }
+        return recast;
+    }
+
+    // Pixel rectangle (x0, y0, x1, y1) around the projected box the ray caster
+    // casts over (see RayCaster::frameBox()), rays outside of it cannot hit the
+    // data.
+    glm::ivec4 dataFootprint(int W, int H) const
+    {
+        glm::vec3 boxMin, boxMax;
+        rayCaster.frameBox(boxMin, boxMax);
+        glm::mat4 viewProjection = currentProjection * currentView;
+        glm::vec2 lo(INFINITY), hi(-INFINITY);
+        for(int i = 0; i < 8; i++)
+        {
+            glm::vec3 corner((i & 1) ? boxMax.x : boxMin.x, (i & 2) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+            glm::vec4 clip = viewProjection * glm::vec4(corner, 1.0f);
+            if (clip.w <= 0.0f)
+                return glm::ivec4(0, 0, W - 1, H - 1);
+            glm::vec2 screen = (glm::vec2(clip) / clip.w * 0.5f + 0.5f) * glm::vec2(W, H);
+            lo = glm::min(lo, screen);
+            hi = glm::max(hi, screen);
+        }
+        return glm::ivec4((int)floorf(lo.x) - 1, (int)floorf(lo.y) - 1, (int)ceilf(hi.x) + 1, (int)ceilf(hi.y) + 1);
+    }
+
+    size_t sourceOf(size_t pixel) const
+    {
+        return (size_t)(targets[pixel].load(std::memory_order_relaxed) & 0xFFFFFFFFull);
+    }
+};
+#endif
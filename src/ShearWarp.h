@@ -0,0 +1,588 @@
+#ifndef SHEAR_WARP_H
+#define SHEAR_WARP_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <climits>
+
+#include "Volume.h"
+#include "Image.h"
+#include "Compositor.h"
+#include "TileScheduler.h"
+
+// One axis-ordered copy of the volume with its transparent runs removed.
+// Layers are perpendicular to axis, with the same slice layout as the texture
+// stacks: x axis (y, z), y axis (x, z), z axis (x, y). Every scanline is a list
+// of run lengths alternating skipped, stored, skipped, ... that add up to the
+// scanline width, and only the voxels of stored runs are kept, packed in data.
+// A voxel is stored when it or one of its 8 neighbours in the layer is not
+// transparent, so every tap of a bilinear sample that can be visible is there.
+struct RunLengthVolume
+{
+    int axis;
+    int width, height, layers; //scanline length, scanlines per layer, layers
+    std::vector<unsigned short> runs;
+    std::vector<unsigned int> runStart; //first run of each scanline, one extra at the end
+    std::vector<unsigned int> dataStart; //first stored voxel of each scanline
+
+    std::vector<unsigned char> data;
+
+    size_t scanline(int y, int layer) const
+    {
+        return (size_t)layer * height + y;
+    }
+
+    size_t memoryFootprint() const
+    {
+        return runs.size() * sizeof(unsigned short) + (runStart.size() + dataStart.size()) * sizeof(unsigned int) + data.size();
+    }
+};
+
+struct ShearWarpStats
+{
+    unsigned long long samples = 0; //composited into the intermediate image
+    unsigned long long intermediatePixels = 0;
+    double encodeMilliseconds = 0.0; //run-length encoding, when the classification changed
+    double compositeMilliseconds = 0.0;
+    double warpMilliseconds = 0.0;
+    double milliseconds = 0.0;
+};
+
+// Shear-warp factorization of the perspective view (Lacroute and Levoy). The
+// slices perpendicular to the principal axis, the one the eye looks along
+// most, are projected through the eye onto the base plane, the front slice:
+// slice k shrinks by s = (k0 - e) / (k - e) about the eye's foot point, so
+// every intermediate pixel collects one ray from the eye. Slices composite
+// front to back into the intermediate image, which runs parallel to the voxel
+// scanlines, so the run-length encoding lets whole transparent runs go by
+// without touching them and pixels that reached opacityThreshold are jumped
+// over through per-row links. The intermediate image is finally warped to the
+// screen, a 2D projective map found by intersecting the pixel rays with the
+// base plane.
+// Samples are classified after bilinear filtering like in the ray caster and
+// corrected to the opacity of the planes sliceSpacing apart they replace, so
+// both converge to the same image. intermediateScale sets intermediate pixels
+// per voxel; above 1 the rays get closer than the voxels of the front slice.
+class ShearWarpRenderer
+{
+public:
+    const Volume& volume;
+    float sliceSpacing;
+    float intermediateScale;
+    float opacityThreshold; //1 disables early ray termination
+    unsigned int threadCount;
+    int rowGrain; //intermediate rows per scheduler tile
+    TransferFunction transferFunction; //its opacity decides what is transparent
+    RunLengthVolume encoded[3];
+    SchedulerStats scheduling; //compositing of the last render()
+
+    ShearWarpRenderer(const Volume& volume, float sliceSpacing = 0.005f) : volume(volume)
+    {
+        this->sliceSpacing = sliceSpacing;
+        intermediateScale = 1.0f;
+        opacityThreshold = 1.0f;
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+        rowGrain = 4;
+        firstVisible = -1;
+    }
+
+    void render(glm::mat4 view, glm::mat4 projection, Image& image, ShearWarpStats* stats = nullptr)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        double encodeTime = encode();
+        auto compositeStart = std::chrono::high_resolution_clock::now();
+        setupFrame(view, projection);
+
+        intermediate.assign((size_t)frame.intermediateWidth * frame.intermediateHeight, glm::vec4(0.0f));
+        links.resize((size_t)(frame.intermediateWidth + 1) * frame.intermediateHeight);
+        for(int j = 0; j < frame.intermediateHeight; j++)
+            for(int i = 0; i <= frame.intermediateWidth; i++)
+                links[(size_t)j * (frame.intermediateWidth + 1) + i] = i;
+
+        std::vector<unsigned long long> samples(threadCount, 0);
+        std::vector<RowCache> caches(threadCount);
+        TileScheduler scheduler(threadCount);
+        scheduler.run(1, frame.intermediateHeight, 1, rowGrain, [&](const WorkTile& tile, unsigned int worker)
+        {
+            samples[worker] += compositeRows(tile.y0, tile.y1, caches[worker]);
+        }, &scheduling);
+        auto warpStart = std::chrono::high_resolution_clock::now();
+
+        scheduler.run(image.width, image.height, 16, 16, [&](const WorkTile& tile, unsigned int)
+        {
+            warp(tile, image);
+        });
+
+        if (stats != nullptr)
+        {
+            auto end = std::chrono::high_resolution_clock::now();
+            for(size_t t = 0; t < samples.size(); t++)
+                stats->samples += samples[t];
+            stats->intermediatePixels += intermediate.size();
+            stats->encodeMilliseconds += encodeTime;
+            stats->compositeMilliseconds += std::chrono::duration<double, std::milli>(warpStart - compositeStart).count();
+            stats->warpMilliseconds += std::chrono::duration<double, std::milli>(end - warpStart).count();
+            stats->milliseconds += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+    }
+
+    // Run-length encodes the three axis copies again if the transparent values
+    // changed since the last call, returns the time spent.
+    double encode()
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        //Values below the first visible one filter to transparent samples among
+        //themselves and with the border, so only they can be left out.
+        int visible = 0;
+        while (visible < TransferFunction::SIZE && transferFunction.table[visible].a <= 0.0f)
+            visible++;
+        if (visible == firstVisible)
+            return 0.0;
+        firstVisible = visible;
+        for(int axis = 0; axis < 3; axis++)
+            encodeAxis(axis);
+        return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    size_t memoryFootprint() const
+    {
+        return encoded[0].memoryFootprint() + encoded[1].memoryFootprint() + encoded[2].memoryFootprint();
+    }
+
+    // Fraction of the voxels of the three copies that are stored.
+    float storedFraction() const
+    {
+        size_t stored = encoded[0].data.size() + encoded[1].data.size() + encoded[2].data.size();
+        return (float)stored / (3.0f * volume.voxelCount());
+    }
+
+private:
+    int firstVisible; //what the copies were encoded for
+    std::vector<glm::vec4> intermediate;
+    std::vector<int> links; //per intermediate row, the next pixel at or after i that is not opaque
+
+    struct FrameSetup
+    {
+        glm::mat4 invView, invProjection;
+        glm::vec3 eye; //in permuted voxel coordinates (x', y', k)
+        glm::vec3 voxelScale; //per permuted axis, world to voxel units
+        glm::ivec3 permutation; //volume axes of x', y' and k
+        int axis, k0, kStep, kEnd;
+        glm::vec2 origin; //base plane position of intermediate pixel (0, 0)
+        int intermediateWidth, intermediateHeight;
+        glm::vec3 ratioPlane; //planes of the reference spacing per slice: |x * i + y * j + z|
+    } frame;
+
+    // Two decoded scanlines of the current slice, with one zero voxel of border
+    // on each side. The stored runs are written in and cleared out again, so
+    // everything else stays zero.
+    struct RowCache
+    {
+        std::vector<unsigned char> rows[2];
+        int row[2] = {INT_MIN, INT_MIN};
+        int layer = -1;
+    };
+
+    void encodeAxis(int axis)
+    {
+        RunLengthVolume& rle = encoded[axis];
+        rle.axis = axis;
+        glm::ivec3 permutation = axisPermutation(axis);
+        glm::ivec3 size(volume.width, volume.height, volume.depth);
+        rle.width = size[permutation.x];
+        rle.height = size[permutation.y];
+        rle.layers = size[permutation.z];
+        glm::ivec3 stride(1, volume.width, volume.width * volume.height);
+        int strideX = stride[permutation.x], strideY = stride[permutation.y], strideZ = stride[permutation.z];
+
+        //Layers are encoded independently into their own lists, then concatenated.
+        std::vector<std::vector<unsigned short> > layerRuns(rle.layers);
+        std::vector<std::vector<unsigned char> > layerData(rle.layers);
+        std::vector<std::vector<unsigned int> > layerRunStart(rle.layers), layerDataStart(rle.layers);
+        const int W = rle.width, H = rle.height;
+        TileScheduler scheduler(std::max(1u, std::min(threadCount, (unsigned int)rle.layers)));
+        scheduler.run(rle.layers, 1, 1, 1, [&](const WorkTile& tile, unsigned int)
+        {
+            std::vector<unsigned char> slice((size_t)W * H), visible((size_t)W * H), keep(W);
+            for(int layer = tile.x0; layer < tile.x1; layer++)
+            {
+                //Visible voxels dilated by one along x here, along y when the runs are cut.
+                const unsigned char* base = volume.data.data() + (size_t)layer * strideZ;
+                for(int y = 0; y < H; y++)
+                {
+                    unsigned char* values = &slice[(size_t)y * W];
+                    unsigned char* near = &visible[(size_t)y * W];
+                    for(int x = 0; x < W; x++)
+                        values[x] = base[(size_t)y * strideY + (size_t)x * strideX];
+                    for(int x = 0; x < W; x++)
+                        near[x] = values[x] >= firstVisible || (x > 0 && values[x - 1] >= firstVisible) || (x + 1 < W && values[x + 1] >= firstVisible);
+                }
+
+                std::vector<unsigned short>& runs = layerRuns[layer];
+                std::vector<unsigned char>& data = layerData[layer];
+                for(int y = 0; y < H; y++)
+                {
+                    for(int x = 0; x < W; x++)
+                        keep[x] = visible[(size_t)y * W + x] || (y > 0 && visible[(size_t)(y - 1) * W + x]) || (y + 1 < H && visible[(size_t)(y + 1) * W + x]);
+
+                    layerRunStart[layer].push_back((unsigned int)runs.size());
+                    layerDataStart[layer].push_back((unsigned int)data.size());
+                    int x = 0;
+                    while (x < W)
+                    {
+                        int skipped = x;
+                        while (x < W && !keep[x])
+                            x++;
+                        runs.push_back((unsigned short)(x - skipped));
+                        int stored = x;
+                        while (x < W && keep[x])
+                            x++;
+                        runs.push_back((unsigned short)(x - stored));
+                        data.insert(data.end(), slice.begin() + (size_t)y * W + stored, slice.begin() + (size_t)y * W + x);
+                    }
+                }
+            }
+        });
+
+        rle.runs.clear();
+        rle.data.clear();
+        rle.runStart.clear();
+        rle.dataStart.clear();
+        for(int layer = 0; layer < rle.layers; layer++)
+        {
+            for(int y = 0; y < H; y++)
+            {
+                rle.runStart.push_back((unsigned int)rle.runs.size() + layerRunStart[layer][y]);
+                rle.dataStart.push_back((unsigned int)rle.data.size() + layerDataStart[layer][y]);
+            }
+            rle.runs.insert(rle.runs.end(), layerRuns[layer].begin(), layerRuns[layer].end());
+            rle.data.insert(rle.data.end(), layerData[layer].begin(), layerData[layer].end());
+        }
+        rle.runStart.push_back((unsigned int)rle.runs.size());
+        rle.dataStart.push_back((unsigned int)rle.data.size());
+    }
+
+    // Volume axes of the scanline, scanline row and layer directions.
+    static glm::ivec3 axisPermutation(int axis)
+    {
+        if (axis == 0)
+            return glm::ivec3(1, 2, 0);
+        if (axis == 1)
+            return glm::ivec3(0, 2, 1);
+        return glm::ivec3(0, 1, 2);
+    }
+
+    void setupFrame(glm::mat4 view, glm::mat4 projection)
+    {
+        frame.invView = glm::inverse(view);
+        frame.invProjection = glm::inverse(projection);
+        glm::vec3 eyeWorld = glm::vec3(frame.invView[3]);
+        glm::vec3 forward = -glm::vec3(frame.invView[2]);
+
+        //Principal axis: the one the eye looks at the data center along most.
+        glm::vec3 toCenter = glm::abs(glm::vec3(0.25f) - eyeWorld);
+        frame.axis = (toCenter.x >= toCenter.y && toCenter.x >= toCenter.z) ? 0 : (toCenter.y >= toCenter.z ? 1 : 2);
+        frame.permutation = axisPermutation(frame.axis);
+        const RunLengthVolume& rle = encoded[frame.axis];
+
+        glm::vec3 scale = 2.0f * glm::vec3(volume.width, volume.height, volume.depth);
+        glm::vec3 eye = eyeWorld * scale - 0.5f;
+        for(int a = 0; a < 3; a++)
+        {
+            frame.eye[a] = eye[frame.permutation[a]];
+            frame.voxelScale[a] = scale[frame.permutation[a]];
+        }
+
+        //Front slice first. An eye between the slices sees the ones ahead of it.
+        float ez = frame.eye.z;
+        if (ez < 0.0f || (ez <= rle.layers - 1 && forward[frame.axis] > 0.0f))
+        {
+            frame.kStep = 1;
+            frame.k0 = std::max(0, (int)floorf(ez) + 1);
+            frame.kEnd = rle.layers;
+        }
+        else
+        {
+            frame.kStep = -1;
+            frame.k0 = std::min(rle.layers - 1, (int)ceilf(ez) - 1);
+            frame.kEnd = -1;
+        }
+
+        //Base plane footprint of all slices, one voxel of border around them.
+        glm::vec2 lo(INFINITY), hi(-INFINITY);
+        int kBack = frame.kEnd - frame.kStep;
+        for(int k : {frame.k0, kBack})
+        {
+            float s = shrink(k);
+            for(int a = 0; a < 2; a++)
+            {
+                float extent = a == 0 ? (float)rle.width : (float)rle.height;
+                for(float p : {-1.0f, extent})
+                {
+                    float q = s * p + (1.0f - s) * frame.eye[a];
+                    lo[a] = std::min(lo[a], q);
+                    hi[a] = std::max(hi[a], q);
+                }
+            }
+        }
+        if (frame.k0 == frame.kEnd || !(hi.x > lo.x))
+            lo = hi = glm::vec2(0.0f);
+        frame.origin = lo;
+        frame.intermediateWidth = std::max(1, (int)ceilf((hi.x - lo.x) * intermediateScale) + 1);
+        frame.intermediateHeight = std::max(1, (int)ceilf((hi.y - lo.y) * intermediateScale) + 1);
+
+        //One slice step along the ray through base point q moves the permuted voxel
+        //vector (q - eye.xy, k0 - eye.z) / |k0 - eye.z|, which in world units covers
+        //|forward . step| / sliceSpacing planes of the reference spacing.
+        glm::vec3 worldForward(forward[frame.permutation.x], forward[frame.permutation.y], forward[frame.permutation.z]);
+        glm::vec3 weight = worldForward / frame.voxelScale / (fabsf(frame.k0 - ez) * sliceSpacing);
+        float invScale = 1.0f / intermediateScale;
+        frame.ratioPlane.x = weight.x * invScale;
+        frame.ratioPlane.y = weight.y * invScale;
+        frame.ratioPlane.z = weight.x * (frame.origin.x - frame.eye.x) + weight.y * (frame.origin.y - frame.eye.y) + weight.z * (frame.k0 - ez);
+    }
+
+    // Scale of slice k about the eye's foot point on the base plane.
+    float shrink(int k) const
+    {
+        return (frame.k0 - frame.eye.z) / (k - frame.eye.z);
+    }
+
+    // Composites all slices into intermediate rows [j0, j1), returns the samples taken.
+    unsigned long long compositeRows(int j0, int j1, RowCache& cache)
+    {
+        const RunLengthVolume& rle = encoded[frame.axis];
+        const int W = frame.intermediateWidth;
+        const float invScale = 1.0f / intermediateScale;
+        for(int r = 0; r < 2; r++)
+        {
+            cache.rows[r].assign(rle.width + 2, 0);
+            cache.row[r] = INT_MIN;
+        }
+        cache.layer = -1;
+
+        unsigned long long samples = 0;
+        for(int k = frame.k0; k != frame.kEnd; k += frame.kStep)
+        {
+            //Slice position of intermediate pixel (i, j): x = a * i + bx, y = a * j + by.
+            float s = shrink(k);
+            float a = invScale / s;
+            float bx = (frame.origin.x - (1.0f - s) * frame.eye.x) / s;
+            float by = (frame.origin.y - (1.0f - s) * frame.eye.y) / s;
+            clearRows(cache);
+            cache.layer = k;
+
+            for(int j = j0; j < j1; j++)
+            {
+                float y = a * j + by;
+                int y0 = (int)floorf(y);
+                if (y0 < -1 || y0 >= rle.height)
+                    continue;
+                float fy = y - y0;
+                const unsigned char* row0 = decodeRow(cache, y0);
+                const unsigned char* row1 = decodeRow(cache, y0 + 1);
+                int* rowLinks = &links[(size_t)j * (W + 1)];
+                glm::vec4* pixels = &intermediate[(size_t)j * W];
+                float ratioRow = frame.ratioPlane.y * j + frame.ratioPlane.z;
+
+                //Stored runs of both scanlines as x intervals [start - 1, end), merged in order.
+                unsigned int r0 = y0 >= 0 ? rle.runStart[rle.scanline(y0, k)] : 0, e0 = y0 >= 0 ? rle.runStart[rle.scanline(y0, k) + 1] : 0;
+                unsigned int r1 = y0 + 1 < rle.height ? rle.runStart[rle.scanline(y0 + 1, k)] : 0;
+                unsigned int e1 = y0 + 1 < rle.height ? rle.runStart[rle.scanline(y0 + 1, k) + 1] : 0;
+                int x0Pos = 0, x1Pos = 0;
+                int spanStart = 0, spanEnd = INT_MIN;
+                for(;;)
+                {
+                    int start, end;
+                    if (!nextStoredRun(rle, r0, e0, x0Pos, r1, e1, x1Pos, start, end))
+                        break;
+                    if (start - 1 <= spanEnd)
+                    {
+                        spanEnd = std::max(spanEnd, end);
+                        continue;
+                    }
+                    if (spanEnd != INT_MIN)
+                        samples += compositeSpan(spanStart, spanEnd, a, bx, fy, row0, row1, rowLinks, pixels, ratioRow);
+                    spanStart = start - 1;
+                    spanEnd = end;
+                }
+                if (spanEnd != INT_MIN)
+                    samples += compositeSpan(spanStart, spanEnd, a, bx, fy, row0, row1, rowLinks, pixels, ratioRow);
+            }
+        }
+        clearRows(cache);
+        return samples;
+    }
+
+    // The stored run with the smaller start of the two scanlines' next ones.
+    static bool nextStoredRun(const RunLengthVolume& rle, unsigned int& r0, unsigned int e0, int& x0, unsigned int& r1, unsigned int e1, int& x1, int& start, int& end)
+    {
+        //Runs come in (skipped, stored) pairs, empty stored runs end a scanline.
+        while (r0 < e0 && rle.runs[r0 + 1] == 0)
+        {
+            x0 += rle.runs[r0];
+            r0 += 2;
+        }
+        while (r1 < e1 && rle.runs[r1 + 1] == 0)
+        {
+            x1 += rle.runs[r1];
+            r1 += 2;
+        }
+        bool has0 = r0 < e0, has1 = r1 < e1;
+        if (!has0 && !has1)
+            return false;
+        bool first = has0 && (!has1 || x0 + rle.runs[r0] <= x1 + rle.runs[r1]);
+        unsigned int& r = first ? r0 : r1;
+        int& x = first ? x0 : x1;
+        start = x + rle.runs[r];
+        end = start + rle.runs[r + 1];
+        x = end;
+        r += 2;
+        return true;
+    }
+
+    // Samples intermediate pixels of one row whose slice position lies in [xStart, xEnd).
+    unsigned long long compositeSpan(int xStart, int xEnd, float a, float bx, float fy, const unsigned char* row0, const unsigned char* row1,
+                                     int* rowLinks, glm::vec4* pixels, float ratioRow)
+    {
+        const int W = frame.intermediateWidth;
+        const int lastX = encoded[frame.axis].width - 1;
+        int iStart = std::max(0, (int)ceilf((xStart - bx) / a));
+        int iEnd = std::min(W, (int)ceilf((xEnd - bx) / a));
+        unsigned long long samples = 0;
+        for(int i = findLink(rowLinks, iStart); i < iEnd; i = findLink(rowLinks, i + 1))
+        {
+            float x = a * i + bx;
+            //Rounding may put the ends of the span a hair outside the row.
+            int x0 = std::min(std::max((int)floorf(x), -1), lastX);
+            float fx = x - x0;
+            //Rows are offset by one for the border voxel.
+            float c0 = row0[x0 + 1] + (row0[x0 + 2] - row0[x0 + 1]) * fx;
+            float c1 = row1[x0 + 1] + (row1[x0 + 2] - row1[x0 + 1]) * fx;
+            glm::vec4 src = transferFunction.lookup((c0 + (c1 - c0) * fy) / 255.0f);
+            samples++;
+            if (src.a <= 0.0f)
+                continue;
+            glm::vec4& dst = pixels[i];
+            blendUnder(dst, correctOpacity(src, fabsf(frame.ratioPlane.x * i + ratioRow)));
+            if (dst.a >= opacityThreshold)
+                rowLinks[i] = i + 1;
+        }
+        return samples;
+    }
+
+    // Next pixel at or after i that is not opaque, compressing the path it followed.
+    static int findLink(int* rowLinks, int i)
+    {
+        int root = i;
+        while (rowLinks[root] != root)
+            root = rowLinks[root];
+        while (rowLinks[i] != root)
+        {
+            int next = rowLinks[i];
+            rowLinks[i] = root;
+            i = next;
+        }
+        return root;
+    }
+
+    // Scanline y of the cache's layer, zero outside the volume.
+    const unsigned char* decodeRow(RowCache& cache, int y)
+    {
+        for(int r = 0; r < 2; r++)
+            if (cache.row[r] == y)
+                return cache.rows[r].data();
+
+        //Replace the row the caller does not need any more: rows are asked for in increasing pairs.
+        int r = cache.row[0] < cache.row[1] ? 0 : 1;
+        clearRow(cache, r);
+        cache.row[r] = y;
+        const RunLengthVolume& rle = encoded[frame.axis];
+        if (y < 0 || y >= rle.height)
+            return cache.rows[r].data();
+
+        size_t line = rle.scanline(y, cache.layer);
+        const unsigned char* data = &rle.data[0] + rle.dataStart[line];
+        unsigned char* dst = cache.rows[r].data() + 1;
+        int x = 0;
+        for(unsigned int run = rle.runStart[line]; run < rle.runStart[line + 1]; run += 2)
+        {
+            x += rle.runs[run];
+            memcpy(dst + x, data, rle.runs[run + 1]);
+            data += rle.runs[run + 1];
+            x += rle.runs[run + 1];
+        }
+        return cache.rows[r].data();
+    }
+
+    void clearRow(RowCache& cache, int r)
+    {
+        const RunLengthVolume& rle = encoded[frame.axis];
+        int y = cache.row[r];
+        cache.row[r] = INT_MIN;
+        if (y < 0 || y >= rle.height || cache.layer < 0)
+            return;
+        size_t line = rle.scanline(y, cache.layer);
+        unsigned char* dst = cache.rows[r].data() + 1;
+        int x = 0;
+        for(unsigned int run = rle.runStart[line]; run < rle.runStart[line + 1]; run += 2)
+        {
+            x += rle.runs[run];
+            memset(dst + x, 0, rle.runs[run + 1]);
+            x += rle.runs[run + 1];
+        }
+    }
+
+    void clearRows(RowCache& cache)
+    {
+        clearRow(cache, 0);
+        clearRow(cache, 1);
+    }
+
+    // Final pixels of a tile: the pixel ray meets the base plane at the
+    // intermediate pixel that carries it, filtered bilinearly. Ray directions
+    // are linear along a row, so the map costs one division per pixel.
+    void warp(const WorkTile& tile, Image& image) const
+    {
+        const int W = frame.intermediateWidth, H = frame.intermediateHeight;
+        for(int py = tile.y0; py < tile.y1; py++)
+        {
+            glm::vec3 first = permutedRay(tile.x0, py, image), step = permutedRay(tile.x0 + 1, py, image) - first;
+            for(int px = tile.x0; px < tile.x1; px++)
+            {
+                glm::vec3 dir = first + (float)(px - tile.x0) * step;
+                glm::vec4 color(0.0f);
+                float t = (frame.k0 - frame.eye.z) / dir.z;
+                float u = (frame.eye.x + t * dir.x - frame.origin.x) * intermediateScale;
+                float v = (frame.eye.y + t * dir.y - frame.origin.y) * intermediateScale;
+                if (t > 0.0f && frame.k0 != frame.kEnd && u > -1.0f && v > -1.0f && u < W && v < H)
+                {
+                    int i0 = (int)floorf(u), j0 = (int)floorf(v);
+                    float fx = u - i0, fy = v - j0;
+                    auto texel = [&](int i, int j)
+                    {
+                        return i < 0 || j < 0 || i >= W || j >= H ? glm::vec4(0.0f) : intermediate[(size_t)j * W + i];
+                    };
+                    glm::vec4 c0 = glm::mix(texel(i0, j0), texel(i0 + 1, j0), fx);
+                    glm::vec4 c1 = glm::mix(texel(i0, j0 + 1), texel(i0 + 1, j0 + 1), fx);
+                    color = glm::mix(c0, c1, fy);
+                }
+                image.at(px, py) = color;
+            }
+        }
+    }
+
+    // Direction of the ray through a pixel in permuted voxel units.
+    glm::vec3 permutedRay(int px, int py, const Image& image) const
+    {
+        glm::vec3 worldDir = glm::mat3(frame.invView) * viewRayThroughPixel(px, py, image.width, image.height, frame.invProjection);
+        return glm::vec3(worldDir[frame.permutation.x], worldDir[frame.permutation.y], worldDir[frame.permutation.z]) * frame.voxelScale;
+    }
+};
+#endif
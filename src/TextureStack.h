@@ -0,0 +1,122 @@
+#ifndef TEXTURE_STACK_H
+#define TEXTURE_STACK_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <thread>
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "Volume.h"
+#include "TileScheduler.h"
+
+// Three object-aligned stacks of 2D slices, one perpendicular to each axis.
+// Rendering picks the stack whose slices face the viewer most and only needs
+// bilinear filtering of 2D textures, so it works for volumes beyond the 3D
+// texture size limit. Slice images are laid out as:
+//   x stack: layer x, image (y, z)
+//   y stack: layer y, image (x, z)
+//   z stack: layer z, image (x, y), which is the volume itself
+class TextureStacks
+{
+public:
+    static const int BLOCK_SIZE = 32; //transpose tile edge, 32x32 bytes stay in L1
+
+    const Volume& volume;
+    std::vector<unsigned char> xStack, yStack;
+
+    TextureStacks(const Volume& volume) : volume(volume)
+    {
+    }
+
+    // Transposes the volume into the x and y stacks, z slices are scheduled as
+    // (z, 1) tiles of the work-stealing TileScheduler.
+    void build(unsigned int threadCount = std::thread::hardware_concurrency(), SchedulerStats* stats = nullptr)
+    {
+        xStack.resize(volume.voxelCount());
+        yStack.resize(volume.voxelCount());
+        threadCount = std::max(1u, std::min(threadCount, (unsigned int)volume.depth));
+
+        TileScheduler scheduler(threadCount);
+        scheduler.run(volume.depth, 1, 1, 1, [this](const WorkTile& tile, unsigned int)
+        {
+            transposeSlab(tile.x0, tile.x1);
+        }, stats);
+    }
+
+    const unsigned char* stackData(int axis) const
+    {
+        if (axis == 0)
+            return xStack.data();
+        if (axis == 1)
+            return yStack.data();
+        return volume.data.data();
+    }
+
+    int layerCount(int axis) const
+    {
+        return axis == 0 ? volume.width : (axis == 1 ? volume.height : volume.depth);
+    }
+
+    int sliceWidth(int axis) const
+    {
+        return axis == 0 ? volume.height : volume.width;
+    }
+
+    int sliceHeight(int axis) const
+    {
+        return axis == 2 ? volume.height : volume.depth;
+    }
+
+    // Bytes of the three stacks together, the z stack shares the volume's layout.
+    size_t memoryFootprint() const
+    {
+        return volume.voxelCount() * 3;
+    }
+
+    // Axis whose slices face the camera most. ascending tells whether increasing layer
+    // order is back to front, i.e. the eye sits on the positive side of that axis.
+    static int dominantAxis(glm::mat4 view, bool& ascending)
+    {
+        glm::vec3 toEye(view[0][2], view[1][2], view[2][2]);
+        glm::vec3 a = glm::abs(toEye);
+        int axis = (a.x >= a.y && a.x >= a.z) ? 0 : (a.y >= a.z ? 1 : 2);
+        ascending = toEye[axis] > 0.0f;
+        return axis;
+    }
+
+private:
+    void transposeSlab(int zBegin, int zEnd)
+    {
+        const int W = volume.width, H = volume.height, D = volume.depth;
+        const unsigned char* src = volume.data.data();
+
+        for(int z = zBegin; z < zEnd; z++)
+        {
+            const unsigned char* slice = src + (size_t)z * W * H;
+
+            //y stack keeps x contiguous, every row moves as a whole.
+            for(int y = 0; y < H; y++)
+                memcpy(&yStack[((size_t)y * D + z) * W], slice + (size_t)y * W, W);
+
+            //x stack swaps x and y inside the slice, done in tiles so both sides stay cached.
+            for(int yb = 0; yb < H; yb += BLOCK_SIZE)
+            {
+                int yEnd = std::min(yb + BLOCK_SIZE, H);
+                for(int xb = 0; xb < W; xb += BLOCK_SIZE)
+                {
+                    int xEnd = std::min(xb + BLOCK_SIZE, W);
+                    for(int x = xb; x < xEnd; x++)
+                    {
+                        unsigned char* dst = &xStack[((size_t)x * D + z) * H];
+                        for(int y = yb; y < yEnd; y++)
+                            dst[y] = slice[(size_t)y * W + x];
+                    }
+                }
+            }
+        }
+    }
+};
+#endif
@@ -0,0 +1,215 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+
+// Rectangle [x0, x1) x [y0, y1) of a 2D index space: pixels for the renderers,
+// (slice, 1) ranges for volume passes.
+struct WorkTile
+{
+    int x0, y0, x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+};
+
+struct WorkerStats
+{
+    unsigned long long tiles = 0; //leaf tiles processed
+    unsigned long long splits = 0;
+    unsigned long long steals = 0; //tiles taken from another worker
+    unsigned long long failedSteals = 0; //rounds over all victims that found nothing
+    double busyMilliseconds = 0.0; //inside the tile function
+};
+
+struct SchedulerStats
+{
+    std::vector<WorkerStats> workers;
+    double wallMilliseconds = 0.0;
+
+    // Fraction of the workers' wall time spent on tiles.
+    double efficiency() const
+    {
+        double busy = 0.0;
+        for(size_t i = 0; i < workers.size(); i++)
+            busy += workers[i].busyMilliseconds;
+        return workers.empty() || wallMilliseconds <= 0.0 ? 0.0 : busy / (wallMilliseconds * workers.size());
+    }
+
+    unsigned long long steals() const
+    {
+        unsigned long long total = 0;
+        for(size_t i = 0; i < workers.size(); i++)
+            total += workers[i].steals;
+        return total;
+    }
+};
+
+// Work-stealing scheduler over a 2D index space. The whole space starts in the
+// first worker's deque. A worker pops the newest tile from the back of its own
+// deque and halves it along its longer side (in grain units) until it is one
+// grain, pushing the other halves back, so its deque holds ever larger pieces
+// towards the front. Idle workers steal from the front of a random victim and
+// therefore take the largest piece available, which they subdivide the same way.
+// Subdivision thus follows the actual cost of the image instead of a static split.
+// Each deque has its own lock; the owner and thieves only meet on the same
+// deque, so there is no global point of contention.
+class TileScheduler
+{
+public:
+    unsigned int threadCount;
+
+    TileScheduler(unsigned int threadCount = std::thread::hardware_concurrency())
+    {
+        this->threadCount = std::max(1u, threadCount);
+    }
+
+    // Calls process(tile, worker) for disjoint tiles covering [0, width) x [0, height),
+    // none larger than grainWidth x grainHeight. worker is in [0, threadCount) and lets
+    // callers keep per-worker accumulators without atomics. The calling thread is worker 0.
+    template <class Process>
+    void run(int width, int height, int grainWidth, int grainHeight, Process process, SchedulerStats* stats = nullptr)
+    {
+        auto start = std::chrono::high_resolution_clock::now();
+        grainWidth = std::max(1, grainWidth);
+        grainHeight = std::max(1, grainHeight);
+
+        std::vector<Worker> workers(threadCount);
+        std::atomic<long long> pending(0);
+        if (width > 0 && height > 0)
+        {
+            WorkTile all = {0, 0, width, height};
+            workers[0].tiles.push_back(all);
+            pending = 1;
+        }
+
+        auto loop = [&](unsigned int self)
+        {
+            Worker& worker = workers[self];
+            unsigned int random = 2654435761u * (self + 1);
+            WorkTile tile;
+            while (pending.load(std::memory_order_acquire) > 0)
+            {
+                if (!popBack(worker, tile) && !steal(workers, self, random, tile))
+                {
+                    std::this_thread::yield();
+                    continue;
+                }
+
+                WorkTile other;
+                while (split(tile, grainWidth, grainHeight, other))
+                {
+                    pending.fetch_add(1, std::memory_order_relaxed);
+                    pushBack(worker, other);
+                    worker.stats.splits++;
+                }
+
+                auto begin = std::chrono::high_resolution_clock::now();
+                process(tile, self);
+                worker.stats.busyMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - begin).count();
+                worker.stats.tiles++;
+                pending.fetch_sub(1, std::memory_order_release);
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for(unsigned int t = 1; t < threadCount; t++)
+            threads.push_back(std::thread(loop, t));
+        loop(0);
+        for(size_t t = 0; t < threads.size(); t++)
+            threads[t].join();
+
+        if (stats != nullptr)
+        {
+            stats->workers.resize(threadCount);
+            for(unsigned int t = 0; t < threadCount; t++)
+                stats->workers[t] = workers[t].stats;
+            stats->wallMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+    }
+
+private:
+    // Own cache lines, so neighbouring workers' locks and counters do not false share.
+    struct alignas(64) Worker
+    {
+        std::mutex lock;
+        std::deque<WorkTile> tiles;
+        WorkerStats stats;
+    };
+
+    static void pushBack(Worker& worker, const WorkTile& tile)
+    {
+        std::lock_guard<std::mutex> guard(worker.lock);
+        worker.tiles.push_back(tile);
+    }
+
+    static bool popBack(Worker& worker, WorkTile& tile)
+    {
+        std::lock_guard<std::mutex> guard(worker.lock);
+        if (worker.tiles.empty())
+            return false;
+        tile = worker.tiles.back();
+        worker.tiles.pop_back();
+        return true;
+    }
+
+    static bool steal(std::vector<Worker>& workers, unsigned int self, unsigned int& random, WorkTile& tile)
+    {
+        unsigned int count = (unsigned int)workers.size();
+        if (count < 2)
+            return false;
+
+        //xorshift picks where the round over the other workers starts.
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        unsigned int first = random % count;
+        for(unsigned int i = 0; i < count; i++)
+        {
+            unsigned int victim = (first + i) % count;
+            if (victim == self)
+                continue;
+            Worker& other = workers[victim];
+            std::unique_lock<std::mutex> guard(other.lock, std::try_to_lock);
+            if (!guard.owns_lock() || other.tiles.empty())
+                continue;
+            tile = other.tiles.front();
+            other.tiles.pop_front();
+            workers[self].stats.steals++;
+            return true;
+        }
+        workers[self].stats.failedSteals++;
+        return false;
+    }
+
+    // Halves tile along the side spanning more grains, keeping cuts on the grain grid.
+    static bool split(WorkTile& tile, int grainWidth, int grainHeight, WorkTile& other)
+    {
+        int grainsX = (tile.width() + grainWidth - 1) / grainWidth;
+        int grainsY = (tile.height() + grainHeight - 1) / grainHeight;
+        if (grainsX <= 1 && grainsY <= 1)
+            return false;
+
+        other = tile;
+        if (grainsX >= grainsY)
+        {
+            int cut = tile.x0 + grainsX / 2 * grainWidth;
+            tile.x1 = cut;
+            other.x0 = cut;
+        }
+        else
+        {
+            int cut = tile.y0 + grainsY / 2 * grainHeight;
+            tile.y1 = cut;
+            other.y0 = cut;
+        }
+        return true;
+    }
+};
+#endif
@@ -0,0 +1,271 @@
+#ifndef TRANSFER_FUNCTION_H
+#define TRANSFER_FUNCTION_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+
+// Control point of a transfer function: a voxel value in [0,255] and the
+// color and opacity it maps to, not premultiplied.
+struct TransferPoint
+{
+    float value;
+    glm::vec4 color;
+};
+
+// 1D transfer function from voxel value to premultiplied RGBA. The control
+// points are interpolated linearly into a table of SIZE entries, one per
+// 8-bit value; past the first and last point the table holds their colors.
+// The table is what every renderer samples: uploaded as the 1D texture
+// shader.fs reads with linear filtering, and read through lookup(), which
+// filters the same way, by the CPU renderers. A new one holds the grayscale
+// ramp.
+class TransferFunction
+{
+public:
+    static const int SIZE = 256;
+    std::vector<TransferPoint> points; //by rising value, set through setPoints()
+    std::vector<glm::vec4> table; //premultiplied RGBA per voxel value
+
+    TransferFunction()
+    {
+        setPoints(grayscale());
+    }
+
+    // Color and opacity both rise linearly from 0 to 1, which premultiplied is
+    // (a^2, a^2, a^2, a) like the original shader.
+    static std::vector<TransferPoint> grayscale()
+    {
+        return {{0.0f, glm::vec4(0.0f)}, {255.0f, glm::vec4(1.0f)}};
+    }
+
+    // Replaces the control points and rebuilds the table. first and last
+    // receive the range of table entries that changed, first > last if none,
+    // so a texture only needs those texels uploaded again.
+    void setPoints(std::vector<TransferPoint> newPoints, int* first = nullptr, int* last = nullptr)
+    {
+        std::stable_sort(newPoints.begin(), newPoints.end(), [](const TransferPoint& a, const TransferPoint& b) { return a.value < b.value; });
+        points = newPoints;
+
+        std::vector<glm::vec4> previous = table;
+        table.resize(SIZE);
+        for(int v = 0; v < SIZE; v++)
+        {
+            glm::vec4 color = evaluate((float)v);
+            table[v] = glm::vec4(glm::vec3(color) * color.a, color.a);
+        }
+
+        int changedFirst = SIZE, changedLast = -1;
+        for(int v = 0; v < SIZE; v++)
+        {
+            if (previous.size() == table.size() && previous[v] == table[v])
+                continue;
+            changedFirst = std::min(changedFirst, v);
+            changedLast = v;
+        }
+        if (first != nullptr)
+            *first = changedFirst;
+        if (last != nullptr)
+            *last = changedLast;
+    }
+
+    // Reads control points from a text file, one "value r g b a" per line
+    // with the value in [0,255] and the rest in [0,1]; '#' starts a comment.
+    // On failure nothing changes.
+    bool load(const std::string& path, int* first = nullptr, int* last = nullptr)
+    {
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == NULL)
+            return false;
+        std::vector<TransferPoint> loaded;
+        char line[256];
+        bool valid = true;
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            char* comment = strchr(line, '#');
+            if (comment != NULL)
+                *comment = '\0';
+            TransferPoint point;
+            int fields = sscanf(line, "%f %f %f %f %f", &point.value, &point.color.r, &point.color.g, &point.color.b, &point.color.a);
+            if (fields <= 0)
+                continue;
+            if (fields != 5)
+            {
+                valid = false;
+                break;
+            }
+            point.value = glm::clamp(point.value, 0.0f, 255.0f);
+            point.color = glm::clamp(point.color, 0.0f, 1.0f);
+            loaded.push_back(point);
+        }
+        fclose(fp);
+        if (!valid || loaded.empty())
+            return false;
+        setPoints(loaded, first, last);
+        return true;
+    }
+
+    // Premultiplied RGBA of a sample in [0,1], interpolated between the two
+    // nearest entries like the GL_LINEAR fetch at (value * 255 + 0.5) / SIZE.
+    glm::vec4 lookup(float value) const
+    {
+        float x = glm::clamp(value, 0.0f, 1.0f) * (SIZE - 1);
+        int i = std::min((int)x, SIZE - 2);
+        float f = x - i;
+        return table[i] + (table[i + 1] - table[i]) * f;
+    }
+
+    // Alpha per voxel value, what MinMaxGrid::classify() takes.
+    std::vector<float> opacity() const
+    {
+        std::vector<float> alpha(SIZE);
+        for(int v = 0; v < SIZE; v++)
+            alpha[v] = table[v].a;
+        return alpha;
+    }
+
+private:
+    glm::vec4 evaluate(float value) const
+    {
+        if (points.empty())
+            return glm::vec4(0.0f);
+        if (value <= points.front().value)
+            return points.front().color;
+        for(size_t i = 1; i < points.size(); i++)
+        {
+            if (value <= points[i].value)
+            {
+                const TransferPoint& a = points[i - 1];
+                const TransferPoint& b = points[i];
+                float t = b.value > a.value ? (value - a.value) / (b.value - a.value) : 1.0f;
+                return a.color + (b.color - a.color) * t;
+            }
+        }
+        return points.back().color;
+    }
+};
+
+// Region of a 2D transfer function: full color at value, falling off linearly
+// to nothing valueWidth / 2 either side, for gradient magnitudes in
+// [gradientMin, gradientMax]. Values and magnitudes in [0,255], color not
+// premultiplied.
+struct TransferWidget
+{
+    float value, valueWidth;
+    float gradientMin, gradientMax;
+    glm::vec4 color;
+};
+
+// 2D transfer function from (value, gradient magnitude) to premultiplied RGBA,
+// sampled into a SIZE x SIZE table with a row per magnitude (see
+// GradientMagnitude for its scale), uploaded as the 2D texture shader.fs
+// reads and filtered the same way by lookup(). Overlapping widgets add up,
+// alpha capped at 1. Boundaries between materials have high magnitudes at
+// values between theirs, which no 1D transfer function can single out.
+// A new one repeats the grayscale ramp for every magnitude.
+class TransferFunction2D
+{
+public:
+    static const int SIZE = TransferFunction::SIZE;
+    std::vector<TransferWidget> widgets; //set through setWidgets(), empty for a 1D function
+    std::vector<glm::vec4> table; //premultiplied RGBA, row by magnitude, column by value
+
+    TransferFunction2D()
+    {
+        setTransferFunction(TransferFunction());
+    }
+
+    // Every row the table of a 1D transfer function, whatever the magnitude.
+    void setTransferFunction(const TransferFunction& transferFunction)
+    {
+        widgets.clear();
+        table.resize((size_t)SIZE * SIZE);
+        for(int g = 0; g < SIZE; g++)
+            std::copy(transferFunction.table.begin(), transferFunction.table.end(), table.begin() + (size_t)g * SIZE);
+    }
+
+    void setWidgets(const std::vector<TransferWidget>& newWidgets)
+    {
+        widgets = newWidgets;
+        table.assign((size_t)SIZE * SIZE, glm::vec4(0.0f));
+        for(const TransferWidget& widget : widgets)
+        {
+            int g0 = std::max(0, (int)ceilf(widget.gradientMin)), g1 = std::min(SIZE - 1, (int)floorf(widget.gradientMax));
+            float halfWidth = std::max(widget.valueWidth * 0.5f, 1e-3f);
+            for(int v = std::max(0, (int)ceilf(widget.value - halfWidth)); v <= std::min(SIZE - 1, (int)floorf(widget.value + halfWidth)); v++)
+            {
+                float alpha = widget.color.a * std::max(0.0f, 1.0f - fabsf(v - widget.value) / halfWidth);
+                for(int g = g0; g <= g1; g++)
+                    table[(size_t)g * SIZE + v] += glm::vec4(glm::vec3(widget.color) * alpha, alpha);
+            }
+        }
+        for(glm::vec4& entry : table)
+            if (entry.a > 1.0f)
+                entry /= entry.a;
+    }
+
+    // Reads widgets from a text file, one "value width gradientMin gradientMax
+    // r g b a" per line; '#' starts a comment. On failure nothing changes.
+    bool load(const std::string& path)
+    {
+        FILE* fp = fopen(path.c_str(), "r");
+        if (fp == NULL)
+            return false;
+        std::vector<TransferWidget> loaded;
+        char line[256];
+        bool valid = true;
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            char* comment = strchr(line, '#');
+            if (comment != NULL)
+                *comment = '\0';
+            TransferWidget widget;
+            int fields = sscanf(line, "%f %f %f %f %f %f %f %f", &widget.value, &widget.valueWidth, &widget.gradientMin, &widget.gradientMax,
+                                &widget.color.r, &widget.color.g, &widget.color.b, &widget.color.a);
+            if (fields <= 0)
+                continue;
+            if (fields != 8)
+            {
+                valid = false;
+                break;
+            }
+            widget.color = glm::clamp(widget.color, 0.0f, 1.0f);
+            loaded.push_back(widget);
+        }
+        fclose(fp);
+        if (!valid || loaded.empty())
+            return false;
+        setWidgets(loaded);
+        return true;
+    }
+
+    // Premultiplied RGBA of a sample and its gradient magnitude, both in
+    // [0,1], bilinear between the entries like the GL_LINEAR fetch.
+    glm::vec4 lookup(float value, float magnitude) const
+    {
+        float x = glm::clamp(value, 0.0f, 1.0f) * (SIZE - 1), y = glm::clamp(magnitude, 0.0f, 1.0f) * (SIZE - 1);
+        int i = std::min((int)x, SIZE - 2), j = std::min((int)y, SIZE - 2);
+        float fx = x - i, fy = y - j;
+        const glm::vec4* row = &table[(size_t)j * SIZE + i];
+        glm::vec4 low = row[0] + (row[1] - row[0]) * fx;
+        glm::vec4 high = row[SIZE] + (row[SIZE + 1] - row[SIZE]) * fx;
+        return low + (high - low) * fy;
+    }
+
+    // Highest alpha of each value over all magnitudes, a value whose entry is
+    // 0 is transparent whatever its gradient; what MinMaxGrid::classify() takes.
+    std::vector<float> opacity() const
+    {
+        std::vector<float> alpha(SIZE, 0.0f);
+        for(int g = 0; g < SIZE; g++)
+            for(int v = 0; v < SIZE; v++)
+                alpha[v] = std::max(alpha[v], table[(size_t)g * SIZE + v].a);
+        return alpha;
+    }
+};
+#endif
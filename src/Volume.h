@@ -0,0 +1,248 @@
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+// How samples between voxels are reconstructed. Trilinear interpolation shows
+// the voxel grid as staircases where the data is magnified; the cubic
+// B-spline is smooth there, at the price of a slight blur, as it approximates
+// the voxels instead of passing through them.
+enum VolumeFilter
+{
+    FILTER_TRILINEAR = 0,
+    FILTER_CUBIC, //B-spline from 8 trilinear samples
+    FILTER_CUBIC_REFERENCE, //the same B-spline from its 64 voxels
+    FILTER_COUNT
+};
+
+inline const char* filterName(VolumeFilter filter)
+{
+    static const char* names[FILTER_COUNT] = {"trilinear", "cubic", "cubic-reference"};
+    return names[filter];
+}
+
+inline bool parseFilter(const char* name, VolumeFilter& filter)
+{
+    for(int i = 0; i < FILTER_COUNT; i++)
+    {
+        if (strcmp(name, filterName((VolumeFilter)i)) == 0)
+        {
+            filter = (VolumeFilter)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Uniform cubic B-spline weights of voxels i - 1 to i + 2 for a sample the
+// fraction a of the way from voxel i to i + 1.
+inline glm::vec4 cubicWeights(float a)
+{
+    float b = 1.0f - a, a2 = a * a, a3 = a2 * a;
+    return glm::vec4(b * b * b / 6.0f, 0.5f * a3 - a2 + 2.0f / 3.0f, -0.5f * a3 + 0.5f * a2 + 0.5f * a + 1.0f / 6.0f, a3 / 6.0f);
+}
+
+// Sigg and Hadwiger's fast B-spline: the weights pair up, so one linear
+// sample at i + h0 between voxels i - 1 and i carries g0 = w0 + w1 and one at
+// i + h1 between i + 1 and i + 2 the remaining 1 - g0. Returns (h0, h1, g0),
+// the table shader.fs reads.
+inline glm::vec3 cubicOffsets(float a)
+{
+    glm::vec4 w = cubicWeights(a);
+    float g0 = w.x + w.y;
+    return glm::vec3(w.y / g0 - 1.0f, w.w / (1.0f - g0) + 1.0f, g0);
+}
+
+// 8-bit scalar field kept in system memory so that CPU side passes can sample
+// exactly what is uploaded to texture1.
+class Volume
+{
+public:
+    int width, height, depth;
+    std::vector<unsigned char> data;
+
+    Volume(int width, int height, int depth)
+    {
+        this->width = width;
+        this->height = height;
+        this->depth = depth;
+        data.resize((size_t)width * height * depth, 0);
+    }
+
+    bool load(const char* path)
+    {
+        FILE* fp = fopen(path, "rb");
+        if (fp == NULL)
+            return false;
+        size_t count = fread(data.data(), sizeof(unsigned char), data.size(), fp);
+        fclose(fp);
+        return count == data.size();
+    }
+
+    // Synthetic sparse test data: blobCount soft spheres of random position and
+    // radius in an otherwise empty grid, the same seed gives the same volume.
+    void fillSparse(int blobCount, unsigned int seed = 1)
+    {
+        std::fill(data.begin(), data.end(), 0);
+        unsigned int state = seed;
+        auto random = [&state]()
+        {
+            state = state * 1664525u + 1013904223u;
+            return (state >> 8) / 16777216.0f;
+        };
+
+        int size = std::min(width, std::min(height, depth));
+        for(int b = 0; b < blobCount; b++)
+        {
+            glm::vec3 center(random() * width, random() * height, random() * depth);
+            float radius = (0.02f + 0.06f * random()) * size;
+            float peak = 128.0f + 127.0f * random();
+            glm::ivec3 lo = glm::max(glm::ivec3(center - radius), glm::ivec3(0));
+            glm::ivec3 hi = glm::min(glm::ivec3(center + radius), glm::ivec3(width - 1, height - 1, depth - 1));
+            for(int z = lo.z; z <= hi.z; z++)
+            {
+                for(int y = lo.y; y <= hi.y; y++)
+                {
+                    for(int x = lo.x; x <= hi.x; x++)
+                    {
+                        float d = glm::length(glm::vec3(x, y, z) - center) / radius;
+                        if (d >= 1.0f)
+                            continue;
+                        unsigned char& v = data[((size_t)z * height + y) * width + x];
+                        v = std::max(v, (unsigned char)(peak * (1.0f - d * d)));
+                    }
+                }
+            }
+        }
+    }
+
+    // The mean of every factor^3 block of voxels, partial blocks at the far
+    // edges averaging what they hold; the grid covers the same extent.
+    Volume downsampled(int factor) const
+    {
+        factor = std::max(factor, 1);
+        Volume coarse((width + factor - 1) / factor, (height + factor - 1) / factor, (depth + factor - 1) / factor);
+        for(int z = 0; z < coarse.depth; z++)
+        {
+            for(int y = 0; y < coarse.height; y++)
+            {
+                for(int x = 0; x < coarse.width; x++)
+                {
+                    unsigned int sum = 0, count = 0;
+                    for(int vz = z * factor; vz < std::min((z + 1) * factor, depth); vz++)
+                        for(int vy = y * factor; vy < std::min((y + 1) * factor, height); vy++)
+                            for(int vx = x * factor; vx < std::min((x + 1) * factor, width); vx++, count++)
+                                sum += data[((size_t)vz * height + vy) * width + vx];
+                    coarse.data[((size_t)z * coarse.height + y) * coarse.width + x] = (unsigned char)((sum + count / 2) / count);
+                }
+            }
+        }
+        return coarse;
+    }
+
+    size_t voxelCount() const
+    {
+        return data.size();
+    }
+
+    // Voxels outside the grid read as the border color (0) like GL_CLAMP_TO_BORDER.
+    unsigned char voxel(int x, int y, int z) const
+    {
+        if (x < 0 || y < 0 || z < 0 || x >= width || y >= height || z >= depth)
+            return 0;
+        return data[((size_t)z * height + y) * width + x];
+    }
+
+    // Trilinear sample in [0,1], matching GL_LINEAR filtering of texture1.
+    float sample(glm::vec3 texCoord) const
+    {
+        float u = texCoord.x * width - 0.5f;
+        float v = texCoord.y * height - 0.5f;
+        float w = texCoord.z * depth - 0.5f;
+
+        int x0 = (int)floorf(u);
+        int y0 = (int)floorf(v);
+        int z0 = (int)floorf(w);
+        float fx = u - x0;
+        float fy = v - y0;
+        float fz = w - z0;
+
+        float c00 = voxel(x0, y0, z0) * (1 - fx) + voxel(x0 + 1, y0, z0) * fx;
+        float c10 = voxel(x0, y0 + 1, z0) * (1 - fx) + voxel(x0 + 1, y0 + 1, z0) * fx;
+        float c01 = voxel(x0, y0, z0 + 1) * (1 - fx) + voxel(x0 + 1, y0, z0 + 1) * fx;
+        float c11 = voxel(x0, y0 + 1, z0 + 1) * (1 - fx) + voxel(x0 + 1, y0 + 1, z0 + 1) * fx;
+
+        float c0 = c00 * (1 - fy) + c10 * fy;
+        float c1 = c01 * (1 - fy) + c11 * fy;
+
+        return (c0 * (1 - fz) + c1 * fz) / 255.0f;
+    }
+
+    // Cubic B-spline in [0,1] from eight sample() calls at the corners that
+    // cubicOffsets() gives along each axis, what shader.fs does with eight
+    // GL_LINEAR fetches instead of 64.
+    float sampleCubic(glm::vec3 texCoord) const
+    {
+        glm::vec3 size(width, height, depth);
+        glm::vec3 u = texCoord * size - 0.5f, i = glm::floor(u), a = u - i;
+        glm::vec3 x = cubicOffsets(a.x), y = cubicOffsets(a.y), z = cubicOffsets(a.z);
+        glm::vec3 p0 = (i + glm::vec3(x.x, y.x, z.x) + 0.5f) / size, p1 = (i + glm::vec3(x.y, y.y, z.y) + 0.5f) / size;
+        glm::vec3 g0(x.z, y.z, z.z);
+
+        float c00 = sample(glm::vec3(p1.x, p0.y, p0.z)) + (sample(glm::vec3(p0.x, p0.y, p0.z)) - sample(glm::vec3(p1.x, p0.y, p0.z))) * g0.x;
+        float c10 = sample(glm::vec3(p1.x, p1.y, p0.z)) + (sample(glm::vec3(p0.x, p1.y, p0.z)) - sample(glm::vec3(p1.x, p1.y, p0.z))) * g0.x;
+        float c01 = sample(glm::vec3(p1.x, p0.y, p1.z)) + (sample(glm::vec3(p0.x, p0.y, p1.z)) - sample(glm::vec3(p1.x, p0.y, p1.z))) * g0.x;
+        float c11 = sample(glm::vec3(p1.x, p1.y, p1.z)) + (sample(glm::vec3(p0.x, p1.y, p1.z)) - sample(glm::vec3(p1.x, p1.y, p1.z))) * g0.x;
+        float c0 = c10 + (c00 - c10) * g0.y;
+        float c1 = c11 + (c01 - c11) * g0.y;
+        return c1 + (c0 - c1) * g0.z;
+    }
+
+    // The same B-spline straight from the 64 voxels it weighs.
+    float sampleCubicReference(glm::vec3 texCoord) const
+    {
+        glm::vec3 u = texCoord * glm::vec3(width, height, depth) - 0.5f, i = glm::floor(u), a = u - i;
+        glm::vec4 wx = cubicWeights(a.x), wy = cubicWeights(a.y), wz = cubicWeights(a.z);
+        int x0 = (int)i.x - 1, y0 = (int)i.y - 1, z0 = (int)i.z - 1;
+        float total = 0.0f;
+        for(int z = 0; z < 4; z++)
+        {
+            for(int y = 0; y < 4; y++)
+            {
+                float row = 0.0f;
+                for(int x = 0; x < 4; x++)
+                    row += wx[x] * voxel(x0 + x, y0 + y, z0 + z);
+                total += wz[z] * wy[y] * row;
+            }
+        }
+        return total / 255.0f;
+    }
+
+    float sample(glm::vec3 texCoord, VolumeFilter filter) const
+    {
+        if (filter == FILTER_CUBIC)
+            return sampleCubic(texCoord);
+        if (filter == FILTER_CUBIC_REFERENCE)
+            return sampleCubicReference(texCoord);
+        return sample(texCoord);
+    }
+
+    // Central differences of sample() one voxel apart, per unit of texture
+    // coordinate. Texture and world space differ by a uniform scale, so this
+    // points the way of the world space gradient.
+    glm::vec3 gradient(glm::vec3 texCoord) const
+    {
+        glm::vec3 h(1.0f / width, 1.0f / height, 1.0f / depth);
+        return glm::vec3(
+            sample(texCoord + glm::vec3(h.x, 0.0f, 0.0f)) - sample(texCoord - glm::vec3(h.x, 0.0f, 0.0f)),
+            sample(texCoord + glm::vec3(0.0f, h.y, 0.0f)) - sample(texCoord - glm::vec3(0.0f, h.y, 0.0f)),
+            sample(texCoord + glm::vec3(0.0f, 0.0f, h.z)) - sample(texCoord - glm::vec3(0.0f, 0.0f, h.z))) / (2.0f * h);
+    }
+};
+#endif
@@ -4,6 +4,9 @@
 #include <vector>
 #include <utility> 
 #include <limits>
+#include <chrono>
+#include <string>
+#include <cstdlib>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -15,6 +18,20 @@
 
 #include "Shader.h"
 #include "Camera.h"
+#include "Volume.h"
+#include "Compositor.h"
+#include "ProxyGeometry.h"
+#include "Clipper.h"
+#include "TextureStack.h"
+#include "RayCaster.h"
+#include "ShearWarp.h"
+#include "ProgressiveRenderer.h"
+#include "ReprojectionCache.h"
+#include "GradientMagnitude.h"
+#include "AutoTransfer.h"
+#include "AmbientOcclusion.h"
+#include "LabelVolume.h"
+#include "FusedVolume.h"
 
 //TODO: Pseudo angles for sorting polygon vertices.
 //TODO: Use constant number of slices instead of zValue += 0.005f
@@ -26,6 +43,12 @@
 #define DATA_HEIGHT 256
 #define DATA_DEPTH 256
 #define DATA_FILE "./resources/data/brain256.raw"
+#define TRANSFER_FILE "./resources/transfer/brain.tf"
+#define TRANSFER_FILE_2D "./resources/transfer/brain.tf2"
+#define LABEL_STYLE_FILE "./resources/transfer/brain.labels"
+#define LABEL_BANDS 4
+#define FUSED_TRANSFER_FILE "./resources/transfer/edges.tf"
+#define FUSED_DOWNSAMPLE 2
 
 using namespace std;
 
@@ -51,8 +74,65 @@ public:
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void processInput(GLFWwindow *window);
+int runHeadless(int argc, char** argv);
+void printSchedulerStats(const SchedulerStats& stats, bool perWorker);
+void benchmarkSimd(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkSkipping(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkAdaptive(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkProjection(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkPreIntegration(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkGradient(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkClassification(RayCaster& rayCaster);
+void benchmarkAutoTransfer(RayCaster& rayCaster);
+void benchmarkShading(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkOcclusion(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkCubic(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkLabels(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkFusion(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height);
+void benchmarkShearWarp(RayCaster& rayCaster, ShearWarpRenderer& shearWarp, glm::mat4 view, glm::mat4 projection, int width, int height);
+void renderProgressive(RayCaster& rayCaster, glm::mat4 projection, float budget, Image& image);
+void renderOrbit(RayCaster& rayCaster, glm::mat4 projection, int frames, Image& image);
 void calculatePlanes();
+void createAccumulationBuffer(int width, int height);
+void createProxyGeometry(Shader& proxyShader);
+void setProxyBox(glm::vec3 boxMin, glm::vec3 boxMax);
+void setProxyTables(Shader& shader);
+void setProxyUniforms(Shader& proxyShader, glm::mat4 view);
+void drawSlices(Shader& sliceShader, unsigned int first, unsigned int last);
+void drawSlicesFrontToBack(Shader& sliceShader, Shader& maskShader);
+void drawSlicesProjection(Shader& sliceShader);
+void resolveProjection(Shader& resolveShader);
+void createBrickTexture(const MinMaxGrid& grid);
+void createTransferTexture();
+void updateTransferTexture(int first, int last);
+void setPreviousSliceUniforms(Shader& sliceShader, glm::mat4 view);
+void setIsosurfaceUniforms(Shader& sliceShader, glm::mat4 view);
+void createPreIntegrationTexture();
+void updatePreIntegration(Shader& sliceShader);
+void createTransferTexture2D();
+void createNormalTexture();
+void uploadMagnitudes(unsigned int texture1, const GradientMagnitude& gradient);
+void createNormalVolumeTexture(GradientMagnitude& gradient);
+void createOcclusionTexture(const AmbientOcclusion& occlusion);
+void updateOcclusion(Shader& sliceShader, AmbientOcclusion& occlusion);
+void createCubicTexture();
+void createLabelTextures();
+void updateLabelTable(int label);
+void createFusedTextures(const FusedVolume& fused);
+void updateOpacityMask(Shader& maskShader);
+void createLightBuffer();
+void drawSlicesHalfAngle(Shader& eyeShader, Shader& lightShader, glm::mat4 view);
+void benchmarkHalfAngle(Shader& proxyShader, Shader& eyeShader, Shader& lightShader, glm::mat4 view);
+void createTextureStacks(const Volume& volume);
+void drawTextureStack(Shader& stackShader, glm::mat4 view);
+void benchmarkTextureStack(Shader& proxyShader, Shader& stackShader, glm::mat4 view);
+void validateFrame(const Volume& volume, glm::mat4 projection, unsigned long long gpuFragments);
+float proxyDeviation();
+void validateProxyGeometry();
+bool validateProxyViews(float tolerance);
+void benchmarkClipping(Shader& sliceShader);
 float pseudoAngle(glm::vec3 p1, glm::vec3 p2);
 float positiveAngle(glm::vec3 vec);
 
@@ -60,6 +140,12 @@ float positiveAngle(glm::vec3 vec);
 const unsigned int WINDOW_WIDTH = 800;
 const unsigned int WINDOW_HEIGHT = 600;
 
+// projection
+const float FIELD_OF_VIEW = 0.78f;
+const float NEAR_PLANE = 0.1f;
+const float FAR_PLANE = 100.0f;
+glm::mat4 projection = glm::perspective(FIELD_OF_VIEW, (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, NEAR_PLANE, FAR_PLANE);
+
 // camera
 glm::vec3 camPos =  glm::vec3(0.25f, 0.25f, 2.0f);
 glm::vec3 center = glm::vec3(0.25f, 0.25f, 0.25f);
@@ -73,7 +159,99 @@ bool firstMouse = true;
 float deltaTime = 0.0f; // time between current frame and last frame
 float lastFrame = 0.0f;
 
+// slicing
+const float BASE_SLICE_SPACING = 0.005f; //the spacing transfer function opacities are meant for
+const float MAX_SLICE_SPACING = 8 * BASE_SLICE_SPACING;
+float sliceSpacing = BASE_SLICE_SPACING; //doubled and halved with . and ,
+bool frontToBack = false;
+const float OPACITY_THRESHOLD = 0.95f;
+const int MASK_UPDATE_INTERVAL = 16; //slices drawn between two opacity mask updates
+ProjectionMode projectionMode = PROJECTION_COMPOSITE;
+float isoValue = 0.3f;
+const float ISO_VALUE_SPEED = 0.2f; //change per second while -/= is held
+unsigned int brickTexture = 0; //min-max bricks the isosurface mode skips fragments with
+
+// transfer function, a 1D texture on unit 5 that every slice shader classifies with
+TransferFunction transferFunction;
+unsigned int transferTexture = 0;
+const float TRANSFER_SHIFT = 4.0f; //voxel values the control points move per [ or ] press
+
+// pre-integrated classification, a 2D texture on unit 6 indexed by the values on two consecutive slices
+bool preIntegrated = false;
+PreIntegrationTable preIntegration;
+unsigned int preIntegrationTexture = 0;
+
+// 2D transfer function over value and gradient magnitude, a 2D texture on unit 7;
+// the magnitudes become texture1's second channel the first time something reads them
+bool gradientClassification = false;
+bool magnitudesUploaded = false;
+TransferFunction2D transferFunction2D;
+unsigned int transferTexture2D = 0;
+
+// starting transfer functions found in the value and gradient magnitude histograms
+AutoTransfer autoTransfer;
+
+// composited slices lit by gradients of six fetches or by quantized normals, an RG8 3D
+// texture on unit 15 built when first chosen and decoded through a 2D texture on unit 8
+ShadingMode shadingMode = SHADING_NONE;
+unsigned int normalTexture = 0, normalVolumeTexture = 0;
+
+// composited slices dimmed by the visibility of a precomputed ambient occlusion volume,
+// a 3D texture on unit 9 updated where the transfer function changed it
+bool ambientOcclusion = false;
+unsigned int occlusionTexture = 0;
+
+// composited and projected slices reconstruct the volume with a cubic B-spline from eight
+// trilinear fetches, their offsets and weights read from a 1D table on unit 10
+bool cubicFiltering = false;
+unsigned int cubicTexture = 0;
+
+// composited slices tinted, faded or hidden per label of a segmentation, read nearest
+// from an integer 3D texture on unit 11 with the label styles in a table on unit 12;
+// neither exists when the volume is past the 3D texture limit
+bool labelsEnabled = false;
+LabelVolume labels(DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH);
+int selectedLabel = 1;
+unsigned int labelTexture = 0, labelTableTexture = 0;
+
+// a second co-registered volume composited with texture1 fragment by fragment, a 3D texture
+// of its own size on unit 13 classified by its own transfer function on unit 14; the slices
+// then cut the box of both
+bool fusionEnabled = false;
+FusionOperator fusionOperator = FUSION_OVER;
+unsigned int fusedTexture = 0, fusedTransferTexture = 0;
+bool validateRequested = false;
+bool benchmarkRequested = false;
+
+// CPU slice polygons are clipped to the view frustum, slices outside of it are dropped
+bool frustumClipping = true;
+ClipStats clipStats;
+
+// offscreen accumulation buffer, its alpha drives early termination
+int framebufferWidth = WINDOW_WIDTH;
+int framebufferHeight = WINDOW_HEIGHT;
+unsigned int accumFBO = 0, accumTexture = 0, accumRBO = 0;
+
 vector<Vertex> vertexBuffer;
+vector<unsigned int> sliceStarts; //first vertex of each slice in vertexBuffer
+vector<float> sliceDepths; //view space z of each slice, in draw order
+unsigned int VBO = 0, VAO = 0;
+
+// slice polygons generated in proxy.vs instead of calculatePlanes()
+bool gpuProxy = false;
+unsigned int proxyVAO = 0, proxyEBO = 0;
+
+// half-angle slicing, the light buffer collects opacity as seen from a directional light
+bool halfAngle = false;
+glm::vec3 lightDirection = glm::normalize(glm::vec3(-1.0f, 1.0f, 1.0f)); //towards the light, world space
+const int LIGHT_BUFFER_SIZE = 512;
+unsigned int lightFBO = 0, lightTexture = 0;
+
+// object-aligned 2D texture stacks, for volumes past the 3D texture limit
+bool textureStacks = false;
+bool textureStacksForced = false; //the volume exceeds GL_MAX_3D_TEXTURE_SIZE, texture1 has no storage
+bool stacksCreated = false;
+unsigned int stackTextures[3] = {0, 0, 0};
 
 glm::vec3 worldSpaceCubeVertices[] = 
 {
@@ -119,8 +297,15 @@ pair<int, int> edges[] =
     pair<int, int> (3,7)
 };
 
-int main(void)
+SliceProxy sliceProxy(worldSpaceCubeVertices);
+
+int main(int argc, char** argv)
 {
+    //Batch renders never create a window, so they run on machines without a display or GPU.
+    for(int i = 1; i < argc; i++)
+        if (string(argv[i]) == "--headless" || string(argv[i]) == "--validate-proxy")
+            return runHeadless(argc, argv);
+
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 4);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 5);
@@ -135,6 +320,7 @@ int main(void)
     glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
     glfwSetCursorPosCallback(window, mouse_callback);
     glfwSetScrollCallback(window, scroll_callback);
+    glfwSetKeyCallback(window, key_callback);
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
     if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)){
         std::cout << "Failed to initialize GLAD" << std::endl;
@@ -143,21 +329,27 @@ int main(void)
 
     
     //Read texture from file
-    unsigned char* AMPLITUDES = new unsigned char[DATA_WIDTH * DATA_HEIGHT * DATA_DEPTH];
-    FILE* fp = fopen(DATA_FILE, "r");
-    fread(AMPLITUDES , sizeof(unsigned char), DATA_WIDTH * DATA_HEIGHT * DATA_DEPTH, fp);
-    fclose (fp);
+    Volume volume(DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH);
+    if (!volume.load(DATA_FILE))
+        std::cout << "Failed to read " << DATA_FILE << std::endl;
 
     // configure global opengl state
     // -----------------------------
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     // build and compile the shader zprogram
     Shader theShader("./resources/shaders/shader.vs", "./resources/shaders/shader.fs");
+    Shader maskShader("./resources/shaders/mask.vs", "./resources/shaders/mask.fs");
+    Shader proxyShader("./resources/shaders/proxy.vs", "./resources/shaders/shader.fs");
+    Shader eyeShader("./resources/shaders/proxy.vs", "./resources/shaders/halfangle.fs");
+    Shader lightShader("./resources/shaders/proxy.vs", "./resources/shaders/light.fs");
+    Shader stackShader("./resources/shaders/stack.vs", "./resources/shaders/stack.fs");
+    Shader resolveShader("./resources/shaders/mask.vs", "./resources/shaders/projection.fs");
+
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    createAccumulationBuffer(framebufferWidth, framebufferHeight);
 
-    unsigned int VBO, VAO;
     glGenVertexArrays(1, &VAO);
     glGenBuffers(1, &VBO);
 
@@ -174,6 +366,20 @@ int main(void)
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
 
+    createProxyGeometry(proxyShader);
+    setProxyTables(eyeShader);
+    setProxyTables(lightShader);
+    createLightBuffer();
+
+    //The histograms need the magnitudes right away, the normals wait for precomputed shading.
+    GradientMagnitude gradient(volume);
+    gradient.build();
+    std::cout << "gradient magnitudes computed in " << gradient.milliseconds << " ms" << std::endl;
+    VolumeHistogram histogram;
+    histogram.build(volume, &gradient.magnitude);
+    autoTransfer.analyze(histogram);
+    std::cout << "histograms in " << histogram.milliseconds << " ms, automatic transfer function in " << autoTransfer.milliseconds << " ms" << std::endl;
+
     // load and create a texture
     unsigned int texture1;
 
@@ -187,7 +393,60 @@ int main(void)
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);//trilinear filtering
     glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);//trilinear filtering
 
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED, DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH, 0, GL_RED, GL_UNSIGNED_BYTE, AMPLITUDES);
+    GLint max3DTextureSize = 0;
+    glGetIntegerv(GL_MAX_3D_TEXTURE_SIZE, &max3DTextureSize);
+    if (DATA_WIDTH <= max3DTextureSize && DATA_HEIGHT <= max3DTextureSize && DATA_DEPTH <= max3DTextureSize)
+    {
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH, 0, GL_RED, GL_UNSIGNED_BYTE, volume.data.data());
+    }
+    else
+    {
+        std::cout << "Volume exceeds GL_MAX_3D_TEXTURE_SIZE (" << max3DTextureSize << "), using 2D texture stacks" << std::endl;
+        textureStacks = true;
+        textureStacksForced = true;
+    }
+
+    //Built once, the iso-value can change every frame without touching it.
+    MinMaxGrid brickGrid(volume);
+    brickGrid.build();
+    createBrickTexture(brickGrid);
+
+    //Edits only upload the changed texels, neither the shaders nor the volume are touched.
+    createTransferTexture();
+    createPreIntegrationTexture();
+    createTransferTexture2D();
+    createNormalTexture();
+    Shader* classifyingShaders[] = {&theShader, &proxyShader, &eyeShader, &lightShader, &stackShader};
+    for(Shader* shader : classifyingShaders)
+    {
+        shader->use();
+        shader->setInt("transferFunction", 5);
+        shader->setInt("transferFunction2D", 7);
+        shader->setInt("normalTable", 8);
+        shader->setInt("normalVolume", 15);
+    }
+
+    //Computed the first time it is switched on, after that only around what an edit changed.
+    AmbientOcclusion occlusion(volume);
+    createOcclusionTexture(occlusion);
+    createCubicTexture();
+
+    //No segmentation comes with the data, bands of its values stand in for one. It is
+    //as large as the volume, so it has no texture either when only the stacks have.
+    labels.segmentByValue(volume, LABEL_BANDS);
+    if (!labels.loadStyles(LABEL_STYLE_FILE))
+        std::cout << "Failed to read " << LABEL_STYLE_FILE << std::endl;
+    if (!textureStacksForced)
+        createLabelTextures();
+
+    //A field derived from the data stands in for a second modality: its gradient
+    //magnitudes at a lower resolution, over the same box.
+    Volume edges = gradient.magnitude.downsampled(FUSED_DOWNSAMPLE);
+    FusedVolume fused(edges);
+    if (!fused.transferFunction.load(FUSED_TRANSFER_FILE))
+        std::cout << "Failed to read " << FUSED_TRANSFER_FILE << std::endl;
+    createFusedTextures(fused);
 
     glEnable(GL_TEXTURE_3D);
     //glGenerateMipmap(GL_TEXTURE_3D);//TODO: mipmap gerekli mi?
@@ -199,22 +458,166 @@ int main(void)
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         processInput(window);
-        calculatePlanes();
 
-        // render
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT); 
-        theShader.use();
+        glm::mat4 view = camera.GetViewMatrix();
+        //Composited 3D texture slices fuse, the proxy box follows.
+        bool fusing = fusionEnabled && projectionMode == PROJECTION_COMPOSITE && !halfAngle && !textureStacks;
+        fused.op = fusionOperator;
+        glm::vec3 boxMin(-0.5f), boxMax(0.5f);
+        if (fusing)
+            fused.proxyBounds(glm::ivec3(DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH), boxMin, boxMax);
+        if (boxMin != worldSpaceCubeVertices[0] || boxMax != worldSpaceCubeVertices[7])
+        {
+            setProxyBox(boxMin, boxMax);
+            setProxyTables(proxyShader);
+            setProxyTables(eyeShader);
+            setProxyTables(lightShader);
+        }
+        if (gpuProxy || halfAngle)
+        {
+            sliceProxy.update(view, sliceSpacing, frontToBack);
+            sliceDepths.resize(sliceProxy.sliceCount);
+            for(int i = 0; i < sliceProxy.sliceCount; i++)
+                sliceDepths[i] = sliceProxy.sliceDepth(i);
+        }
+        else
+        {
+            calculatePlanes();
+        }
 
-        glm::mat4 projection = glm::perspective(0.78f, (float)WINDOW_WIDTH / (float)WINDOW_HEIGHT, 0.1f, 100.0f);
-        theShader.setMat4("projection", projection);
+        // render into the accumulation buffer, blitted to the window below
+        glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+        //Front-to-back needs zero destination alpha to start the under operator.
+        glClearColor(0.0f, 0.0f, 0.0f, (frontToBack || halfAngle) ? 0.0f : 1.0f);
+        //The projections count the slices that reached a pixel in alpha, a minimum starts at white.
+        //The isosurface is opaque and goes through the usual compositing.
+        bool isosurface = projectionMode == PROJECTION_ISOSURFACE && !halfAngle && !textureStacks;
+        bool projecting = projectionMode != PROJECTION_COMPOSITE && !isosurface && !halfAngle && !textureStacks;
+        if (projecting)
+        {
+            float start = projectionMode == PROJECTION_MINIMUM ? 1.0f : 0.0f;
+            glClearColor(start, start, start, 0.0f);
+        }
+        glClearStencil(0);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT); 
+        Shader& sliceShader = gpuProxy ? proxyShader : theShader;
+        sliceShader.use();
+
+        sliceShader.setMat4("projection", projection);
+        sliceShader.setInt("projectionMode", (projecting || isosurface) ? projectionMode : PROJECTION_COMPOSITE);
+        sliceShader.setFloat("opacityExponent", sliceSpacing / BASE_SLICE_SPACING);
+        if (isosurface)
+            setIsosurfaceUniforms(sliceShader, view);
+        sliceShader.setBool("gradientClassification", gradientClassification && !isosurface && !projecting);
+        sliceShader.setInt("shadingMode", isosurface || projecting ? SHADING_NONE : shadingMode);
+        if (shadingMode != SHADING_NONE && !isosurface && !projecting)
+            setPreviousSliceUniforms(sliceShader, view);
+        sliceShader.setBool("preIntegrated", preIntegrated && !gradientClassification && !isosurface && !projecting);
+        if (preIntegrated && !gradientClassification && !isosurface && !projecting)
+        {
+            setPreviousSliceUniforms(sliceShader, view);
+            updatePreIntegration(sliceShader);
+        }
+        sliceShader.setBool("ambientOcclusion", ambientOcclusion && !isosurface && !projecting);
+        if (ambientOcclusion && !isosurface && !projecting)
+            updateOcclusion(sliceShader, occlusion);
+        sliceShader.setBool("cubicFiltering", cubicFiltering && !isosurface);
+        sliceShader.setInt("cubicOffsets", 10);
+        sliceShader.setBool("labeled", labelsEnabled && !isosurface && !projecting);
+        sliceShader.setInt("labelVolume", 11);
+        sliceShader.setInt("labelTable", 12);
+        sliceShader.setBool("fused", fusing);
+        sliceShader.setInt("fusedVolume", 13);
+        sliceShader.setInt("fusedTransfer", 14);
+        sliceShader.setMat4("fusedFromTexCoord", fused.texFromWorld * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f)));
+        sliceShader.setInt("fusionOperator", fused.op);
+        sliceShader.setFloat("fusionWeight", fused.weight);
 
         // render boxes
-        glBindVertexArray(VAO);
+        if (gpuProxy)
+        {
+            setProxyUniforms(proxyShader, view);
+        }
+        else
+        {
+            glBindVertexArray(VAO);
+            glBindBuffer(GL_ARRAY_BUFFER, VBO);
+            glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(Vertex), vertexBuffer.data(), GL_DYNAMIC_DRAW);
+        }
 
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(Vertex), &vertexBuffer[0], GL_DYNAMIC_DRAW);
-        glDrawArrays(GL_TRIANGLES, 0, vertexBuffer.size());
+        if (textureStacks && !stacksCreated)
+            createTextureStacks(volume);
+        if (!textureStacksForced && !magnitudesUploaded && (gradientClassification || shadingMode == SHADING_PRECOMPUTED))
+            uploadMagnitudes(texture1, gradient);
+        if (!textureStacksForced && normalVolumeTexture == 0 && shadingMode == SHADING_PRECOMPUTED)
+            createNormalVolumeTexture(gradient);
+
+        if (benchmarkRequested && textureStacksForced)
+            std::cout << "the volume exceeds GL_MAX_3D_TEXTURE_SIZE, there is no 3D texture slicing to compare with" << std::endl;
+        else if (benchmarkRequested && halfAngle)
+            benchmarkHalfAngle(proxyShader, eyeShader, lightShader, view);
+        else if (benchmarkRequested && textureStacks)
+            benchmarkTextureStack(proxyShader, stackShader, view);
+        else if (benchmarkRequested && !gpuProxy)
+            benchmarkClipping(sliceShader);
+        benchmarkRequested = false;
+
+        bool validating = validateRequested;
+        validateRequested = false;
+        unsigned int fragmentQuery = 0;
+        if (validating)
+        {
+            glGenQueries(1, &fragmentQuery);
+            glBeginQuery(GL_SAMPLES_PASSED, fragmentQuery);
+        }
+
+        if (halfAngle)
+        {
+            drawSlicesHalfAngle(eyeShader, lightShader, view);
+        }
+        else if (textureStacks)
+        {
+            drawTextureStack(stackShader, view);
+        }
+        else if (projecting)
+        {
+            drawSlicesProjection(sliceShader);
+        }
+        else if (frontToBack)
+        {
+            drawSlicesFrontToBack(sliceShader, maskShader);
+        }
+        else
+        {
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+            drawSlices(sliceShader, 0, sliceDepths.size());
+        }
+
+        if (validating)
+        {
+            glEndQuery(GL_SAMPLES_PASSED);
+            GLuint64 gpuFragments = 0;
+            glGetQueryObjectui64v(fragmentQuery, GL_QUERY_RESULT, &gpuFragments);
+            glDeleteQueries(1, &fragmentQuery);
+            if (halfAngle || textureStacks || projectionMode != PROJECTION_COMPOSITE || preIntegrated || gradientClassification || shadingMode != SHADING_NONE || ambientOcclusion || cubicFiltering || labelsEnabled || fusionEnabled || sliceSpacing != BASE_SLICE_SPACING)
+                std::cout << "validation is only available for composited, post-classified view-aligned 3D texture slicing at the base spacing" << std::endl;
+            else
+                validateFrame(volume, projection, gpuFragments);
+            if (gpuProxy && !halfAngle && !textureStacks)
+                validateProxyGeometry();
+        }
+
+        if (projecting && projectionMode != PROJECTION_MAXIMUM)
+        {
+            resolveProjection(resolveShader);
+        }
+        else
+        {
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, accumFBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glBlitFramebuffer(0, 0, framebufferWidth, framebufferHeight, 0, 0, framebufferWidth, framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
 
         // glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
         glfwSwapBuffers(window);
@@ -224,6 +627,26 @@ int main(void)
     //de-allocate all resources once they've outlived their purpose:
     glDeleteVertexArrays(1, &VAO);
     glDeleteBuffers(1, &VBO);
+    glDeleteVertexArrays(1, &proxyVAO);
+    glDeleteBuffers(1, &proxyEBO);
+    glDeleteFramebuffers(1, &accumFBO);
+    glDeleteTextures(1, &accumTexture);
+    glDeleteRenderbuffers(1, &accumRBO);
+    glDeleteFramebuffers(1, &lightFBO);
+    glDeleteTextures(1, &lightTexture);
+    glDeleteTextures(3, stackTextures);
+    glDeleteTextures(1, &brickTexture);
+    glDeleteTextures(1, &transferTexture);
+    glDeleteTextures(1, &preIntegrationTexture);
+    glDeleteTextures(1, &transferTexture2D);
+    glDeleteTextures(1, &normalTexture);
+    glDeleteTextures(1, &normalVolumeTexture);
+    glDeleteTextures(1, &occlusionTexture);
+    glDeleteTextures(1, &cubicTexture);
+    glDeleteTextures(1, &labelTexture);
+    glDeleteTextures(1, &labelTableTexture);
+    glDeleteTextures(1, &fusedTexture);
+    glDeleteTextures(1, &fusedTransferTexture);
 
     // glfw: terminate, clearing all previously allocated GLFW resources.
     glfwTerminate();
@@ -271,11 +694,24 @@ void calculatePlanes()
     }
 
     vertexBuffer.clear();
+    sliceStarts.clear();
+    sliceDepths.clear();
+    clipStats = ClipStats();
+    static FrustumClipper<Vertex> clipper(projection);
     
     //Slice the bounding box with view-aligned planes.
     //For each plane(zValue) find the intersection points of bounding box's edges.
-    for(float zValue = vertices_viewspace[minz_idx].z; zValue < vertices_viewspace[maxZ_idx].z; zValue += 0.005f)
+    float minZ = vertices_viewspace[minz_idx].z;
+    float maxZ = vertices_viewspace[maxZ_idx].z;
+    int sliceCount = (int)ceil((maxZ - minZ) / sliceSpacing);
+    for(int s = 0; s < sliceCount; s++)
     {
+        //Back-to-front starts at the farthest plane, front-to-back at the nearest one.
+        int k = frontToBack ? sliceCount - 1 - s : s;
+        float zValue = minZ + k * sliceSpacing;
+        sliceStarts.push_back(vertexBuffer.size());
+        sliceDepths.push_back(zValue);
+
         vector<Vertex> planeVertices(0);//max 6 intersections possible for a plane
         for(int i=0; i < edgeCount; i++)
         {
@@ -289,7 +725,7 @@ void calculatePlanes()
             //zValue = p1.z + (p2.z - p1.z) * t
 
             float t = (zValue - p1.z)/(p2.z - p1.z);
-            if(t < 0 || t > 1)//No intersection with this edge.
+            if(!(t >= 0 && t <= 1))//No intersection with this edge, or it lies in the plane (0/0).
             	continue;
 
             glm::vec3 vertexCoord(p1.x + (p2.x -p1.x) * t, p1.y + (p2.y -p1.y) * t, zValue);
@@ -301,6 +737,10 @@ void calculatePlanes()
         //Sort vertices of the plane in ccw order.
         sort(planeVertices.begin(), planeVertices.end(), ccw_sort());
 
+        //Cut away the parts outside the view frustum, skip the slice if nothing is left.
+        if (frustumClipping && !clipper.clip(planeVertices, clipStats))
+            continue;
+
         //Avarage vertices in planeVertices, find middle vertex for the plane.
         Vertex midPoint;
         for(int i=0; i < planeVertices.size(); i++)
@@ -327,6 +767,818 @@ void calculatePlanes()
 }
 
 
+// Color texture for the composited image plus depth/stencil, the stencil holds the opacity mask.
+void createAccumulationBuffer(int width, int height)
+{
+    if (accumFBO == 0)
+    {
+        glGenFramebuffers(1, &accumFBO);
+        glGenTextures(1, &accumTexture);
+        glGenRenderbuffers(1, &accumRBO);
+    }
+
+    //The average intensity projection sums hundreds of slices and counts them in alpha.
+    glBindTexture(GL_TEXTURE_2D, accumTexture);
+    GLint format = projectionMode == PROJECTION_AVERAGE ? GL_RGBA32F : GL_RGBA8;
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, accumRBO);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, accumTexture, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, accumRBO);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::FRAMEBUFFER:: Accumulation buffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Static index buffer for proxy.vs: one instance per slice, six polygon vertices each.
+void createProxyGeometry(Shader& proxyShader)
+{
+    glGenVertexArrays(1, &proxyVAO);
+    glGenBuffers(1, &proxyEBO);
+    glBindVertexArray(proxyVAO);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, proxyEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(SliceProxy::indices), SliceProxy::indices, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+
+    setProxyTables(proxyShader);
+}
+
+//Moves the proxy cube onto the world space box [boxMin, boxMax], texture coordinates stay
+//twice the position. The path tables only depend on how the vertices are numbered.
+void setProxyBox(glm::vec3 boxMin, glm::vec3 boxMax)
+{
+    for(int i = 0; i < 8; i++)
+    {
+        worldSpaceCubeVertices[i] = glm::vec3((i & 2) ? boxMax.x : boxMin.x, (i & 1) ? boxMax.y : boxMin.y, (i & 4) ? boxMax.z : boxMin.z);
+        verticesTexCoords[i] = 2.0f * worldSpaceCubeVertices[i];
+        sliceProxy.vertices[i] = worldSpaceCubeVertices[i];
+    }
+}
+
+//The path tables never change, the cube only with setProxyBox(); the plane parameters are set per frame.
+void setProxyTables(Shader& shader)
+{
+    shader.use();
+    glUniform3fv(glGetUniformLocation(shader.ID, "vecVertices"), 8, &worldSpaceCubeVertices[0][0]);
+    glUniform1iv(glGetUniformLocation(shader.ID, "nSequence"), 64, sliceProxy.nSequence);
+}
+
+void setProxyUniforms(Shader& proxyShader, glm::mat4 view)
+{
+    proxyShader.setMat4("view", view);
+    proxyShader.setVec3("vecView", sliceProxy.vecView);
+    proxyShader.setInt("frontIdx", sliceProxy.frontIdx);
+    proxyShader.setFloat("dPlaneStart", sliceProxy.dPlaneStart);
+    proxyShader.setFloat("dPlaneIncr", sliceProxy.dPlaneIncr);
+}
+
+//Draws slices [first, last) of the current draw order.
+void drawSlices(Shader& sliceShader, unsigned int first, unsigned int last)
+{
+    if (first >= last)
+        return;
+
+    if (gpuProxy)
+    {
+        sliceShader.setInt("sliceOffset", first);
+        glBindVertexArray(proxyVAO);
+        glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0, last - first);
+    }
+    else
+    {
+        unsigned int endVertex = last < sliceStarts.size() ? sliceStarts[last] : vertexBuffer.size();
+        glBindVertexArray(VAO);
+        glDrawArrays(GL_TRIANGLES, sliceStarts[first], endVertex - sliceStarts[first]);
+    }
+}
+
+//Draws the slices nearest first with the under operator. Every MASK_UPDATE_INTERVAL slices
+//the stencil is refreshed from the accumulated alpha, so saturated pixels are rejected by the
+//early stencil test before the fragment shader runs.
+void drawSlicesFrontToBack(Shader& sliceShader, Shader& maskShader)
+{
+    glDisable(GL_DEPTH_TEST);
+    glEnable(GL_STENCIL_TEST);
+    glBlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+
+    unsigned int sliceCount = sliceDepths.size();
+    for(unsigned int first = 0; first < sliceCount; first += MASK_UPDATE_INTERVAL)
+    {
+        unsigned int last = min(first + MASK_UPDATE_INTERVAL, sliceCount);
+
+        sliceShader.use();
+        glStencilFunc(GL_EQUAL, 0, 0xFF);
+        glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+        drawSlices(sliceShader, first, last);
+
+        if (last < sliceCount)
+            updateOpacityMask(maskShader);
+    }
+
+    glDisable(GL_STENCIL_TEST);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//Maximum, minimum or sum of the slice values through the blend equation, shader.fs writes
+//(value, value, value, 1) so alpha holds whether (and for the sum how often) a slice was hit.
+//The order does not matter, so the depth test stays out of the way of front-to-back order.
+void drawSlicesProjection(Shader& sliceShader)
+{
+    glDisable(GL_DEPTH_TEST);
+    if (projectionMode == PROJECTION_MAXIMUM)
+        glBlendEquation(GL_MAX);
+    else if (projectionMode == PROJECTION_MINIMUM)
+        glBlendEquationSeparate(GL_MIN, GL_MAX);
+    else
+        glBlendFunc(GL_ONE, GL_ONE);
+
+    drawSlices(sliceShader, 0, sliceDepths.size());
+
+    glBlendEquation(GL_FUNC_ADD);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//Writes the accumulated minimum or mean to the window, pixels no slice reached turn black.
+void resolveProjection(Shader& resolveShader)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDisable(GL_BLEND);
+    glDisable(GL_DEPTH_TEST);
+
+    resolveShader.use();
+    resolveShader.setInt("accumulation", 1);
+    resolveShader.setInt("projectionMode", projectionMode);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, accumTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glActiveTexture(GL_TEXTURE0);
+
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+}
+
+//Level 0 of the grid as an RG8 texture, min in r and max in g, fetched per brick without filtering.
+void createBrickTexture(const MinMaxGrid& grid)
+{
+    const MinMaxGrid::Level& base = grid.levels[0];
+    vector<unsigned char> ranges(base.minValue.size() * 2);
+    for(size_t i = 0; i < base.minValue.size(); i++)
+    {
+        ranges[2 * i] = base.minValue[i];
+        ranges[2 * i + 1] = base.maxValue[i];
+    }
+
+    glGenTextures(1, &brickTexture);
+    glBindTexture(GL_TEXTURE_3D, brickTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RG8, base.width, base.height, base.depth, 0, GL_RG, GL_UNSIGNED_BYTE, ranges.data());
+    glBindTexture(GL_TEXTURE_3D, 0);
+}
+
+//The transfer function table as an RGBA32F 1D texture bound to unit 5 for good,
+//filtered linearly between the entries like TransferFunction::lookup().
+void createTransferTexture()
+{
+    glGenTextures(1, &transferTexture);
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_1D, transferTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, TransferFunction::SIZE, 0, GL_RGBA, GL_FLOAT, transferFunction.table.data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Uploads the table entries first to last again, nothing if the range is empty.
+void updateTransferTexture(int first, int last)
+{
+    if (first > last)
+    {
+        std::cout << "transfer function unchanged" << std::endl;
+        return;
+    }
+    glBindTexture(GL_TEXTURE_1D, transferTexture);
+    glTexSubImage1D(GL_TEXTURE_1D, 0, first, last - first + 1, GL_RGBA, GL_FLOAT, &transferFunction.table[first]);
+    glBindTexture(GL_TEXTURE_1D, 0);
+    std::cout << "transfer function updated, texels " << first << " to " << last << " uploaded" << std::endl;
+}
+
+//RGBA32F, SIZE x SIZE texels, filled by updatePreIntegration().
+void createPreIntegrationTexture()
+{
+    glGenTextures(1, &preIntegrationTexture);
+    glBindTexture(GL_TEXTURE_2D, preIntegrationTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, PreIntegrationTable::SIZE, PreIntegrationTable::SIZE, 0, GL_RGBA, GL_FLOAT, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//The 2D transfer function table as an RGBA32F texture bound to unit 7 for good, value along s.
+void createTransferTexture2D()
+{
+    glGenTextures(1, &transferTexture2D);
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_2D, transferTexture2D);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, TransferFunction2D::SIZE, TransferFunction2D::SIZE, 0, GL_RGBA, GL_FLOAT, transferFunction2D.table.data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//GradientMagnitude::normalTable() as an RGB32F texture bound to unit 8 for good, fetched per texel.
+void createNormalTexture()
+{
+    glGenTextures(1, &normalTexture);
+    glActiveTexture(GL_TEXTURE8);
+    glBindTexture(GL_TEXTURE_2D, normalTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB32F, 256, 256, 0, GL_RGB, GL_FLOAT, GradientMagnitude::normalTable().data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Replaces texture1 by (value, magnitude) pairs, twice the memory of the values alone, once
+//the 2D transfer function or precomputed shading reads the magnitudes.
+void uploadMagnitudes(unsigned int texture1, const GradientMagnitude& gradient)
+{
+    glBindTexture(GL_TEXTURE_3D, texture1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RG8, DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH, 0, GL_RG, GL_UNSIGNED_BYTE, gradient.interleave().data());
+    magnitudesUploaded = true;
+}
+
+//Builds the quantized normals the first time precomputed shading is chosen and uploads
+//them as an RG8 texture on unit 15, fetched per texel like the table they index.
+void createNormalVolumeTexture(GradientMagnitude& gradient)
+{
+    gradient.quantizeNormals = true;
+    gradient.build();
+    std::cout << "gradient magnitudes and normals computed in " << gradient.milliseconds << " ms" << std::endl;
+    glGenTextures(1, &normalVolumeTexture);
+    glActiveTexture(GL_TEXTURE15);
+    glBindTexture(GL_TEXTURE_3D, normalVolumeTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_RG8, DATA_WIDTH, DATA_HEIGHT, DATA_DEPTH, 0, GL_RG, GL_UNSIGNED_BYTE, gradient.interleaveNormals().data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//An R8 texture of AmbientOcclusion::visibility on unit 9, filtered linearly between the cells
+//and clamped to the edge ones like AmbientOcclusion::sample(); filled by updateOcclusion().
+void createOcclusionTexture(const AmbientOcclusion& occlusion)
+{
+    glGenTextures(1, &occlusionTexture);
+    glActiveTexture(GL_TEXTURE9);
+    glBindTexture(GL_TEXTURE_3D, occlusionTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, occlusion.width, occlusion.height, occlusion.depth, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Brings the visibilities up to date with the transfer function in use and uploads the
+//box of cells that changed, not the whole volume.
+void updateOcclusion(Shader& sliceShader, AmbientOcclusion& occlusion)
+{
+    if (occlusion.update(gradientClassification ? transferFunction2D.opacity() : transferFunction.opacity()))
+    {
+        glm::ivec3 low = occlusion.changedLow, size = occlusion.changedHigh - occlusion.changedLow + 1;
+        glBindTexture(GL_TEXTURE_3D, occlusionTexture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, occlusion.width);
+        glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, occlusion.height);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, low.x, low.y, low.z, size.x, size.y, size.z, GL_RED, GL_UNSIGNED_BYTE,
+                        &occlusion.visibility[occlusion.index(low.x, low.y, low.z)]);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+        glBindTexture(GL_TEXTURE_3D, 0);
+        std::cout << "ambient occlusion: " << occlusion.rebuiltCells << " densities and " << occlusion.occludedCells << " visibilities in "
+                  << occlusion.buildMilliseconds << " ms, " << size.x << "x" << size.y << "x" << size.z << " cells uploaded" << std::endl;
+    }
+    sliceShader.setInt("occlusionVolume", 9);
+    sliceShader.setVec3("occlusionScale", occlusion.textureScale());
+}
+
+//cubicOffsets() at 256 fractions i / 255 as an RGB32F texture bound to unit 10 for good,
+//filtered linearly between them.
+void createCubicTexture()
+{
+    std::vector<glm::vec3> offsets(256);
+    for(int i = 0; i < 256; i++)
+        offsets[i] = cubicOffsets(i / 255.0f);
+    glGenTextures(1, &cubicTexture);
+    glActiveTexture(GL_TEXTURE10);
+    glBindTexture(GL_TEXTURE_1D, cubicTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGB32F, 256, 0, GL_RGB, GL_FLOAT, offsets.data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//The labels as an integer texture on unit 11, R8UI or R16UI as loaded, and their table on
+//unit 12, RGBA32F in rows of 256. Integer textures only filter with GL_NEAREST, which is
+//what labels need anyway.
+void createLabelTextures()
+{
+    bool wide = labels.bytesPerLabel == 2;
+    glGenTextures(1, &labelTexture);
+    glActiveTexture(GL_TEXTURE11);
+    glBindTexture(GL_TEXTURE_3D, labelTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, wide ? GL_R16UI : GL_R8UI, labels.width, labels.height, labels.depth, 0, GL_RED_INTEGER,
+                 wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, labels.data.data());
+
+    std::vector<glm::vec4> table(labels.table);
+    table.resize((size_t)labels.tableRows() * 256, glm::vec4(0.0f));
+    glGenTextures(1, &labelTableTexture);
+    glActiveTexture(GL_TEXTURE12);
+    glBindTexture(GL_TEXTURE_2D, labelTableTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 256, labels.tableRows(), 0, GL_RGBA, GL_FLOAT, table.data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//A style change uploads the one texel of its label.
+void updateLabelTable(int label)
+{
+    glBindTexture(GL_TEXTURE_2D, labelTableTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, label % 256, label / 256, 1, 1, GL_RGBA, GL_FLOAT, &labels.table[label]);
+    glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+//The fused volume as R8 on unit 13, read through CLAMP_TO_BORDER like texture1 so it is
+//transparent outside its box, and its transfer function table on unit 14.
+void createFusedTextures(const FusedVolume& fused)
+{
+    glGenTextures(1, &fusedTexture);
+    glActiveTexture(GL_TEXTURE13);
+    glBindTexture(GL_TEXTURE_3D, fusedTexture);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_BORDER);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, fused.volume.width, fused.volume.height, fused.volume.depth, 0, GL_RED, GL_UNSIGNED_BYTE,
+                 fused.volume.data.data());
+
+    glGenTextures(1, &fusedTransferTexture);
+    glActiveTexture(GL_TEXTURE14);
+    glBindTexture(GL_TEXTURE_1D, fusedTransferTexture);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA32F, TransferFunction::SIZE, 0, GL_RGBA, GL_FLOAT, fused.transferFunction.table.data());
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Rebuilds the segments a transfer function edit or a new slice spacing touched and
+//binds the table to unit 6. The whole table is uploaded again, 1 MB.
+void updatePreIntegration(Shader& sliceShader)
+{
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_2D, preIntegrationTexture);
+    if (preIntegration.update(transferFunction, sliceSpacing / BASE_SLICE_SPACING))
+    {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, PreIntegrationTable::SIZE, PreIntegrationTable::SIZE, GL_RGBA, GL_FLOAT, preIntegration.table.data());
+        std::cout << "pre-integration table: " << preIntegration.rebuiltEntries << " entries rebuilt in " << preIntegration.buildMilliseconds << " ms" << std::endl;
+    }
+    glActiveTexture(GL_TEXTURE0);
+    sliceShader.setInt("preIntegration", 6);
+}
+
+//The eye and the previous slice's distance for shader.fs, world space like the CPU ray caster.
+void setPreviousSliceUniforms(Shader& sliceShader, glm::mat4 view)
+{
+    glm::mat4 invView = glm::inverse(view);
+    sliceShader.setVec3("eyePosition", glm::vec3(invView[3]));
+    sliceShader.setVec3("viewDirection", -glm::normalize(glm::vec3(invView[2])));
+    sliceShader.setFloat("sliceSpacing", sliceSpacing);
+}
+
+//The iso-value and the min-max bricks on top of the previous slice.
+void setIsosurfaceUniforms(Shader& sliceShader, glm::mat4 view)
+{
+    setPreviousSliceUniforms(sliceShader, view);
+    sliceShader.setFloat("isoValue", isoValue);
+    sliceShader.setInt("brickRange", 4);
+    sliceShader.setInt("brickSize", 8);
+
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_3D, brickTexture);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+//Marks pixels whose accumulated opacity crossed OPACITY_THRESHOLD in the stencil buffer.
+void updateOpacityMask(Shader& maskShader)
+{
+    //Make the blended slices visible to texture fetches, the mask pass itself never writes color.
+    glTextureBarrier();
+    glDrawBuffer(GL_NONE);
+    glDisable(GL_BLEND);
+    glStencilFunc(GL_ALWAYS, 1, 0xFF);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+    maskShader.use();
+    maskShader.setInt("accumulation", 1);
+    maskShader.setFloat("threshold", OPACITY_THRESHOLD);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, accumTexture);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glActiveTexture(GL_TEXTURE0);
+
+    glEnable(GL_BLEND);
+    glDrawBuffer(GL_COLOR_ATTACHMENT0);
+}
+
+void createLightBuffer()
+{
+    glGenFramebuffers(1, &lightFBO);
+    glGenTextures(1, &lightTexture);
+
+    glBindTexture(GL_TEXTURE_2D, lightTexture);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, LIGHT_BUFFER_SIZE, LIGHT_BUFFER_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, lightTexture, 0);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+        std::cout << "ERROR::FRAMEBUFFER:: Light buffer is not complete" << std::endl;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+//Half-angle slicing (Kniss et al.): slices are perpendicular to the vector halfway between
+//the light and the eye (or the reversed eye direction when they face each other) and are
+//visited front to back as seen from the light. Each slice is first composited into the eye
+//buffer, shadowed by the light buffer, then added to the light buffer, so shadows come out
+//of the same single pass over the slices.
+void drawSlicesHalfAngle(Shader& eyeShader, Shader& lightShader, glm::mat4 view)
+{
+    glm::vec3 toEye(view[0][2], view[1][2], view[2][2]);
+    bool sameSide = glm::dot(toEye, lightDirection) >= 0.0f;
+    glm::vec3 halfAxis = glm::normalize(sameSide ? toEye + lightDirection : lightDirection - toEye);
+
+    //Keep the sample distance along eye rays equal to plain slicing.
+    float spacing = BASE_SLICE_SPACING * fabs(glm::dot(halfAxis, toEye));
+    sliceProxy.updateAxis(halfAxis, 0.0f, spacing, true);
+
+    //Orthographic light looking at the proxy cube, wide enough for its bounding sphere.
+    glm::vec3 up = fabs(lightDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    glm::mat4 lightView = glm::lookAt(lightDirection * 2.0f, glm::vec3(0.0f), up);
+    glm::mat4 lightProjection = glm::ortho(-0.9f, 0.9f, -0.9f, 0.9f, 0.1f, 4.0f);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+
+    eyeShader.use();
+    setProxyUniforms(eyeShader, view);
+    eyeShader.setMat4("projection", projection);
+    eyeShader.setMat4("lightViewProjection", lightProjection * lightView);
+    eyeShader.setInt("lightBuffer", 2);
+    lightShader.use();
+    setProxyUniforms(lightShader, lightView);
+    lightShader.setMat4("projection", lightProjection);
+
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_2D, lightTexture);
+    glActiveTexture(GL_TEXTURE0);
+    glDisable(GL_DEPTH_TEST);
+    glBindVertexArray(proxyVAO);
+
+    for(int i = 0; i < sliceProxy.sliceCount; i++)
+    {
+        //Front to back for the eye uses the under operator, back to front the over operator.
+        glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+        glViewport(0, 0, framebufferWidth, framebufferHeight);
+        if (sameSide)
+            glBlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+        else
+            glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        eyeShader.use();
+        eyeShader.setInt("sliceOffset", i);
+        glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0, 1);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, lightFBO);
+        glViewport(0, 0, LIGHT_BUFFER_SIZE, LIGHT_BUFFER_SIZE);
+        glBlendFunc(GL_ONE_MINUS_DST_ALPHA, GL_ONE);
+        lightShader.use();
+        lightShader.setInt("sliceOffset", i);
+        glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0, 1);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, accumFBO);
+    glViewport(0, 0, framebufferWidth, framebufferHeight);
+    glEnable(GL_DEPTH_TEST);
+}
+
+//GPU time of a half-angle frame against plain view-aligned slicing of the same view.
+void benchmarkHalfAngle(Shader& proxyShader, Shader& eyeShader, Shader& lightShader, glm::mat4 view)
+{
+    unsigned int query;
+    glGenQueries(1, &query);
+    GLuint64 plainTime = 0, halfAngleTime = 0;
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    sliceProxy.update(view, sliceSpacing, false);
+    int plainSlices = sliceProxy.sliceCount;
+    proxyShader.use();
+    proxyShader.setMat4("projection", projection);
+    setProxyUniforms(proxyShader, view);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(proxyVAO);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0, plainSlices);
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &plainTime);
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    drawSlicesHalfAngle(eyeShader, lightShader, view);
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &halfAngleTime);
+
+    std::cout << "plain slicing: " << plainSlices << " slices " << plainTime / 1.0e6 << " ms, "
+              << "half-angle: " << sliceProxy.sliceCount << " slices " << halfAngleTime / 1.0e6 << " ms ("
+              << (plainTime ? (double)halfAngleTime / plainTime : 0.0) << "x)" << std::endl;
+
+    glDeleteQueries(1, &query);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+//Transposes the volume into three slice stacks and uploads them as 2D array textures.
+void createTextureStacks(const Volume& volume)
+{
+    auto start = chrono::high_resolution_clock::now();
+    TextureStacks stacks(volume);
+    SchedulerStats buildStats;
+    stacks.build(std::thread::hardware_concurrency(), &buildStats);
+    double buildTime = chrono::duration<double, milli>(chrono::high_resolution_clock::now() - start).count();
+
+    glGenTextures(3, stackTextures);
+    for(int axis = 0; axis < 3; axis++)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, stackTextures[axis]);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);//bilinear filtering
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_R8, stacks.sliceWidth(axis), stacks.sliceHeight(axis), stacks.layerCount(axis),
+                     0, GL_RED, GL_UNSIGNED_BYTE, stacks.stackData(axis));
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    stacksCreated = true;
+
+    std::cout << "texture stacks built in " << buildTime << " ms, "
+              << stacks.memoryFootprint() / (1024.0 * 1024.0) << " MB of textures against "
+              << volume.voxelCount() / (1024.0 * 1024.0) << " MB for the 3D texture" << std::endl;
+    printSchedulerStats(buildStats, false);
+}
+
+//Draws the stack facing the camera back to front, one instanced quad per layer.
+void drawTextureStack(Shader& stackShader, glm::mat4 view)
+{
+    bool ascending;
+    int axis = TextureStacks::dominantAxis(view, ascending);
+    int layerCount = axis == 0 ? DATA_WIDTH : (axis == 1 ? DATA_HEIGHT : DATA_DEPTH);
+
+    //Layers are 0.5 / layerCount apart in world space, along the view ray that grows with the angle.
+    glm::vec3 toEye(view[0][2], view[1][2], view[2][2]);
+    float rayStep = (0.5f / layerCount) / max(fabs(toEye[axis]), 1e-3f);
+
+    stackShader.use();
+    stackShader.setMat4("view", view);
+    stackShader.setMat4("projection", projection);
+    stackShader.setInt("axis", axis);
+    stackShader.setInt("layerCount", layerCount);
+    stackShader.setBool("ascending", ascending);
+    stackShader.setFloat("opacityExponent", rayStep / BASE_SLICE_SPACING);
+    stackShader.setInt("stack", 3);
+
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, stackTextures[axis]);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(proxyVAO);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 6, layerCount);
+}
+
+//GPU time of the texture stack renderer against 3D texture slicing of the same view.
+void benchmarkTextureStack(Shader& proxyShader, Shader& stackShader, glm::mat4 view)
+{
+    unsigned int query;
+    glGenQueries(1, &query);
+    GLuint64 sliceTime = 0, stackTime = 0;
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    sliceProxy.update(view, sliceSpacing, false);
+    proxyShader.use();
+    proxyShader.setMat4("projection", projection);
+    setProxyUniforms(proxyShader, view);
+    glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+    glBindVertexArray(proxyVAO);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    glDrawElementsInstanced(GL_TRIANGLES, 12, GL_UNSIGNED_INT, 0, sliceProxy.sliceCount);
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &sliceTime);
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glBeginQuery(GL_TIME_ELAPSED, query);
+    drawTextureStack(stackShader, view);
+    glEndQuery(GL_TIME_ELAPSED);
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &stackTime);
+
+    std::cout << "3D texture slicing: " << sliceTime / 1.0e6 << " ms (" << DATA_WIDTH * DATA_HEIGHT * DATA_DEPTH / (1024.0 * 1024.0) << " MB), "
+              << "2D texture stack: " << stackTime / 1.0e6 << " ms (" << 3.0 * DATA_WIDTH * DATA_HEIGHT * DATA_DEPTH / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+    glDeleteQueries(1, &query);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+//Compares the current frame against the CPU reference compositor and reports fragment counts.
+void validateFrame(const Volume& volume, glm::mat4 projection, unsigned long long gpuFragments)
+{
+    vector<unsigned char> pixels((size_t)framebufferWidth * framebufferHeight * 4);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, framebufferWidth, framebufferHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+
+    ReferenceCompositor reference(volume, transferFunction);
+    vector<glm::vec4> image;
+    CompositeStats stats;
+    reference.render(sliceDepths, camera.GetViewMatrix(), projection, framebufferWidth, framebufferHeight,
+                     frontToBack, OPACITY_THRESHOLD, MASK_UPDATE_INTERVAL, image, stats);
+
+    float meanError;
+    float maxError = ReferenceCompositor::maxError(image, pixels.data(), &meanError);
+    unsigned long long total = stats.shadedFragments + stats.skippedFragments;
+    std::cout << (frontToBack ? "front-to-back" : "back-to-front")
+              << " slices: " << sliceDepths.size()
+              << " max error: " << maxError << " mean error: " << meanError << std::endl;
+    std::cout << "fragments gpu: " << gpuFragments << " cpu: " << stats.shadedFragments
+              << " skipped: " << stats.skippedFragments
+              << " (" << (total ? 100.0 * stats.skippedFragments / total : 0.0) << "%)" << std::endl;
+}
+
+//Largest distance between the polygons proxy.vs generates (through its CPU copy) and those of
+//calculatePlanes() for the current view, INFINITY if they do not have the same slices.
+float proxyDeviation()
+{
+    glm::mat4 view = camera.GetViewMatrix();
+    bool clipping = frustumClipping;
+    frustumClipping = false;
+    calculatePlanes();
+    frustumClipping = clipping;
+    sliceProxy.update(view, sliceSpacing, frontToBack);
+    if ((int)sliceStarts.size() != sliceProxy.sliceCount)
+        return INFINITY;
+
+    float maxDeviation = 0.0f;
+    vector<glm::vec3> polygon;
+    for(unsigned int s = 0; s < sliceStarts.size(); s++)
+    {
+        unsigned int endVertex = s + 1 < sliceStarts.size() ? sliceStarts[s + 1] : vertexBuffer.size();
+        //Every fan triangle starts with a perimeter vertex followed by the next one and the midpoint.
+        polygon.clear();
+        for(unsigned int v = sliceStarts[s]; v < endVertex; v += 3)
+            polygon.push_back(vertexBuffer[v].vertexCoord);
+        if (!polygon.empty())
+            maxDeviation = max(maxDeviation, sliceProxy.maxDeviation(s, polygon, view));
+    }
+    return maxDeviation;
+}
+
+//Checks the polygons proxy.vs generates (through its CPU copy) against calculatePlanes().
+void validateProxyGeometry()
+{
+    float maxDeviation = proxyDeviation();
+    std::cout << "proxy geometry slices cpu: " << sliceStarts.size() << " gpu: " << sliceProxy.sliceCount
+              << " max vertex deviation: " << maxDeviation << std::endl;
+}
+
+//proxyDeviation() for both slice orders and several spacings, from views all around the volume
+//in keypad steps, the axis aligned start included. False if any exceeds tolerance.
+bool validateProxyViews(float tolerance)
+{
+    const int AZIMUTH_STEPS = 97, POLAR_STEPS = 113; //keypad steps between two views
+    const float spacings[] = {BASE_SLICE_SPACING, 0.0123f, 2 * BASE_SLICE_SPACING, MAX_SLICE_SPACING};
+    float spacing = sliceSpacing;
+    bool order = frontToBack;
+    float worst = 0.0f;
+    int slicings = 0, failures = 0;
+    for(int p = 0; p < 8; p++)
+    {
+        for(int a = 0; a < 16; a++)
+        {
+            for(float candidate : spacings)
+            {
+                for(int o = 0; o < 2; o++)
+                {
+                    sliceSpacing = candidate;
+                    frontToBack = o == 1;
+                    float deviation = proxyDeviation();
+                    worst = max(worst, deviation);
+                    slicings++;
+                    if (!(deviation <= tolerance))
+                    {
+                        failures++;
+                        std::cout << "view " << p << "/" << a << " spacing " << candidate << (frontToBack ? " front-to-back" : " back-to-front")
+                                  << ": slices cpu " << sliceStarts.size() << " gpu " << sliceProxy.sliceCount
+                                  << ", max vertex deviation " << deviation << std::endl;
+                    }
+                }
+            }
+            for(int i = 0; i < AZIMUTH_STEPS; i++)
+                camera.rotateLeft();
+        }
+        for(int i = 0; i < POLAR_STEPS; i++)
+            camera.rotateDown();
+    }
+    sliceSpacing = spacing;
+    frontToBack = order;
+
+    std::cout << "proxy geometry: " << slicings << " slicings checked, max vertex deviation " << worst << " (tolerance " << tolerance << "), "
+              << failures << " failed" << std::endl;
+    return failures == 0;
+}
+
+//Draws the current view with and without frustum clipping and reports what clipping saves.
+//Zoom in with O/P first, at the default distance the whole volume is visible.
+void benchmarkClipping(Shader& sliceShader)
+{
+    bool clipping = frustumClipping;
+    unsigned int queries[2];
+    glGenQueries(2, queries);
+
+    for(int pass = 0; pass < 2; pass++)
+    {
+        frustumClipping = pass == 1;
+        calculatePlanes();
+        unsigned long long vertices = vertexBuffer.size();
+        unsigned long long slicesDrawn = clipStats.slices - clipStats.slicesCulled;
+        if (!frustumClipping)
+            slicesDrawn = sliceDepths.size();
+
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBeginQuery(GL_TIME_ELAPSED, queries[0]);
+        glBeginQuery(GL_SAMPLES_PASSED, queries[1]);
+        glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(Vertex), vertexBuffer.data(), GL_DYNAMIC_DRAW);
+        glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        drawSlices(sliceShader, 0, sliceDepths.size());
+        glEndQuery(GL_SAMPLES_PASSED);
+        glEndQuery(GL_TIME_ELAPSED);
+
+        GLuint64 gpuTime = 0, fragments = 0;
+        glGetQueryObjectui64v(queries[0], GL_QUERY_RESULT, &gpuTime);
+        glGetQueryObjectui64v(queries[1], GL_QUERY_RESULT, &fragments);
+        std::cout << (frustumClipping ? "clipped:   " : "unclipped: ")
+                  << "slices " << slicesDrawn << "/" << sliceDepths.size()
+                  << " vertices " << vertices
+                  << " fragments " << fragments
+                  << " gpu " << gpuTime / 1.0e6 << " ms" << std::endl;
+    }
+
+    glDeleteQueries(2, queries);
+    frustumClipping = clipping;
+    calculatePlanes();
+    glBufferData(GL_ARRAY_BUFFER, vertexBuffer.size() * sizeof(Vertex), vertexBuffer.data(), GL_DYNAMIC_DRAW);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+}
 
 inline float positiveAngle(glm::vec3 vec)
 {
@@ -397,15 +1649,1571 @@ void processInput(GLFWwindow *window)
 
     if (glfwGetKey(window, GLFW_KEY_KP_8) == GLFW_PRESS)
         camera.rotateUp();
+
+    //The isosurface only needs the brick texture, so the iso-value can follow the key every frame.
+    float isoStep = 0.0f;
+    if (glfwGetKey(window, GLFW_KEY_MINUS) == GLFW_PRESS)
+        isoStep -= ISO_VALUE_SPEED * deltaTime;
+    if (glfwGetKey(window, GLFW_KEY_EQUAL) == GLFW_PRESS)
+        isoStep += ISO_VALUE_SPEED * deltaTime;
+    if (isoStep != 0.0f)
+        isoValue = glm::clamp(isoValue + isoStep, 0.0f, 1.0f);
 }
 
-// glfw: whenever the window size changed (by OS or user resize) this callback function executes
-// ---------------------------------------------------------------------------------------------
-void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+// Renders one frame on the CPU and writes it to disk, no GL context involved.
+// usage: VolumeRender --headless out.png [--size 800x600] [--threads N] [--azimuth rad] [--polar rad]
+//                     [--simd scalar|sse4.2|avx2|avx512] [--bench-simd] [--worker-stats]
+//                     [--volume file.raw WxHxD | --synthetic N] [--no-skipping] [--bench-skipping]
+//                     [--termination [alpha]] [--adaptive-step [tolerance]] [--max-step N] [--bench-adaptive]
+//                     [--shear-warp [scale]] [--bench-shear-warp] [--progressive [budget ms]] [--orbit N]
+//                     [--projection composite|mip|minip|average|iso] [--iso value] [--no-projection-skipping] [--bench-projection]
+//                     [--tf file.tf] [--stride N] [--pre-integrated] [--bench-pre-integration]
+//                     [--gradient-tf file.tf2] [--bench-gradient] [--bench-classification] [--auto-tf] [--bench-auto-tf]
+//                     [--shading none|gradient|precomputed] [--bench-shading] [--ambient-occlusion] [--bench-occlusion]
+//                     [--filter trilinear|cubic|cubic-reference] [--bench-cubic]
+//                     [--labels file.raw | --label-bands N] [--label-styles file.labels] [--hide-label L] [--bench-labels]
+//                     [--fuse file.raw WxHxD | --fuse-gradient [N]] [--fuse-tf file.tf] [--fuse-offset x,y,z]
+//                     [--fusion over|add|maximum|blend|mask] [--fusion-weight w] [--bench-fusion]
+//                     [--validate-proxy [tolerance]]
+// --synthetic renders an N^3 volume of random blobs in empty space. --termination
+// stops rays at alpha (OPACITY_THRESHOLD by default), --adaptive-step lets samples
+// in bricks varying less than tolerance per plane span up to --max-step planes.
+// --shear-warp renders with the ShearWarpRenderer instead of ray casting, at
+// scale intermediate pixels per voxel. --progressive refines in slices of
+// budget ms (16 by default) and restarts once for a keypad step of the camera.
+// --orbit renders N frames one keypad step apart through the ReprojectionCache.
+// --projection takes the maximum, minimum or mean sample of each ray instead of compositing,
+// or shades its first crossing of the --iso value (0.3 by default, implies iso).
+// --tf classifies with the control points of file.tf instead of the grayscale ramp.
+// --stride samples every N planes, opacity corrected, and --pre-integrated
+// classifies the segments between the samples instead (scalar path only).
+// --gradient-tf classifies by value and gradient magnitude with the widgets of
+// file.tf2 (scalar path only; shear-warp keeps the 1D function).
+// --bench-gradient times the gradient volume per instruction set, --synthetic 512 for 512^3.
+// --bench-classification times reclassifying the brick grid for volumes up to 512^3.
+// --auto-tf replaces the transfer function (and the --gradient-tf widgets) with
+// one found in the histograms, --bench-auto-tf times that.
+// --shading lights composited samples by on-the-fly or precomputed gradients (scalar path only).
+// --ambient-occlusion dims them by the precomputed visibility (scalar path only).
+// --filter reconstructs composited and projected samples with the cubic B-spline,
+// from eight trilinear samples or, for reference, 64 voxels (scalar path only).
+// --labels reads a segmentation of the volume's size, 8 or 16 bits per voxel;
+// --label-bands N labels bands of values instead. Composited samples then take
+// the style of their label from --label-styles, --hide-label hides label L
+// (scalar path only). --bench-labels times hiding labels, 4 bands by default.
+// --fuse composites a second volume with the first, of its own size, or
+// --fuse-gradient its gradient magnitudes at 1/N of the resolution (2 by default),
+// classified by --fuse-tf (edges.tf by default) and moved by --fuse-offset in
+// world units (the volume spans 0.5). --fusion picks how the two samples
+// combine, --fusion-weight the fused share of a blend (scalar path only).
+// --bench-fusion times the operators against the volume alone, a gradient field by default.
+// --validate-proxy (also without --headless) compares the CPU copy of proxy.vs with calculatePlanes()
+// from views all around the volume instead of rendering, and exits with 1 if a vertex is further
+// than tolerance (1e-4 by default) off.
+// The angles are applied as the same 0.005 rad steps the keypad keys take, so a
+// batch render reproduces what the interactive view shows after those key presses.
+int runHeadless(int argc, char** argv)
 {
-    // make sure the viewport matches the new window dimensions; note that width and 
-    // height will be significantly larger than specified on retina displays.
-    glViewport(0, 0, width, height);
+    string output = "output.png";
+    int width = WINDOW_WIDTH, height = WINDOW_HEIGHT;
+    unsigned int threads = 0;
+    float azimuth = 0.0f, polar = 0.0f;
+    string simd;
+    bool benchmark = false;
+    bool workerStats = false;
+    string volumeFile = DATA_FILE;
+    int volumeWidth = DATA_WIDTH, volumeHeight = DATA_HEIGHT, volumeDepth = DATA_DEPTH;
+    int synthetic = 0;
+    bool skipping = true, benchmarkSkip = false;
+    float termination = 1.0f;
+    bool adaptive = false, benchmarkAdapt = false;
+    float stepTolerance = 0.05f;
+    int maxStep = 4;
+    float shearWarpScale = 0.0f;
+    bool benchmarkWarp = false;
+    float progressiveBudget = 0.0f;
+    int orbitFrames = 0;
+    ProjectionMode projectionType = PROJECTION_COMPOSITE;
+    bool projectionSkipping = true, benchmarkProject = false;
+    float iso = 0.3f;
+    string transferFile;
+    int stride = 1;
+    bool preIntegrated = false, benchmarkPreIntegrate = false;
+    string gradientFile;
+    bool benchmarkGradients = false;
+    bool benchmarkClassify = false;
+    bool automaticTransfer = false, benchmarkAuto = false;
+    ShadingMode shading = SHADING_NONE;
+    bool benchmarkShade = false;
+    bool occluded = false, benchmarkOcclude = false;
+    VolumeFilter filter = FILTER_TRILINEAR;
+    bool benchmarkCubicFilter = false;
+    string labelFile, labelStyleFile;
+    int labelBands = 0;
+    vector<int> hiddenLabels;
+    bool benchmarkLabeling = false;
+    string fusedFile, fusedTransferFile = FUSED_TRANSFER_FILE;
+    int fusedWidth = 0, fusedHeight = 0, fusedDepth = 0;
+    int fusedDownsample = 0;
+    glm::vec3 fusedOffset(0.0f);
+    FusionOperator fusionType = FUSION_OVER;
+    float fusionWeight = 0.5f;
+    bool benchmarkFusing = false;
+    float proxyTolerance = 0.0f;
+
+    for(int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--headless" && hasValue)
+            output = argv[++i];
+        else if (arg == "--size" && hasValue)
+            sscanf(argv[++i], "%dx%d", &width, &height);
+        else if (arg == "--threads" && hasValue)
+            threads = atoi(argv[++i]);
+        else if (arg == "--azimuth" && hasValue)
+            azimuth = atof(argv[++i]);
+        else if (arg == "--polar" && hasValue)
+            polar = atof(argv[++i]);
+        else if (arg == "--simd" && hasValue)
+            simd = argv[++i];
+        else if (arg == "--bench-simd")
+            benchmark = true;
+        else if (arg == "--worker-stats")
+            workerStats = true;
+        else if (arg == "--volume" && i + 2 < argc)
+        {
+            volumeFile = argv[++i];
+            sscanf(argv[++i], "%dx%dx%d", &volumeWidth, &volumeHeight, &volumeDepth);
+        }
+        else if (arg == "--synthetic" && hasValue)
+            synthetic = atoi(argv[++i]);
+        else if (arg == "--no-skipping")
+            skipping = false;
+        else if (arg == "--bench-skipping")
+            benchmarkSkip = true;
+        else if (arg == "--termination")
+            termination = hasValue && argv[i + 1][0] != '-' ? (float)atof(argv[++i]) : OPACITY_THRESHOLD;
+        else if (arg == "--adaptive-step")
+        {
+            adaptive = true;
+            if (hasValue && argv[i + 1][0] != '-')
+                stepTolerance = (float)atof(argv[++i]);
+        }
+        else if (arg == "--max-step" && hasValue)
+            maxStep = atoi(argv[++i]);
+        else if (arg == "--bench-adaptive")
+            benchmarkAdapt = true;
+        else if (arg == "--shear-warp")
+            shearWarpScale = hasValue && argv[i + 1][0] != '-' ? (float)atof(argv[++i]) : 1.0f;
+        else if (arg == "--bench-shear-warp")
+            benchmarkWarp = true;
+        else if (arg == "--progressive")
+            progressiveBudget = hasValue && argv[i + 1][0] != '-' ? (float)atof(argv[++i]) : 16.0f;
+        else if (arg == "--orbit" && hasValue)
+            orbitFrames = atoi(argv[++i]);
+        else if (arg == "--projection" && hasValue)
+        {
+            if (!parseProjection(argv[++i], projectionType))
+                std::cout << "Unknown projection " << argv[i] << ", compositing" << std::endl;
+        }
+        else if (arg == "--iso" && hasValue)
+        {
+            iso = (float)atof(argv[++i]);
+            projectionType = PROJECTION_ISOSURFACE;
+        }
+        else if (arg == "--no-projection-skipping")
+            projectionSkipping = false;
+        else if (arg == "--bench-projection")
+            benchmarkProject = true;
+        else if (arg == "--tf" && hasValue)
+            transferFile = argv[++i];
+        else if (arg == "--stride" && hasValue)
+            stride = atoi(argv[++i]);
+        else if (arg == "--pre-integrated")
+            preIntegrated = true;
+        else if (arg == "--bench-pre-integration")
+            benchmarkPreIntegrate = true;
+        else if (arg == "--gradient-tf" && hasValue)
+            gradientFile = argv[++i];
+        else if (arg == "--bench-gradient")
+            benchmarkGradients = true;
+        else if (arg == "--bench-classification")
+            benchmarkClassify = true;
+        else if (arg == "--auto-tf")
+            automaticTransfer = true;
+        else if (arg == "--bench-auto-tf")
+            benchmarkAuto = true;
+        else if (arg == "--shading" && hasValue)
+        {
+            if (!parseShading(argv[++i], shading))
+                std::cout << "Unknown shading " << argv[i] << ", none" << std::endl;
+        }
+        else if (arg == "--bench-shading")
+            benchmarkShade = true;
+        else if (arg == "--ambient-occlusion")
+            occluded = true;
+        else if (arg == "--bench-occlusion")
+            benchmarkOcclude = true;
+        else if (arg == "--filter" && hasValue)
+        {
+            if (!parseFilter(argv[++i], filter))
+                std::cout << "Unknown filter " << argv[i] << ", trilinear" << std::endl;
+        }
+        else if (arg == "--bench-cubic")
+            benchmarkCubicFilter = true;
+        else if (arg == "--labels" && hasValue)
+            labelFile = argv[++i];
+        else if (arg == "--label-bands" && hasValue)
+            labelBands = atoi(argv[++i]);
+        else if (arg == "--label-styles" && hasValue)
+            labelStyleFile = argv[++i];
+        else if (arg == "--hide-label" && hasValue)
+            hiddenLabels.push_back(atoi(argv[++i]));
+        else if (arg == "--bench-labels")
+            benchmarkLabeling = true;
+        else if (arg == "--fuse" && i + 2 < argc)
+        {
+            fusedFile = argv[++i];
+            sscanf(argv[++i], "%dx%dx%d", &fusedWidth, &fusedHeight, &fusedDepth);
+        }
+        else if (arg == "--fuse-gradient")
+            fusedDownsample = hasValue && argv[i + 1][0] != '-' ? atoi(argv[++i]) : FUSED_DOWNSAMPLE;
+        else if (arg == "--fuse-tf" && hasValue)
+            fusedTransferFile = argv[++i];
+        else if (arg == "--fuse-offset" && hasValue)
+            sscanf(argv[++i], "%f,%f,%f", &fusedOffset.x, &fusedOffset.y, &fusedOffset.z);
+        else if (arg == "--fusion" && hasValue)
+        {
+            if (!parseFusion(argv[++i], fusionType))
+                std::cout << "Unknown fusion operator " << argv[i] << ", over" << std::endl;
+        }
+        else if (arg == "--fusion-weight" && hasValue)
+            fusionWeight = (float)atof(argv[++i]);
+        else if (arg == "--bench-fusion")
+            benchmarkFusing = true;
+        else if (arg == "--validate-proxy")
+            proxyTolerance = hasValue && argv[i + 1][0] != '-' ? (float)atof(argv[++i]) : 1e-4f;
+    }
+
+    //The slice geometry needs neither the volume nor a GL context.
+    if (proxyTolerance > 0.0f)
+        return validateProxyViews(proxyTolerance) ? 0 : 1;
+
+    for(int i = 0; i < (int)roundf(fabs(azimuth) / 0.005f); i++)
+    {
+        if (azimuth > 0)
+            camera.rotateLeft();
+        else
+            camera.rotateRight();
+    }
+    for(int i = 0; i < (int)roundf(fabs(polar) / 0.005f); i++)
+    {
+        if (polar > 0)
+            camera.rotateDown();
+        else
+            camera.rotateUp();
+    }
+
+    if (synthetic > 0)
+        volumeWidth = volumeHeight = volumeDepth = synthetic;
+    Volume volume(volumeWidth, volumeHeight, volumeDepth);
+    if (synthetic > 0)
+        volume.fillSparse(64);
+    else if (!volume.load(volumeFile.c_str()))
+    {
+        std::cout << "Failed to read " << volumeFile << std::endl;
+        return -1;
+    }
+
+    glm::mat4 headlessProjection = glm::perspective(FIELD_OF_VIEW, (float)width / (float)height, NEAR_PLANE, FAR_PLANE);
+    RayCaster rayCaster(volume, sliceSpacing);
+    if (threads > 0)
+        rayCaster.threadCount = threads;
+    rayCaster.emptySpaceSkipping = skipping;
+    rayCaster.opacityThreshold = termination;
+    rayCaster.adaptiveStep = adaptive;
+    rayCaster.stepTolerance = stepTolerance;
+    rayCaster.maxStep = maxStep;
+    rayCaster.projectionMode = projectionType;
+    rayCaster.projectionSkipping = projectionSkipping;
+    rayCaster.isoValue = iso;
+    rayCaster.sampleStride = stride;
+    rayCaster.preIntegrated = preIntegrated;
+    if (!transferFile.empty() && !rayCaster.transferFunction.load(transferFile))
+    {
+        std::cout << "Failed to read " << transferFile << std::endl;
+        return -1;
+    }
+    SimdIsa isa;
+    if (!simd.empty() && !parseSimd(simd.c_str(), isa))
+        std::cout << "Unknown instruction set " << simd << ", using " << simdName(rayCaster.simd) << std::endl;
+    else if (!simd.empty() && !simdAvailable(isa))
+        std::cout << simdName(isa) << " is not available, using " << simdName(rayCaster.simd) << std::endl;
+    else if (!simd.empty())
+        rayCaster.simd = isa;
+
+    GradientMagnitude gradient(volume);
+    gradient.quantizeNormals = shading == SHADING_PRECOMPUTED;
+    rayCaster.shading = shading;
+    rayCaster.gradients = &gradient;
+    rayCaster.ambientOcclusion = occluded;
+    rayCaster.filter = filter;
+    LabelVolume labels(volume.width, volume.height, volume.depth);
+    if (benchmarkLabeling && labelFile.empty() && labelBands <= 0)
+        labelBands = LABEL_BANDS;
+    if (!labelFile.empty() && !labels.load(labelFile.c_str()))
+    {
+        std::cout << "Failed to read " << labelFile << std::endl;
+        return -1;
+    }
+    else if (labelFile.empty() && labelBands > 0)
+        labels.segmentByValue(volume, labelBands);
+    if (!labelStyleFile.empty() && !labels.loadStyles(labelStyleFile))
+    {
+        std::cout << "Failed to read " << labelStyleFile << std::endl;
+        return -1;
+    }
+    for(int label : hiddenLabels)
+    {
+        if (label < 0 || label >= labels.labelCount)
+            continue;
+        LabelStyle style = labels.styles[label];
+        style.visible = false;
+        labels.setStyle(label, style);
+    }
+    if (!labelFile.empty() || labelBands > 0)
+        rayCaster.labels = &labels;
+    if (!gradientFile.empty() && !rayCaster.transferFunction2D.load(gradientFile))
+    {
+        std::cout << "Failed to read " << gradientFile << std::endl;
+        return -1;
+    }
+    if (benchmarkFusing && fusedFile.empty() && fusedDownsample <= 0)
+        fusedDownsample = FUSED_DOWNSAMPLE;
+    if (!gradientFile.empty() || shading == SHADING_PRECOMPUTED || (fusedFile.empty() && fusedDownsample > 0))
+    {
+        gradient.build(rayCaster.simd, rayCaster.threadCount);
+        std::cout << "gradient magnitudes " << (gradient.quantizeNormals ? "and normals " : "") << "computed in " << gradient.milliseconds << " ms" << std::endl;
+    }
+    if (!gradientFile.empty())
+        rayCaster.gradientMagnitude = &gradient.magnitude;
+    Volume fusedData(std::max(fusedWidth, 1), std::max(fusedHeight, 1), std::max(fusedDepth, 1));
+    if (!fusedFile.empty() && !fusedData.load(fusedFile.c_str()))
+    {
+        std::cout << "Failed to read " << fusedFile << std::endl;
+        return -1;
+    }
+    else if (fusedFile.empty() && fusedDownsample > 0)
+        fusedData = gradient.magnitude.downsampled(fusedDownsample);
+    FusedVolume fused(fusedData);
+    if ((!fusedFile.empty() || fusedDownsample > 0) && !fused.transferFunction.load(fusedTransferFile))
+    {
+        std::cout << "Failed to read " << fusedTransferFile << std::endl;
+        return -1;
+    }
+    fused.texFromWorld = primaryTexFromWorld() * glm::translate(glm::mat4(1.0f), -fusedOffset);
+    fused.op = fusionType;
+    fused.weight = fusionWeight;
+    if (!fusedFile.empty() || fusedDownsample > 0)
+        rayCaster.fusion = &fused;
+    if (automaticTransfer)
+    {
+        VolumeHistogram histogram;
+        histogram.build(volume, rayCaster.gradientMagnitude, rayCaster.threadCount);
+        AutoTransfer automatic;
+        automatic.analyze(histogram);
+        rayCaster.transferFunction.setPoints(automatic.points);
+        if (rayCaster.gradientMagnitude != nullptr)
+            rayCaster.transferFunction2D.setWidgets(automatic.widgets);
+        std::cout << "automatic transfer function in " << histogram.milliseconds + automatic.milliseconds << " ms: window "
+                  << automatic.window() << " level " << automatic.level() << ", " << automatic.materials.size() << " materials, "
+                  << automatic.boundaries.size() << " boundaries" << std::endl;
+    }
+
+    if (benchmark)
+    {
+        benchmarkSimd(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkSkip)
+    {
+        benchmarkSkipping(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkAdapt)
+    {
+        benchmarkAdaptive(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkProject)
+    {
+        benchmarkProjection(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkPreIntegrate)
+    {
+        benchmarkPreIntegration(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkGradients)
+    {
+        benchmarkGradient(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkClassify)
+    {
+        benchmarkClassification(rayCaster);
+        return 0;
+    }
+    if (benchmarkAuto)
+    {
+        benchmarkAutoTransfer(rayCaster);
+        return 0;
+    }
+    if (benchmarkShade)
+    {
+        benchmarkShading(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkOcclude)
+    {
+        benchmarkOcclusion(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkCubicFilter)
+    {
+        benchmarkCubic(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkLabeling)
+    {
+        benchmarkLabels(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+    if (benchmarkFusing)
+    {
+        benchmarkFusion(rayCaster, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+
+    ShearWarpRenderer shearWarp(volume, sliceSpacing);
+    shearWarp.threadCount = rayCaster.threadCount;
+    shearWarp.opacityThreshold = termination;
+    shearWarp.transferFunction = rayCaster.transferFunction;
+    if (benchmarkWarp)
+    {
+        benchmarkShearWarp(rayCaster, shearWarp, camera.GetViewMatrix(), headlessProjection, width, height);
+        return 0;
+    }
+
+    Image image(width, height);
+    if (orbitFrames > 0)
+        renderOrbit(rayCaster, headlessProjection, orbitFrames, image);
+    else if (progressiveBudget > 0.0f)
+        renderProgressive(rayCaster, headlessProjection, progressiveBudget, image);
+    else if (shearWarpScale > 0.0f)
+    {
+        ShearWarpStats stats;
+        shearWarp.intermediateScale = shearWarpScale;
+        shearWarp.render(camera.GetViewMatrix(), headlessProjection, image, &stats);
+        std::cout << "shear-warp rendered " << width << "x" << height << " on " << shearWarp.threadCount << " threads in " << stats.milliseconds
+                  << " ms (encode " << stats.encodeMilliseconds << ", composite " << stats.compositeMilliseconds << ", warp " << stats.warpMilliseconds
+                  << "), " << stats.samples << " samples, " << stats.intermediatePixels << " intermediate pixels" << std::endl;
+        printSchedulerStats(shearWarp.scheduling, workerStats);
+    }
+    else
+    {
+        RayCastStats stats;
+        rayCaster.render(camera.GetViewMatrix(), headlessProjection, image, &stats);
+        std::cout << "rendered " << width << "x" << height << " on " << rayCaster.threadCount << " threads (" << simdName(rayCaster.simd) << ") in "
+                  << stats.milliseconds << " ms, " << stats.samples << " samples (" << (double)stats.samples / max(stats.rays, 1ull)
+                  << " per ray), " << stats.skippedSamples << " skipped" << std::endl;
+        if (rayCaster.ambientOcclusion)
+            std::cout << "ambient occlusion computed in " << rayCaster.occlusion.buildMilliseconds << " ms" << std::endl;
+        if (rayCaster.fusion != nullptr)
+            std::cout << fusionName(fused.op) << " fusion with " << fusedData.width << "x" << fusedData.height << "x" << fusedData.depth
+                      << " voxels, its occupancy marked in " << fused.occupancyMilliseconds << " ms" << std::endl;
+        printSchedulerStats(rayCaster.scheduling, workerStats);
+    }
+
+    if (!image.write(output))
+    {
+        std::cout << "Failed to write " << output << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+//Load balance of a TileScheduler run, optionally broken down per worker.
+void printSchedulerStats(const SchedulerStats& stats, bool perWorker)
+{
+    std::cout << "scheduler: " << stats.workers.size() << " workers, " << 100.0 * stats.efficiency() << "% busy, "
+              << stats.steals() << " steals, " << stats.wallMilliseconds << " ms wall" << std::endl;
+    if (!perWorker)
+        return;
+    for(size_t t = 0; t < stats.workers.size(); t++)
+    {
+        const WorkerStats& worker = stats.workers[t];
+        std::cout << "  worker " << t << ": " << worker.tiles << " tiles, " << worker.splits << " splits, "
+                  << worker.steals << " steals, " << worker.failedSteals << " failed steal rounds, "
+                  << worker.busyMilliseconds << " ms busy ("
+                  << (stats.wallMilliseconds > 0.0 ? 100.0 * worker.busyMilliseconds / stats.wallMilliseconds : 0.0) << "%)" << std::endl;
+    }
+}
+
+//Throughput of every ray packet kernel this CPU runs, on one thread and on all of them,
+//with the largest channel difference to the scalar path.
+void benchmarkSimd(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    unsigned int allThreads = rayCaster.threadCount;
+    Image reference(width, height), image(width, height);
+    double scalarRate = 0.0;
+
+    for(int isa = SIMD_SCALAR; isa <= SIMD_AVX512; isa++)
+    {
+        if (!simdAvailable((SimdIsa)isa))
+        {
+            std::cout << simdName((SimdIsa)isa) << ": not available" << std::endl;
+            continue;
+        }
+        rayCaster.simd = (SimdIsa)isa;
+
+        double rate[2];
+        unsigned int threadCounts[2] = {1, allThreads};
+        for(int t = 0; t < 2; t++)
+        {
+            rayCaster.threadCount = threadCounts[t];
+            //Best of a few runs, the first one also warms the caches and builds the padded volume.
+            double best = 0.0;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                RayCastStats stats;
+                rayCaster.render(view, projection, isa == SIMD_SCALAR ? reference : image, &stats);
+                best = max(best, stats.samples / (stats.milliseconds * 1.0e-3) / threadCounts[t]);
+            }
+            rate[t] = best;
+        }
+        if (isa == SIMD_SCALAR)
+            scalarRate = rate[0];
+
+        float maxDiff = 0.0f;
+        if (isa != SIMD_SCALAR)
+            for(size_t i = 0; i < image.pixels.size(); i++)
+                for(int c = 0; c < 4; c++)
+                    maxDiff = max(maxDiff, fabsf(image.pixels[i][c] - reference.pixels[i][c]));
+
+        std::cout << simdName((SimdIsa)isa) << ": " << rate[0] / 1.0e6 << " M samples/s/core on 1 thread, "
+                  << rate[1] / 1.0e6 << " M samples/s/core on " << allThreads << " threads, "
+                  << rate[0] / scalarRate << "x scalar, max diff " << maxDiff << std::endl;
+    }
+    rayCaster.threadCount = allThreads;
+}
+
+//Renders the view with and without empty-space skipping and reports the samples it saves.
+void benchmarkSkipping(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    Image reference(width, height), image(width, height);
+    RayCastStats best[2];
+    double gridTime = 0.0;
+
+    for(int pass = 0; pass < 2; pass++)
+    {
+        rayCaster.emptySpaceSkipping = pass == 1;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, pass == 0 ? reference : image, &stats);
+            //The grid is built by the first render that skips and reused after.
+            if (pass == 1 && r == 0)
+                gridTime = rayCaster.gridMilliseconds;
+            if (r == 0 || stats.milliseconds < best[pass].milliseconds)
+                best[pass] = stats;
+        }
+    }
+
+    float maxDiff = 0.0f;
+    for(size_t i = 0; i < image.pixels.size(); i++)
+        for(int c = 0; c < 4; c++)
+            maxDiff = max(maxDiff, fabsf(image.pixels[i][c] - reference.pixels[i][c]));
+
+    unsigned long long total = best[1].samples + best[1].skippedSamples;
+    std::cout << rayCaster.volume.width << "x" << rayCaster.volume.height << "x" << rayCaster.volume.depth << " volume, "
+              << 100.0f * rayCaster.grid.emptyFraction() << "% of " << rayCaster.grid.brickSize << "^3 bricks empty, "
+              << rayCaster.grid.levels.size() << " levels, built in " << gridTime << " ms" << std::endl;
+    std::cout << "no skipping: " << best[0].milliseconds << " ms, " << best[0].samples << " samples" << std::endl;
+    std::cout << "skipping:    " << best[1].milliseconds << " ms, " << best[1].samples << " samples, " << best[1].skippedSamples
+              << " skipped (" << (total ? 100.0 * best[1].skippedSamples / total : 0.0) << "%), "
+              << best[0].milliseconds / best[1].milliseconds << "x speedup, max diff " << maxDiff << std::endl;
+}
+
+//Every projection other than compositing cast naively, sampling all planes (up to the
+//isosurface hit), against skipping the grid nodes that cannot change the ray's result.
+void benchmarkProjection(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    Image reference(width, height), image(width, height);
+
+    for(int mode = PROJECTION_MAXIMUM; mode < PROJECTION_MODE_COUNT; mode++)
+    {
+        rayCaster.projectionMode = (ProjectionMode)mode;
+        RayCastStats best[2];
+        for(int pass = 0; pass < 2; pass++)
+        {
+            rayCaster.projectionSkipping = pass == 1;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                RayCastStats stats;
+                rayCaster.render(view, projection, pass == 0 ? reference : image, &stats);
+                if (r == 0 || stats.milliseconds < best[pass].milliseconds)
+                    best[pass] = stats;
+            }
+        }
+
+        float maxDiff = 0.0f;
+        for(size_t i = 0; i < image.pixels.size(); i++)
+            for(int c = 0; c < 4; c++)
+                maxDiff = max(maxDiff, fabsf(image.pixels[i][c] - reference.pixels[i][c]));
+        std::cout << projectionName((ProjectionMode)mode) << ": naive " << best[0].milliseconds << " ms, " << best[0].samples
+                  << " samples; skipping " << best[1].milliseconds << " ms, " << best[1].samples << " samples, "
+                  << best[0].milliseconds / best[1].milliseconds << "x speedup, max diff " << maxDiff << std::endl;
+    }
+}
+
+//Strides of 1 to 8 planes, post-classified and pre-integrated, on the scalar path against
+//planes 8 times denser with the opacity corrected down, then a full and an incremental table rebuild.
+void benchmarkPreIntegration(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const int OVERSAMPLING = 8;
+    Image reference(width, height), image(width, height);
+    RayCaster dense(rayCaster.volume, rayCaster.sliceSpacing / OVERSAMPLING);
+    dense.threadCount = rayCaster.threadCount;
+    dense.transferFunction = rayCaster.transferFunction;
+    for(glm::vec4& entry : dense.transferFunction.table)
+        entry = correctOpacity(entry, 1.0f / OVERSAMPLING);
+    dense.render(view, projection, reference);
+
+    SimdIsa simd = rayCaster.simd;
+    rayCaster.simd = SIMD_SCALAR;
+    rayCaster.adaptiveStep = false;
+
+    const int STRIDES[4] = {1, 2, 4, 8};
+    for(int s = 0; s < 4; s++)
+    {
+        rayCaster.sampleStride = STRIDES[s];
+        for(int pass = 0; pass < 2; pass++)
+        {
+            rayCaster.preIntegrated = pass == 1;
+            RayCastStats best;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                RayCastStats stats;
+                rayCaster.render(view, projection, image, &stats);
+                if (r == 0 || stats.milliseconds < best.milliseconds)
+                    best = stats;
+            }
+
+            double squares = 0.0;
+            for(size_t i = 0; i < image.pixels.size(); i++)
+                for(int c = 0; c < 4; c++)
+                    squares += (image.pixels[i][c] - reference.pixels[i][c]) * (image.pixels[i][c] - reference.pixels[i][c]);
+            double rmse = sqrt(squares / (image.pixels.size() * 4));
+            std::cout << "stride " << STRIDES[s] << (pass == 1 ? ", pre-integrated: " : ", post-classified: ") << best.milliseconds << " ms, "
+                      << best.samples << " samples, PSNR " << (rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY) << " dB" << std::endl;
+        }
+    }
+
+    PreIntegrationTable& table = rayCaster.preIntegration;
+    TransferFunction edited = rayCaster.transferFunction;
+    table.update(edited, 1.0f);
+    std::cout << "pre-integration table: " << table.rebuiltEntries << " entries in " << table.buildMilliseconds << " ms on "
+              << table.threadCount << " threads" << std::endl;
+    //Nudge the control point with the highest value, only segments reaching past the next lower one change.
+    vector<TransferPoint> points = edited.points;
+    points.back().value = max(points.back().value - TRANSFER_SHIFT, points.size() > 1 ? points[points.size() - 2].value : 0.0f);
+    edited.setPoints(points);
+    if (table.update(edited, 1.0f))
+        std::cout << "after moving the last control point: " << table.rebuiltEntries << " entries in " << table.buildMilliseconds << " ms" << std::endl;
+    rayCaster.preIntegrated = false;
+    rayCaster.sampleStride = 1;
+    rayCaster.simd = simd;
+}
+
+//Gradient magnitude volume built per instruction set on 1 thread and all of them, checked
+//against the scalar build, then the scalar ray caster classifying by value against the
+//2D transfer function that repeats the same 1D one for every magnitude.
+void benchmarkGradient(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const Volume& volume = rayCaster.volume;
+    GradientMagnitude reference(volume);
+    reference.build(SIMD_SCALAR, 1);
+    std::cout << "gradient magnitudes of " << volume.width << "x" << volume.height << "x" << volume.depth << ": "
+              << volume.voxelCount() / (1024.0 * 1024.0) << " MB, interleaved with the values "
+              << 2.0 * volume.voxelCount() / (1024.0 * 1024.0) << " MB" << std::endl;
+
+    unsigned int threadCounts[2] = {1, rayCaster.threadCount};
+    for(int isa = SIMD_SCALAR; isa <= SIMD_AVX512; isa++)
+    {
+        if (!simdAvailable((SimdIsa)isa))
+        {
+            std::cout << simdName((SimdIsa)isa) << ": not available" << std::endl;
+            continue;
+        }
+        GradientMagnitude gradient(volume);
+        double best[2];
+        for(int t = 0; t < 2; t++)
+        {
+            best[t] = 0.0;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                gradient.build((SimdIsa)isa, threadCounts[t]);
+                if (r == 0 || gradient.milliseconds < best[t])
+                    best[t] = gradient.milliseconds;
+            }
+        }
+        std::cout << simdName((SimdIsa)isa) << ": " << best[0] << " ms on 1 thread, " << best[1] << " ms on " << threadCounts[1]
+                  << " threads, " << (gradient.magnitude.data == reference.magnitude.data ? "identical" : "DIFFERENT") << std::endl;
+    }
+
+    SimdIsa simd = rayCaster.simd;
+    rayCaster.simd = SIMD_SCALAR;
+    rayCaster.transferFunction2D.setTransferFunction(rayCaster.transferFunction);
+    Image oneD(width, height), twoD(width, height);
+    RayCastStats best[2];
+    for(int pass = 0; pass < 2; pass++)
+    {
+        rayCaster.gradientMagnitude = pass == 1 ? &reference.magnitude : nullptr;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, pass == 1 ? twoD : oneD, &stats);
+            if (r == 0 || stats.milliseconds < best[pass].milliseconds)
+                best[pass] = stats;
+        }
+    }
+    float maxDiff = 0.0f;
+    for(size_t i = 0; i < oneD.pixels.size(); i++)
+        for(int c = 0; c < 4; c++)
+            maxDiff = max(maxDiff, fabsf(oneD.pixels[i][c] - twoD.pixels[i][c]));
+    std::cout << "scalar ray casting, 1D: " << best[0].milliseconds << " ms, 2D: " << best[1].milliseconds << " ms, max diff " << maxDiff << std::endl;
+    rayCaster.gradientMagnitude = nullptr;
+    rayCaster.simd = simd;
+}
+
+//Reclassification latency of the min-max grid after a transfer function edit, for the
+//loaded volume and synthetic ones of growing size, on 1 thread and all of them, against
+//scanning every node's value range.
+void benchmarkClassification(RayCaster& rayCaster)
+{
+    const int REPETITIONS = 3;
+    const int SIZES[3] = {128, 256, 512};
+    vector<float> opacity = rayCaster.transferFunction.opacity();
+    unsigned int threadCounts[2] = {1, rayCaster.threadCount};
+
+    for(int v = -1; v < 3; v++)
+    {
+        Volume synthetic(v < 0 ? 1 : SIZES[v], v < 0 ? 1 : SIZES[v], v < 0 ? 1 : SIZES[v]);
+        if (v >= 0)
+            synthetic.fillSparse(64);
+        const Volume& volume = v < 0 ? rayCaster.volume : synthetic;
+        MinMaxGrid grid(volume);
+        grid.build(rayCaster.threadCount);
+
+        double best[2];
+        for(int t = 0; t < 2; t++)
+        {
+            best[t] = 0.0;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                grid.classify(opacity, threadCounts[t]);
+                if (r == 0 || grid.classifyMilliseconds < best[t])
+                    best[t] = grid.classifyMilliseconds;
+            }
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        size_t mismatches = 0;
+        for(const MinMaxGrid::Level& level : grid.levels)
+        {
+            for(size_t i = 0; i < level.minValue.size(); i++)
+            {
+                bool transparent = true;
+                for(int value = level.minValue[i]; value <= level.maxValue[i] && transparent; value++)
+                    transparent = opacity[value] <= 0.0f;
+                mismatches += transparent != (level.empty[i] != 0);
+            }
+        }
+        double scan = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+        std::cout << volume.width << "x" << volume.height << "x" << volume.depth << ", " << grid.nodeCount() << " nodes: "
+                  << best[0] << " ms on 1 thread, " << best[1] << " ms on " << threadCounts[1] << " threads, range scan "
+                  << scan << " ms, " << mismatches << " mismatches" << std::endl;
+    }
+}
+
+//Value and joint histograms on 1 thread and all of them against one counter per voxel,
+//then what AutoTransfer finds in them.
+void benchmarkAutoTransfer(RayCaster& rayCaster)
+{
+    const int REPETITIONS = 3;
+    const Volume& volume = rayCaster.volume;
+    GradientMagnitude gradient(volume);
+    gradient.build(rayCaster.simd, rayCaster.threadCount);
+
+    auto start = std::chrono::high_resolution_clock::now();
+    vector<unsigned int> naive(VolumeHistogram::SIZE, 0);
+    for(unsigned char value : volume.data)
+        naive[value]++;
+    double naiveTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    std::cout << volume.width << "x" << volume.height << "x" << volume.depth << ", one counter per voxel: " << naiveTime << " ms" << std::endl;
+
+    unsigned int threadCounts[2] = {1, rayCaster.threadCount};
+    VolumeHistogram histogram;
+    for(int joint = 0; joint < 2; joint++)
+    {
+        double best[2];
+        for(int t = 0; t < 2; t++)
+        {
+            best[t] = 0.0;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                histogram.build(volume, joint == 1 ? &gradient.magnitude : nullptr, threadCounts[t]);
+                if (r == 0 || histogram.milliseconds < best[t])
+                    best[t] = histogram.milliseconds;
+            }
+        }
+        bool same = true;
+        for(int v = 0; v < VolumeHistogram::SIZE; v++)
+            same = same && histogram.counts[v] == naive[v];
+        AutoTransfer automatic;
+        automatic.analyze(histogram);
+        std::cout << (joint == 1 ? "value x gradient magnitude: " : "value: ") << best[0] << " ms on 1 thread, " << best[1] << " ms on "
+                  << threadCounts[1] << " threads, " << (same ? "identical" : "DIFFERENT") << " counts, analysis " << automatic.milliseconds
+                  << " ms" << std::endl;
+        std::cout << "  window " << automatic.windowLow << " to " << automatic.windowHigh << " (level " << automatic.level() << "), materials";
+        for(int m : automatic.materials)
+            std::cout << " " << m;
+        if (joint == 1)
+        {
+            std::cout << ", boundaries";
+            for(int b : automatic.boundaries)
+                std::cout << " " << b;
+        }
+        std::cout << std::endl;
+    }
+}
+
+//Precomputing the quantized normals per instruction set, what they cost in memory, and
+//the scalar ray caster unlit, shaded with six extra samples and with the normals.
+void benchmarkShading(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const Volume& volume = rayCaster.volume;
+    GradientMagnitude gradient(volume);
+    gradient.quantizeNormals = true;
+    for(int isa = SIMD_SCALAR; isa <= SIMD_AVX512; isa++)
+    {
+        if (!simdAvailable((SimdIsa)isa))
+            continue;
+        double best = 0.0;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            gradient.build((SimdIsa)isa, rayCaster.threadCount);
+            if (r == 0 || gradient.milliseconds < best)
+                best = gradient.milliseconds;
+        }
+        std::cout << "normals and magnitudes, " << simdName((SimdIsa)isa) << ": " << best << " ms on " << rayCaster.threadCount << " threads" << std::endl;
+    }
+    double megabytes = volume.voxelCount() / (1024.0 * 1024.0);
+    std::cout << "memory: values " << megabytes << " MB; on the fly nothing more; precomputed " << 3.0 * megabytes
+              << " MB more (2 bytes of normal index, 1 of magnitude) and a "
+              << GradientMagnitude::NORMAL_TABLE_SIZE * sizeof(glm::vec3) / 1024 << " KB table" << std::endl;
+
+    SimdIsa simd = rayCaster.simd;
+    rayCaster.simd = SIMD_SCALAR;
+    rayCaster.gradients = &gradient;
+    vector<Image> images(SHADING_MODE_COUNT, Image(width, height));
+    for(int mode = 0; mode < SHADING_MODE_COUNT; mode++)
+    {
+        rayCaster.shading = (ShadingMode)mode;
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, images[mode], &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        std::cout << shadingName((ShadingMode)mode) << ": " << best.milliseconds << " ms, "
+                  << best.samples / (best.milliseconds * 1.0e3) << " M samples/s";
+        if (mode == SHADING_PRECOMPUTED)
+        {
+            double squares = 0.0;
+            for(size_t i = 0; i < images[mode].pixels.size(); i++)
+                for(int c = 0; c < 4; c++)
+                    squares += (images[mode].pixels[i][c] - images[SHADING_GRADIENT].pixels[i][c]) * (images[mode].pixels[i][c] - images[SHADING_GRADIENT].pixels[i][c]);
+            double rmse = sqrt(squares / (images[mode].pixels.size() * 4));
+            std::cout << ", PSNR against the gradient " << (rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY) << " dB";
+        }
+        std::cout << std::endl;
+    }
+    rayCaster.shading = SHADING_NONE;
+    rayCaster.simd = simd;
+}
+
+//Building the ambient occlusion volume on one thread and on all, updating it after transfer
+//function edits against building it again, and what it adds to a scalar frame.
+void benchmarkOcclusion(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const int EDITS = 3;
+    const Volume& volume = rayCaster.volume;
+    unsigned int threadCounts[2] = {1, rayCaster.threadCount};
+    for(int t = 0; t < (threadCounts[1] > 1 ? 2 : 1); t++)
+    {
+        double best = 0.0;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            AmbientOcclusion occlusion(volume);
+            occlusion.threadCount = threadCounts[t];
+            occlusion.update(rayCaster.transferFunction.opacity());
+            if (r == 0 || occlusion.buildMilliseconds < best)
+                best = occlusion.buildMilliseconds;
+        }
+        std::cout << "build on " << threadCounts[t] << " threads: " << best << " ms" << std::endl;
+    }
+
+    AmbientOcclusion occlusion(volume);
+    occlusion.threadCount = rayCaster.threadCount;
+    occlusion.update(rayCaster.transferFunction.opacity());
+    std::cout << occlusion.width << "x" << occlusion.height << "x" << occlusion.depth << " cells of " << occlusion.cellSize << "^3 voxels, "
+              << occlusion.visibility.size() / 1024.0 << " KB of visibility" << std::endl;
+    //The control points move the way [ and ] move them.
+    TransferFunction edited = rayCaster.transferFunction;
+    for(int e = 0; e < EDITS; e++)
+    {
+        vector<TransferPoint> points = edited.points;
+        for(TransferPoint& point : points)
+            point.value = glm::clamp(point.value + TRANSFER_SHIFT, 0.0f, 255.0f);
+        edited.setPoints(points);
+        occlusion.update(edited.opacity());
+        AmbientOcclusion rebuilt(volume);
+        rebuilt.threadCount = rayCaster.threadCount;
+        rebuilt.update(edited.opacity());
+        std::cout << "edit " << e + 1 << ": update " << occlusion.buildMilliseconds << " ms (" << occlusion.rebuiltCells << " densities, "
+                  << occlusion.occludedCells << " visibilities), build " << rebuilt.buildMilliseconds << " ms, "
+                  << (occlusion.visibility == rebuilt.visibility ? "identical" : "DIFFERENT") << std::endl;
+    }
+
+    SimdIsa simd = rayCaster.simd;
+    rayCaster.simd = SIMD_SCALAR;
+    Image image(width, height);
+    double milliseconds[2];
+    for(int on = 0; on < 2; on++)
+    {
+        rayCaster.ambientOcclusion = on != 0;
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, image, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        milliseconds[on] = best.milliseconds;
+        std::cout << (on ? "scalar frame with ambient occlusion: " : "scalar frame without: ") << best.milliseconds << " ms, "
+                  << best.samples / (best.milliseconds * 1.0e3) << " M samples/s" << std::endl;
+    }
+    std::cout << "per frame overhead: " << 100.0 * (milliseconds[1] / milliseconds[0] - 1.0) << "%" << std::endl;
+    rayCaster.ambientOcclusion = false;
+    rayCaster.simd = simd;
+}
+
+//Trilinear against cubic B-spline frames per instruction set, what the eight fetches cost,
+//and how far both land from the B-spline taken directly from 64 voxels per sample.
+void benchmarkCubic(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    SimdIsa simd = rayCaster.simd;
+    Image reference(width, height), image(width, height);
+    rayCaster.simd = SIMD_SCALAR;
+    rayCaster.filter = FILTER_CUBIC_REFERENCE;
+    RayCastStats referenceStats;
+    rayCaster.render(view, projection, reference, &referenceStats);
+    std::cout << "64 voxel reference, scalar: " << referenceStats.milliseconds << " ms" << std::endl;
+
+    for(int isa = SIMD_SCALAR; isa <= SIMD_AVX512; isa++)
+    {
+        if (!simdAvailable((SimdIsa)isa))
+            continue;
+        rayCaster.simd = (SimdIsa)isa;
+        double milliseconds[2];
+        for(int f = FILTER_TRILINEAR; f <= FILTER_CUBIC; f++)
+        {
+            rayCaster.filter = (VolumeFilter)f;
+            RayCastStats best;
+            for(int r = 0; r < REPETITIONS; r++)
+            {
+                RayCastStats stats;
+                rayCaster.render(view, projection, image, &stats);
+                if (r == 0 || stats.milliseconds < best.milliseconds)
+                    best = stats;
+            }
+            milliseconds[f] = best.milliseconds;
+            double squares = 0.0;
+            float maxDifference = 0.0f;
+            for(size_t i = 0; i < image.pixels.size(); i++)
+            {
+                for(int c = 0; c < 4; c++)
+                {
+                    float difference = image.pixels[i][c] - reference.pixels[i][c];
+                    squares += difference * difference;
+                    maxDifference = max(maxDifference, fabsf(difference));
+                }
+            }
+            double rmse = sqrt(squares / (image.pixels.size() * 4));
+            std::cout << simdName((SimdIsa)isa) << " " << filterName((VolumeFilter)f) << ": " << best.milliseconds << " ms, "
+                      << best.samples / (best.milliseconds * 1.0e3) << " M samples/s, PSNR against the reference "
+                      << (rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY) << " dB, max diff " << maxDifference << std::endl;
+        }
+        std::cout << simdName((SimdIsa)isa) << " cubic overhead: " << 100.0 * (milliseconds[FILTER_CUBIC] / milliseconds[FILTER_TRILINEAR] - 1.0)
+                  << "% on " << rayCaster.threadCount << " threads" << std::endl;
+    }
+    rayCaster.filter = FILTER_TRILINEAR;
+    rayCaster.simd = simd;
+}
+
+//Frames without and with labels, then each label hidden in turn: what setStyle() and the
+//grid update touch against listing the bricks and hiding them from scratch, which must
+//give the same empty nodes, and the samples the frame skips for it.
+void benchmarkLabels(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const int MAX_LABELS = 8;
+    LabelVolume& labels = *rayCaster.labels;
+    SimdIsa simd = rayCaster.simd;
+    rayCaster.simd = SIMD_SCALAR;
+    labels.threadCount = rayCaster.threadCount;
+    labels.buildBricks(rayCaster.grid.brickSize);
+    std::cout << labels.labelCount << " labels of " << 8 * labels.bytesPerLabel << " bits: " << labels.data.size() / (1024.0 * 1024.0) << " MB, "
+              << labels.brickBytes() / 1024.0 << " KB of brick lists built in " << labels.brickMilliseconds << " ms, "
+              << labels.tableRows() * 256 * sizeof(glm::vec4) / 1024.0 << " KB table" << std::endl;
+
+    Image image(width, height);
+    auto frame = [&]()
+    {
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, image, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        return best;
+    };
+    LabelVolume* labeled = rayCaster.labels;
+    for(int on = 0; on < 2; on++)
+    {
+        rayCaster.labels = on ? labeled : nullptr;
+        RayCastStats best = frame();
+        std::cout << (on ? "scalar frame with labels: " : "scalar frame without: ") << best.milliseconds << " ms, " << best.samples << " samples, "
+                  << 100.0f * rayCaster.grid.emptyFraction() << "% of the bricks empty" << std::endl;
+    }
+
+    std::vector<float> opacity = rayCaster.transferFunction.opacity();
+    for(int label = 1; label < std::min(labels.labelCount, MAX_LABELS + 1); label++)
+    {
+        LabelStyle style = labels.styles[label], hidden = style;
+        hidden.visible = false;
+        labels.setStyle(label, hidden);
+        double styleMilliseconds = labels.styleMilliseconds;
+        size_t visited = labels.visitedBricks, flipped = labels.changedBricks.size();
+        RayCastStats stats;
+        rayCaster.render(view, projection, image, &stats);
+        double updateMilliseconds = flipped > 0 ? rayCaster.grid.hideMilliseconds : 0.0;
+        size_t updatedNodes = flipped > 0 ? rayCaster.grid.hiddenUpdates : 0;
+        RayCastStats best = frame();
+
+        LabelVolume rebuilt = labels;
+        rebuilt.buildBricks(rayCaster.grid.brickSize);
+        MinMaxGrid fresh(rayCaster.volume, rayCaster.grid.brickSize);
+        fresh.filterRadius = rayCaster.grid.filterRadius;
+        fresh.build(rayCaster.threadCount);
+        fresh.classify(opacity, rayCaster.threadCount);
+        fresh.hide(rebuilt.brickHidden);
+        bool identical = true;
+        for(size_t l = 0; l < fresh.levels.size(); l++)
+            identical = identical && fresh.levels[l].empty == rayCaster.grid.levels[l].empty;
+
+        std::cout << "label " << label << " hidden: " << visited << " bricks visited, " << flipped << " flipped in " << styleMilliseconds << " ms, "
+                  << updatedNodes << " nodes updated in " << updateMilliseconds << " ms; from scratch " << rebuilt.brickMilliseconds << " + "
+                  << fresh.hideMilliseconds << " ms, " << (identical ? "identical" : "DIFFERENT") << "; frame " << best.milliseconds << " ms, "
+                  << best.samples << " samples, " << 100.0f * rayCaster.grid.emptyFraction() << "% of the bricks empty" << std::endl;
+        //Shown again before the next one is hidden.
+        labels.setStyle(label, style);
+        rayCaster.render(view, projection, image);
+    }
+    rayCaster.simd = simd;
+}
+
+//The volume alone, then fused by every operator (scalar path): frame time, samples, the
+//planes per pixel the proxy box spans and the bricks the fused volume keeps from being
+//skipped; every image is checked against the same frame without empty-space skipping.
+void benchmarkFusion(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    FusedVolume& fused = *rayCaster.fusion;
+    FusionOperator op = fused.op;
+    SimdIsa simd = rayCaster.simd;
+    bool skipping = rayCaster.emptySpaceSkipping;
+    rayCaster.simd = SIMD_SCALAR;
+    rayCaster.emptySpaceSkipping = true;
+    Image reference(width, height), image(width, height);
+    auto frame = [&]()
+    {
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, image, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        return best;
+    };
+
+    rayCaster.fusion = nullptr;
+    RayCastStats alone = frame();
+    std::vector<unsigned char> emptyAlone = rayCaster.grid.levels[0].empty;
+    std::cout << rayCaster.volume.width << "x" << rayCaster.volume.height << "x" << rayCaster.volume.depth << " volume alone: " << alone.milliseconds
+              << " ms, " << alone.samples << " samples, " << (double)(alone.samples + alone.skippedSamples) / alone.rays << " planes per pixel, "
+              << 100.0f * rayCaster.grid.emptyFraction() << "% of the bricks empty" << std::endl;
+
+    rayCaster.fusion = &fused;
+    for(int o = 0; o < FUSION_COUNT; o++)
+    {
+        fused.op = (FusionOperator)o;
+        rayCaster.emptySpaceSkipping = false;
+        rayCaster.render(view, projection, reference);
+        rayCaster.emptySpaceSkipping = true;
+        RayCastStats best = frame();
+
+        float maxDiff = 0.0f;
+        for(size_t i = 0; i < image.pixels.size(); i++)
+            for(int c = 0; c < 4; c++)
+                maxDiff = max(maxDiff, fabsf(image.pixels[i][c] - reference.pixels[i][c]));
+        const std::vector<unsigned char>& empty = rayCaster.grid.levels[0].empty;
+        size_t kept = 0;
+        for(size_t i = 0; i < empty.size(); i++)
+            kept += emptyAlone[i] && !empty[i];
+        std::cout << "fused " << fused.volume.width << "x" << fused.volume.height << "x" << fused.volume.depth << ", " << fusionName(fused.op) << ": "
+                  << best.milliseconds << " ms, " << best.samples << " samples, " << (double)(best.samples + best.skippedSamples) / best.rays
+                  << " planes per pixel, " << 100.0f * rayCaster.grid.emptyFraction() << "% of the bricks empty, " << kept
+                  << " kept for the fused volume, max diff to no skipping " << maxDiff << std::endl;
+    }
+    std::cout << "fused occupancy marked in " << fused.occupancyMilliseconds << " ms, applied to the grid in " << rayCaster.grid.occupyMilliseconds
+              << " ms" << std::endl;
+    fused.op = op;
+    rayCaster.simd = simd;
+    rayCaster.emptySpaceSkipping = skipping;
+}
+
+//Fixed steps against early termination at OPACITY_THRESHOLD (or the --termination
+//value), adaptive steps and both, with samples per ray and the error they cost.
+void benchmarkAdaptive(RayCaster& rayCaster, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    const char* names[4] = {"fixed step:          ", "early termination:   ", "adaptive step:       ", "termination+adaptive:"};
+    float threshold = rayCaster.opacityThreshold < 1.0f ? rayCaster.opacityThreshold : OPACITY_THRESHOLD;
+    Image reference(width, height), image(width, height);
+    double referenceTime = 0.0;
+
+    for(int mode = 0; mode < 4; mode++)
+    {
+        rayCaster.opacityThreshold = mode & 1 ? threshold : 1.0f;
+        rayCaster.adaptiveStep = (mode & 2) != 0;
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, mode == 0 ? reference : image, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        if (mode == 0)
+            referenceTime = best.milliseconds;
+
+        float maxDiff = 0.0f;
+        double sumDiff = 0.0;
+        if (mode != 0)
+        {
+            for(size_t i = 0; i < image.pixels.size(); i++)
+            {
+                for(int c = 0; c < 4; c++)
+                {
+                    float diff = fabsf(image.pixels[i][c] - reference.pixels[i][c]);
+                    maxDiff = max(maxDiff, diff);
+                    sumDiff += diff;
+                }
+            }
+        }
+
+        std::cout << names[mode] << " " << best.milliseconds << " ms, " << (double)best.samples / max(best.rays, 1ull) << " samples/ray, "
+                  << referenceTime / best.milliseconds << "x speedup, max error " << maxDiff
+                  << ", mean error " << sumDiff / (image.pixels.size() * 4) << std::endl;
+    }
+}
+
+//Brute-force ray casting (every plane sampled, scalar and in packets) against shear-warp
+//at growing intermediate resolution, with the image difference to the ray cast frame.
+void benchmarkShearWarp(RayCaster& rayCaster, ShearWarpRenderer& shearWarp, glm::mat4 view, glm::mat4 projection, int width, int height)
+{
+    const int REPETITIONS = 3;
+    Image reference(width, height), image(width, height);
+    rayCaster.emptySpaceSkipping = false;
+    rayCaster.adaptiveStep = false;
+
+    double rayCastTime[2] = {0.0, 0.0};
+    SimdIsa isas[2] = {SIMD_SCALAR, rayCaster.simd};
+    for(int pass = 0; pass < 2; pass++)
+    {
+        rayCaster.simd = isas[pass];
+        RayCastStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            RayCastStats stats;
+            rayCaster.render(view, projection, reference, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+        rayCastTime[pass] = best.milliseconds;
+        std::cout << "ray casting (" << simdName(isas[pass]) << "): " << best.milliseconds << " ms, " << best.samples << " samples" << std::endl;
+    }
+
+    double encodeTime = shearWarp.encode();
+    std::cout << "run-length encoding: " << encodeTime << " ms, " << 100.0f * shearWarp.storedFraction() << "% of the voxels stored, "
+              << shearWarp.memoryFootprint() / 1024 << " KB for three copies (" << 3 * rayCaster.volume.voxelCount() / 1024 << " KB dense)" << std::endl;
+
+    const float SCALES[3] = {1.0f, 2.0f, 3.0f};
+    for(int s = 0; s < 3; s++)
+    {
+        shearWarp.intermediateScale = SCALES[s];
+        ShearWarpStats best;
+        for(int r = 0; r < REPETITIONS; r++)
+        {
+            ShearWarpStats stats;
+            shearWarp.render(view, projection, image, &stats);
+            if (r == 0 || stats.milliseconds < best.milliseconds)
+                best = stats;
+        }
+
+        float maxDiff = 0.0f;
+        double squares = 0.0;
+        for(size_t i = 0; i < image.pixels.size(); i++)
+        {
+            for(int c = 0; c < 4; c++)
+            {
+                float diff = fabsf(image.pixels[i][c] - reference.pixels[i][c]);
+                maxDiff = max(maxDiff, diff);
+                squares += diff * diff;
+            }
+        }
+        double rmse = sqrt(squares / (image.pixels.size() * 4));
+
+        std::cout << "shear-warp x" << SCALES[s] << ": " << best.milliseconds << " ms (composite " << best.compositeMilliseconds
+                  << ", warp " << best.warpMilliseconds << "), " << best.samples << " samples, "
+                  << rayCastTime[0] / best.milliseconds << "x scalar / " << rayCastTime[1] / best.milliseconds << "x "
+                  << simdName(isas[1]) << " ray casting, PSNR " << (rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY)
+                  << " dB, max diff " << maxDiff << std::endl;
+    }
+}
+
+//Refines the view in budget ms steps like a frame loop would. After the first image the
+//camera takes one keypad step, which restarts the refinement for the new view.
+void renderProgressive(RayCaster& rayCaster, glm::mat4 projection, float budget, Image& image)
+{
+    ProgressiveRenderer progressive(rayCaster, image.width, image.height);
+    for(int view = 0; view < 2; view++)
+    {
+        if (view == 1)
+            camera.rotateLeft();
+        progressive.restart(camera.GetViewMatrix(), projection);
+        int steps = 0;
+        do
+        {
+            progressive.refine(budget);
+            steps++;
+        }
+        while (!progressive.converged() && (view == 1 || progressive.passIndex() == 0));
+
+        const ProgressiveStats& stats = progressive.stats;
+        std::cout << (view == 0 ? "initial view: " : "after camera step: ") << "first image " << stats.firstImageMilliseconds << " ms";
+        if (progressive.converged())
+        {
+            std::cout << ", converged " << stats.convergedMilliseconds << " ms in " << steps << " refine steps of " << budget << " ms, passes at";
+            for(size_t p = 0; p < stats.passMilliseconds.size(); p++)
+                std::cout << " " << stats.passMilliseconds[p];
+            std::cout << " ms, " << stats.rays << " rays, " << stats.cancelledTiles << " tiles cancelled by the restart";
+        }
+        std::cout << std::endl;
+    }
+    image = progressive.image;
+}
+
+//Orbits the camera by rotateLeft() steps, reprojecting every frame from the last one, and
+//compares each frame with a full render of the same view.
+void renderOrbit(RayCaster& rayCaster, glm::mat4 projection, int frames, Image& image)
+{
+    ReprojectionCache cache(rayCaster);
+    Image reference(image.width, image.height);
+    double cacheTime = 0.0, fullTime = 0.0, recastFraction = 0.0, dataFraction = 0.0, meanError = 0.0;
+    float maxError = 0.0f;
+
+    for(int f = 0; f <= frames; f++)
+    {
+        if (f > 0)
+            camera.rotateLeft();
+        ReprojectionStats stats;
+        cache.render(camera.GetViewMatrix(), projection, image, &stats);
+        RayCastStats full;
+        rayCaster.render(camera.GetViewMatrix(), projection, reference, &full);
+        if (f == 0)
+            continue;
+
+        float frameMax = 0.0f;
+        double frameSum = 0.0;
+        for(size_t i = 0; i < image.pixels.size(); i++)
+        {
+            for(int c = 0; c < 4; c++)
+            {
+                float diff = fabsf(image.pixels[i][c] - reference.pixels[i][c]);
+                frameMax = max(frameMax, diff);
+                frameSum += diff;
+            }
+        }
+        double frameMean = frameSum / (image.pixels.size() * 4);
+        unsigned long long dataPixels = stats.pixels - stats.background;
+
+        cacheTime += stats.milliseconds;
+        fullTime += full.milliseconds;
+        recastFraction += stats.recastFraction();
+        dataFraction += dataPixels > 0 ? (double)stats.recast() / dataPixels : 0.0;
+        maxError = max(maxError, frameMax);
+        meanError += frameMean;
+        if (f % 10 == 0 || f == frames)
+            std::cout << "frame " << f << ": " << stats.milliseconds << " ms (full " << full.milliseconds << " ms), re-cast "
+                      << 100.0 * stats.recastFraction() << "% of the rays (" << stats.disoccluded << " disoccluded, " << stats.edges
+                      << " at edges, " << stats.refreshed << " refreshed), max diff " << frameMax << ", mean diff " << frameMean << std::endl;
+    }
+    if (frames > 0)
+        std::cout << "orbit of " << frames << " frames: " << cacheTime / frames << " ms per frame against " << fullTime / frames
+                  << " ms full, " << 100.0 * recastFraction / frames << "% of all rays and " << 100.0 * dataFraction / frames
+                  << "% of the rays hitting the data re-cast, max diff " << maxError << ", mean diff " << meanError / frames << std::endl;
+}
+
+// glfw: whenever the window size changed (by OS or user resize) this callback function executes
+// ---------------------------------------------------------------------------------------------
+void framebuffer_size_callback(GLFWwindow* window, int width, int height)
+{
+    // make sure the viewport matches the new window dimensions; note that width and 
+    // height will be significantly larger than specified on retina displays.
+    glViewport(0, 0, width, height);
+    if (width > 0 && height > 0)
+    {
+        framebufferWidth = width;
+        framebufferHeight = height;
+        createAccumulationBuffer(width, height);
+    }
+}
+
+// glfw: toggles that must fire once per key press rather than every frame
+// -----------------------------------------------------------------------
+void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods)
+{
+    if (action != GLFW_PRESS)
+        return;
+
+    if (key == GLFW_KEY_F)
+    {
+        frontToBack = !frontToBack;
+        std::cout << (frontToBack ? "front-to-back compositing" : "back-to-front compositing") << std::endl;
+    }
+
+    if (key == GLFW_KEY_G)
+    {
+        gpuProxy = !gpuProxy;
+        std::cout << (gpuProxy ? "slice polygons generated in the vertex shader" : "slice polygons generated on the CPU") << std::endl;
+    }
+
+    //Half-angle slices and everything but the stacks read the 3D texture.
+    if ((key == GLFW_KEY_H || key == GLFW_KEY_T) && textureStacksForced)
+    {
+        std::cout << "the volume exceeds GL_MAX_3D_TEXTURE_SIZE, only 2D texture stacks are available" << std::endl;
+        return;
+    }
+
+    if (key == GLFW_KEY_H)
+    {
+        halfAngle = !halfAngle;
+        std::cout << (halfAngle ? "half-angle slicing with shadows" : "view-aligned slicing") << std::endl;
+    }
+
+    if (key == GLFW_KEY_T)
+    {
+        textureStacks = !textureStacks;
+        std::cout << (textureStacks ? "object-aligned 2D texture stacks" : "3D texture slicing") << std::endl;
+    }
+
+    if (key == GLFW_KEY_C)
+    {
+        frustumClipping = !frustumClipping;
+        std::cout << (frustumClipping ? "frustum clipping on" : "frustum clipping off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_M)
+    {
+        projectionMode = (ProjectionMode)((projectionMode + 1) % PROJECTION_MODE_COUNT);
+        createAccumulationBuffer(framebufferWidth, framebufferHeight);
+        std::cout << projectionName(projectionMode) << " projection" << (projectionMode != PROJECTION_COMPOSITE && (halfAngle || textureStacks)
+                  ? " (view-aligned 3D texture slicing only)" : "") << std::endl;
+    }
+
+    if (key == GLFW_KEY_L)
+    {
+        int first, last;
+        if (transferFunction.load(TRANSFER_FILE, &first, &last))
+            updateTransferTexture(first, last);
+        else
+            std::cout << "Failed to read " << TRANSFER_FILE << std::endl;
+    }
+
+    if (key == GLFW_KEY_LEFT_BRACKET || key == GLFW_KEY_RIGHT_BRACKET)
+    {
+        vector<TransferPoint> points = transferFunction.points;
+        for(TransferPoint& point : points)
+            point.value = glm::clamp(point.value + (key == GLFW_KEY_LEFT_BRACKET ? -TRANSFER_SHIFT : TRANSFER_SHIFT), 0.0f, 255.0f);
+        int first, last;
+        transferFunction.setPoints(points, &first, &last);
+        updateTransferTexture(first, last);
+    }
+
+    if (key == GLFW_KEY_I)
+    {
+        ambientOcclusion = !ambientOcclusion;
+        std::cout << (ambientOcclusion ? "ambient occlusion on" : "ambient occlusion off") << std::endl;
+    }
+
+    if (key == GLFW_KEY_Y)
+    {
+        cubicFiltering = !cubicFiltering;
+        std::cout << (cubicFiltering ? "cubic B-spline filtering" : "trilinear filtering") << std::endl;
+    }
+
+    if ((key == GLFW_KEY_Z || key == GLFW_KEY_X || key == GLFW_KEY_E) && labelTexture == 0)
+    {
+        std::cout << "the volume exceeds GL_MAX_3D_TEXTURE_SIZE, there is no label texture" << std::endl;
+        return;
+    }
+
+    if (key == GLFW_KEY_Z)
+    {
+        labelsEnabled = !labelsEnabled;
+        std::cout << (labelsEnabled ? "labels on, " : "labels off, ") << labels.labelCount << " labels" << std::endl;
+    }
+
+    if (key == GLFW_KEY_X)
+    {
+        selectedLabel = (selectedLabel + 1) % labels.labelCount;
+        std::cout << "label " << selectedLabel << (labels.styles[selectedLabel].visible ? " shown" : " hidden") << std::endl;
+    }
+
+    if (key == GLFW_KEY_E)
+    {
+        LabelStyle style = labels.styles[selectedLabel];
+        style.visible = !style.visible;
+        labels.setStyle(selectedLabel, style);
+        updateLabelTable(selectedLabel);
+        std::cout << "label " << selectedLabel << (style.visible ? " shown" : " hidden") << std::endl;
+    }
+
+    if (key == GLFW_KEY_Q)
+    {
+        fusionEnabled = !fusionEnabled;
+        std::cout << (fusionEnabled ? "fused gradient magnitudes, " : "fusion off, ") << fusionName(fusionOperator) << std::endl;
+    }
+
+    if (key == GLFW_KEY_R)
+    {
+        fusionOperator = (FusionOperator)((fusionOperator + 1) % FUSION_COUNT);
+        std::cout << "fusion operator " << fusionName(fusionOperator) << std::endl;
+    }
+
+    if (key == GLFW_KEY_N)
+    {
+        shadingMode = (ShadingMode)((shadingMode + 1) % SHADING_MODE_COUNT);
+        std::cout << "shading: " << shadingName(shadingMode) << std::endl;
+    }
+
+    //The automatic transfer function replaces the one in use, 2D with gradient classification.
+    if (key == GLFW_KEY_U)
+    {
+        if (gradientClassification)
+        {
+            transferFunction2D.setWidgets(autoTransfer.widgets);
+            glBindTexture(GL_TEXTURE_2D, transferTexture2D);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TransferFunction2D::SIZE, TransferFunction2D::SIZE, GL_RGBA, GL_FLOAT, transferFunction2D.table.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        else
+        {
+            int first, last;
+            transferFunction.setPoints(autoTransfer.points, &first, &last);
+            updateTransferTexture(first, last);
+        }
+        std::cout << "automatic transfer function, window " << autoTransfer.window() << " level " << autoTransfer.level() << ", "
+                  << autoTransfer.materials.size() << " materials, " << autoTransfer.boundaries.size() << " boundaries" << std::endl;
+    }
+
+    //The widgets are read again every time, so edits to the file show on the next K, K.
+    if (key == GLFW_KEY_K)
+    {
+        gradientClassification = !gradientClassification;
+        if (gradientClassification && transferFunction2D.load(TRANSFER_FILE_2D))
+        {
+            glBindTexture(GL_TEXTURE_2D, transferTexture2D);
+            glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, TransferFunction2D::SIZE, TransferFunction2D::SIZE, GL_RGBA, GL_FLOAT, transferFunction2D.table.data());
+            glBindTexture(GL_TEXTURE_2D, 0);
+        }
+        else if (gradientClassification)
+        {
+            std::cout << "Failed to read " << TRANSFER_FILE_2D << std::endl;
+            gradientClassification = false;
+        }
+        std::cout << (gradientClassification ? "classification by value and gradient magnitude" : "classification by value") << std::endl;
+    }
+
+    if (key == GLFW_KEY_J)
+    {
+        preIntegrated = !preIntegrated;
+        std::cout << (preIntegrated ? "pre-integrated classification" : "post-classification") << std::endl;
+    }
+
+    if (key == GLFW_KEY_COMMA || key == GLFW_KEY_PERIOD)
+    {
+        sliceSpacing = glm::clamp(sliceSpacing * (key == GLFW_KEY_PERIOD ? 2.0f : 0.5f), BASE_SLICE_SPACING, MAX_SLICE_SPACING);
+        std::cout << "slice spacing " << sliceSpacing << " (" << sliceSpacing / BASE_SLICE_SPACING << "x)" << std::endl;
+    }
+
+    if (key == GLFW_KEY_B)
+        benchmarkRequested = true;
+
+    if (key == GLFW_KEY_V)
+        validateRequested = true;
 }
 
 